@@ -0,0 +1,279 @@
+/*! \file bq.c
+ *
+ * DRE 2024
+ *
+ * Batching queue with an adaptive wake-up threshold, see bq.h.
+ */
+
+#include <stdlib.h>     /* aligned_alloc, free */
+#include <string.h>     /* memset */
+#include <errno.h>      /* errno, EINVAL, ENOMEM */
+#include <time.h>       /* struct timespec, CLOCK_MONOTONIC */
+#include "bq.h"         /* bq_t and external function prototypes */
+
+/**
+ * bq_create - allocate a batching queue and its ring
+ * @depth: ring slots, a power of two
+ * @width: payload bytes
+ * @policy: what bq_enq does when the ring is full
+ * @max_batch: most payloads one bq_deq takes, at most depth
+ * @max_wait_ns: longest a pending payload waits for the consumer to wake
+ *
+ * target starts at 1, so the first payloads are handed over at once until
+ * there is a rate to go by.
+ *
+ * Return: the queue, or NULL with errno set to EINVAL or ENOMEM
+ */
+bq_t *bq_create(size_t depth, size_t width, fullpolicy_t policy,
+                size_t max_batch, uint64_t max_wait_ns)
+{
+    pthread_condattr_t attr;
+    bq_t *bqp;
+
+    if (max_batch == 0 || max_batch > depth || max_wait_ns < BQ_TARGET_FRACTION)
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+    bqp = aligned_alloc(CACHE_LINE, SQ_STRIDE(sizeof(bq_t)));
+    if (bqp == NULL)
+    {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    memset(bqp, 0, sizeof(bq_t));
+    bqp->ring = sq_create_policy(depth, width, policy);
+    if (bqp->ring == NULL)
+    {
+        free(bqp);
+        return (NULL);
+    }
+    bqp->max_batch = max_batch;
+    bqp->max_wait_ns = max_wait_ns;
+    atomic_init(&bqp->target, 1);
+    atomic_init(&bqp->oldest, 0);
+    atomic_init(&bqp->sleeping, 0);
+    atomic_init(&bqp->stop, 0);
+    bqp->smooth = 1 << BQ_FP;
+    pthread_mutex_init(&bqp->mu, NULL);
+    /* deadlines are sq_clock_ns times */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bqp->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    return (bqp);
+}
+
+/**
+ * bq_destroy - free the queue and its ring
+ * @bqp: the queue, no thread may be using it.  NULL is ignored.
+ */
+void bq_destroy(bq_t *bqp)
+{
+    if (bqp == NULL)
+        return;
+    pthread_cond_destroy(&bqp->wake);
+    pthread_mutex_destroy(&bqp->mu);
+    sq_destroy(bqp->ring);
+    free(bqp);
+}
+
+/**
+ * bq_signal - wake the consumer if it is asleep
+ */
+static void bq_signal(bq_t *bqp)
+{
+    /* the payload is published before sleeping is read, as bq_deq does the opposite */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load(&bqp->sleeping))
+        return;
+    pthread_mutex_lock(&bqp->mu);
+    pthread_cond_signal(&bqp->wake);
+    pthread_mutex_unlock(&bqp->mu);
+}
+
+/**
+ * bq_enq - queue one payload, waking the consumer only if a batch is due
+ * @bqp: the queue
+ * @val: the payload, width bytes
+ *
+ * The consumer is signalled when the payload is the first pending one, so
+ * it learns when to wake at the latest, or when target are pending.
+ *
+ * Return: 0, or -1 if the ring's full policy turned the payload away
+ */
+int bq_enq(bq_t *bqp, buf_t val)
+{
+    uint64_t t = 0, none = 0;
+    int first = 0;
+
+    /* stamp before queueing, so the deadline is never late */
+    if (atomic_load(&bqp->oldest) == 0)
+        t = sq_clock_ns();
+    if (q_enq_bulk(bqp->ring, val, 1) != 1)
+        return (-1);
+    /* again after, in case the consumer cleared it to take a batch without this one */
+    if (atomic_load(&bqp->oldest) == 0)
+    {
+        if (t == 0)
+            t = sq_clock_ns();
+        first = atomic_compare_exchange_strong(&bqp->oldest, &none, t);
+    }
+    if (first || q_count(bqp->ring) >= atomic_load_explicit(&bqp->target, memory_order_relaxed))
+        bq_signal(bqp);
+    return (0);
+}
+
+/**
+ * bq_due - is a batch due: 1 for target pending, 2 for max_wait_ns passed
+ */
+static int bq_due(bq_t *bqp, uint64_t now)
+{
+    uint64_t oldest = atomic_load(&bqp->oldest);
+
+    if (q_count(bqp->ring) >= atomic_load_explicit(&bqp->target, memory_order_relaxed))
+        return (1);
+    if (oldest != 0 && now - oldest >= bqp->max_wait_ns)
+        return (2);
+    return (0);
+}
+
+/**
+ * bq_adapt - move target toward the payloads arriving in a fraction of
+ * max_wait_ns at the rate the last batch came in
+ * @bqp: the queue
+ * @k: payloads in the batch just taken
+ * @now: when it was taken
+ */
+static void bq_adapt(bq_t *bqp, size_t k, uint64_t now)
+{
+    uint64_t elapsed = now - bqp->last_ns, want, lo = 1 << BQ_FP,
+             hi = (uint64_t)bqp->max_batch << BQ_FP;
+
+    if (bqp->last_ns != 0)
+    {
+        if (elapsed == 0)
+            elapsed = 1;
+        want = (uint64_t)((double)k * (bqp->max_wait_ns / BQ_TARGET_FRACTION) / elapsed * lo);
+        want = want < lo ? lo : (want > hi ? hi : want);
+        /* an eighth of the way, as an rtt estimator smooths */
+        if (want > bqp->smooth)
+            bqp->smooth += (want - bqp->smooth) >> 3;
+        else
+            bqp->smooth -= (bqp->smooth - want) >> 3;
+        atomic_store_explicit(&bqp->target, (size_t)((bqp->smooth + lo / 2) >> BQ_FP),
+                              memory_order_relaxed);
+    }
+    bqp->last_ns = now;
+}
+
+/**
+ * bq_deq - wait for a batch and take it
+ * @bqp: the queue
+ * @dst: room for max_batch payloads packed width apart
+ *
+ * Sleeps until target payloads are pending or the oldest has waited
+ * max_wait_ns, then takes up to max_batch, oldest first.  One consumer
+ * only.  After bq_stop it stops waiting and takes what is left.
+ *
+ * Return: payloads taken, 0 only once the queue is stopped and empty
+ */
+size_t bq_deq(bq_t *bqp, void *dst)
+{
+    struct timespec ts;
+    uint64_t oldest, now, prev, cur;
+    size_t k;
+    unsigned b;
+    int why;
+
+    for (;;)
+    {
+        now = sq_clock_ns();
+        why = bq_due(bqp, now);
+        if (why == 0 && !atomic_load(&bqp->stop))
+        {
+            pthread_mutex_lock(&bqp->mu);
+            atomic_store(&bqp->sleeping, 1);
+            /* a producer that queued before seeing sleeping set is seen here */
+            while ((why = bq_due(bqp, now)) == 0 && !atomic_load(&bqp->stop))
+            {
+                oldest = atomic_load(&bqp->oldest);
+                if (oldest == 0)
+                    pthread_cond_wait(&bqp->wake, &bqp->mu);
+                else
+                {
+                    ts.tv_sec = (time_t)((oldest + bqp->max_wait_ns) / 1000000000ULL);
+                    ts.tv_nsec = (long)((oldest + bqp->max_wait_ns) % 1000000000ULL);
+                    pthread_cond_timedwait(&bqp->wake, &bqp->mu, &ts);
+                }
+                now = sq_clock_ns();
+            }
+            atomic_store(&bqp->sleeping, 0);
+            pthread_mutex_unlock(&bqp->mu);
+        }
+        /* clear the stamp first when this batch takes everything pending */
+        prev = 0;
+        if (q_count(bqp->ring) <= bqp->max_batch)
+            prev = atomic_exchange(&bqp->oldest, 0);
+        k = q_deq_bulk(bqp->ring, dst, bqp->max_batch);
+        /*
+         * payloads queued after the count but before the clear found the
+         * stamp set and left it to this batch, which may have been full
+         * without them: put back a stamp no later than theirs
+         */
+        if (prev != 0 && q_count(bqp->ring) > 0)
+        {
+            cur = atomic_load(&bqp->oldest);
+            while ((cur == 0 || cur > prev) &&
+                   !atomic_compare_exchange_weak(&bqp->oldest, &cur, prev))
+                ;
+        }
+        if (k > 0)
+            break;
+        if (atomic_load(&bqp->stop))
+            return (0);
+    }
+    bqp->batches++;
+    bqp->items += k;
+    if (why == 1)
+        bqp->full_wakes++;
+    else if (why == 2)
+        bqp->timed_wakes++;
+    b = 64 - __builtin_clzll((unsigned long long)k);
+    bqp->size[b < BQ_BUCKETS ? b : BQ_BUCKETS - 1]++;
+    bq_adapt(bqp, k, now);
+    return (k);
+}
+
+/**
+ * bq_stop - tell the consumer no more payloads are coming
+ * @bqp: the queue
+ *
+ * bq_deq hands out what is still queued without waiting, then returns 0.
+ */
+void bq_stop(bq_t *bqp)
+{
+    atomic_store(&bqp->stop, 1);
+    pthread_mutex_lock(&bqp->mu);
+    pthread_cond_signal(&bqp->wake);
+    pthread_mutex_unlock(&bqp->mu);
+}
+
+/**
+ * bq_print_stats - batch counts and a histogram of batch sizes
+ * @fp: where to print
+ * @label: names the queue or the run
+ * @bqp: the queue
+ */
+void bq_print_stats(FILE *fp, const char *label, const bq_t *bqp)
+{
+    unsigned b;
+
+    fprintf(fp, "%s: %zu payloads in %zu batches, mean %.1f, %zu woken full, %zu by max wait, target %zu\n",
+            label, bqp->items, bqp->batches, bqp->batches ? (double)bqp->items / bqp->batches : 0.0,
+            bqp->full_wakes, bqp->timed_wakes, atomic_load(&bqp->target));
+    fprintf(fp, "    %20s %10s\n", "batch below", "batches");
+    for (b = 0; b < BQ_BUCKETS; b++)
+        if (bqp->size[b])
+            fprintf(fp, "    %20llu %10zu\n", 1ULL << b, bqp->size[b]);
+}
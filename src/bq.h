@@ -0,0 +1,107 @@
+/*! \file bq.h
+ *
+ * DRE 2024
+ *
+ * Batching queue: an sq_t whose consumer sleeps until a batch is worth
+ * waking for, interrupt-coalescing style.
+ *
+ * A consumer that wakes for every payload pays the wake-up and a cold
+ * cache per payload; one that always waits for a full batch holds the
+ * first payload of a quiet period for as long as the batch takes.  bq_deq
+ * sleeps until either
+ *
+ * - target payloads are pending, or
+ * - the oldest pending payload has waited max_wait_ns,
+ *
+ * and then takes up to max_batch with one q_deq_bulk.  Producers only
+ * signal the consumer when one of the two becomes true, not per payload.
+ *
+ * target follows the arrival rate.  After each batch the consumer works
+ * out how many payloads arrive in BQ_TARGET_FRACTION of max_wait_ns at the
+ * rate it just saw, and moves target an eighth of the way there, between 1
+ * and max_batch.  Under load batches grow and wake-ups stay about
+ * BQ_TARGET_FRACTION-th of max_wait_ns apart whatever the rate; when it is
+ * quiet target drops to 1 and a lone payload is handed over at once.
+ * Either way no payload waits past max_wait_ns for the consumer to be
+ * woken.
+ *
+ * The oldest pending payload is tracked by one timestamp, set by the
+ * producer that finds it clear and cleared by the consumer before a batch
+ * that looks like it takes everything pending.  A payload that slips in
+ * between can leave it set with nothing pending: the consumer then wakes
+ * early for nothing.  If payloads slipped in before the clear and the
+ * batch filled up without them, the consumer puts the old stamp back, so
+ * it never wakes late.
+ *
+ * One consumer.  The ring keeps its lock mode and full policy; set
+ * ring->mode before the first bq_enq.  The locked modes take any number of
+ * producers, LOCK_FREE only one: the sq_t ring is single producer there,
+ * and two threads calling bq_enq at once would corrupt it.
+ */
+
+#ifndef _BQ_H
+#define _BQ_H
+
+#include <stdio.h>      /* FILE */
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint64_t */
+#include <stdatomic.h>  /* atomic_ operations */
+#include <pthread.h>    /* pthread_mutex_t, pthread_cond_t */
+#include "vringbuffer.h" /* sq_t, buf_t, fullpolicy_t */
+
+/// \def BQ_BUCKETS batch size histogram buckets, bucket b counts sizes below 2^b
+#define BQ_BUCKETS 24
+/// \def BQ_TARGET_FRACTION target is the payloads arriving in max_wait_ns / BQ_TARGET_FRACTION
+#define BQ_TARGET_FRACTION 4
+/// \def BQ_FP fixed point shift of the smoothed target
+#define BQ_FP 8
+
+/**
+ * struct bq - batching queue
+ * @ring: the queue itself
+ * @max_batch: most payloads one bq_deq takes
+ * @max_wait_ns: longest a pending payload waits for the consumer to wake
+ * @target: pending payloads that wake the consumer at once
+ * @oldest: sq_clock_ns when the oldest pending payload was queued, 0 if none
+ * @sleeping: 1 while the consumer waits on @wake
+ * @stop: set by bq_stop
+ * @mu: guards the sleep, with @wake
+ * @wake: the consumer sleeps on it
+ * @smooth: target << BQ_FP before rounding, consumer only
+ * @last_ns: when the last batch was taken, consumer only
+ * @batches: batches taken
+ * @items: payloads in them
+ * @full_wakes: batches taken because target payloads were pending
+ * @timed_wakes: batches taken because max_wait_ns had passed
+ * @size: histogram of batch sizes
+ */
+typedef struct bq
+{
+    sq_t *ring;
+    size_t max_batch;
+    uint64_t max_wait_ns;
+    _Alignas(CACHE_LINE) atomic_size_t target;
+    _Atomic(uint64_t) oldest;
+    atomic_int sleeping;
+    atomic_int stop;
+    pthread_mutex_t mu;
+    pthread_cond_t wake;
+    _Alignas(CACHE_LINE) uint64_t smooth;
+    uint64_t last_ns;
+    size_t batches;
+    size_t items;
+    size_t full_wakes;
+    size_t timed_wakes;
+    size_t size[BQ_BUCKETS];
+} bq_t;
+
+/* externally visible prototypes */
+bq_t *bq_create(size_t depth, size_t width, fullpolicy_t policy,
+                size_t max_batch, uint64_t max_wait_ns);
+void bq_destroy(bq_t *bqp);
+int bq_enq(bq_t *bqp, buf_t val);
+size_t bq_deq(bq_t *bqp, void *dst);
+void bq_stop(bq_t *bqp);
+void bq_print_stats(FILE *fp, const char *label, const bq_t *bqp);
+
+#endif /* _BQ_H */
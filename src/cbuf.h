@@ -91,12 +91,14 @@
 /* ---- Include Files ---------------------------------------------------- */
 
 /* ---- Constants and Types ---------------------------------------------- */
+#if defined( myQ_SIZE )
 typedef volatile struct
 {
     uint8_t     m_getIdx;
     uint8_t     m_putIdx;
     uint8_t     m_entry[ myQ_SIZE ];
 } Q_t;
+#endif
 
 /**
 *   Initializes the circular buffer for use.
@@ -198,6 +200,20 @@ typedef volatile struct
 
 #if defined( __cplusplus )
 
+#include <new>          /* placement new */
+#include <utility>      /* std::move, std::forward */
+
+/**
+*   The entries live in raw, suitably aligned slot storage rather than in a
+*   default-constructed @c EntryType array. An entry is only constructed when
+*   it is pushed (or emplaced) and is destroyed when it is popped, so
+*   @c EntryType does not need a default constructor and may be move-only
+*   (e.g. @c std::unique_ptr or a message owning a heap buffer).
+*
+*   The queue owns its entries, so it cannot be copied. Any entries still
+*   queued when the CBUF goes out of scope are destroyed.
+*/
+
 template < class IndexType, unsigned Size, class EntryType >
 class CBUF
 {
@@ -205,9 +221,22 @@ public:
 
     CBUF()
     {
-        m_getIdx = m_putIdx = 0;
+        m_getIdx = 0;
+        m_putIdx = 0;
     }
 
+    ~CBUF()
+    {
+        while ( !IsEmpty() )
+        {
+            Slot( m_getIdx )->~EntryType();
+            m_getIdx = m_getIdx + 1;
+        }
+    }
+
+    CBUF( const CBUF & ) = delete;
+    CBUF &operator =( const CBUF & ) = delete;
+
     IndexType Len() const
     {
         return m_putIdx - m_getIdx;
@@ -226,21 +255,57 @@ public:
         return Len() > Size;
     }
 
-    void Push( EntryType val )
+    /**
+    *   Constructs a new entry in place at the end of the circular buffer,
+    *   forwarding @c args to the @c EntryType constructor. Like Push, it is
+    *   the caller's responsibility to ensure the buffer is not full.
+    */
+
+    template < class... Args >
+    void Emplace( Args &&... args )
+    {
+        ::new ( static_cast< void * >( Slot( m_putIdx ))) EntryType( std::forward< Args >( args )... );
+        m_putIdx = m_putIdx + 1;
+    }
+
+    void Push( const EntryType &val )
+    {
+        Emplace( val );
+    }
+
+    void Push( EntryType &&val )
     {
-        m_entry[ m_putIdx++ & ( Size - 1 )] = val;
+        Emplace( std::move( val ));
     }
 
+    /**
+    *   Moves the oldest entry out of the circular buffer and destroys the
+    *   slot's copy before the get index is advanced, so the writer can never
+    *   see a slot that still holds a live entry.
+    */
+
     EntryType Pop()
     {
-        return m_entry[ m_getIdx++ & ( Size - 1 )];
+        EntryType  *entry = Slot( m_getIdx );
+        EntryType   val( std::move( *entry ));
+
+        entry->~EntryType();
+        m_getIdx = m_getIdx + 1;
+        return val;
     }
 
 private:
 
+    static_assert(( Size & ( Size - 1 )) == 0, "CBUF Size must be a power of two" );
+
+    EntryType *Slot( IndexType idx )
+    {
+        return reinterpret_cast< EntryType * >( m_entry[ idx & ( Size - 1 )] );
+    }
+
     volatile IndexType  m_getIdx;
     volatile IndexType  m_putIdx;
-    EntryType           m_entry[ Size ];
+    alignas( EntryType ) unsigned char  m_entry[ Size ][ sizeof( EntryType ) ];
 
 };
 
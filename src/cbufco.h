@@ -0,0 +1,313 @@
+/****************************************************************************
+*
+*   DRE 2024 - coroutine front end for the CBUF circular buffer.
+*
+****************************************************************************/
+/**
+*
+*   @file   cbufco.h
+*
+*   @defgroup   CBUFCO Awaitable Circular Buffer
+*   @{
+*
+*   @brief  A bounded CBUF whose Push and Pop can be @c co_await'ed.
+*
+*   A spinning CBUF::Pop (or q_deq) called from a coroutine either blocks the
+*   worker thread it runs on or has to be polled. CBUF_Await puts a small
+*   spinlock and two intrusive waiter lists around a CBUF so that
+*
+*   @code
+*   EntryType v = co_await myQ.Pop();
+*   co_await myQ.Push( std::move( v ));
+*   @endcode
+*
+*   suspend the calling coroutine when the ring is empty (Pop) or full (Push)
+*   instead of spinning. The other side resumes exactly one waiter:
+*
+*       - Push with a waiting popper hands the entry straight to that popper.
+*       - Pop from a full ring with a waiting pusher moves that pusher's entry
+*         into the freed slot.
+*
+*   so waiters are served in arrival order and no entry is copied more than
+*   it would be by CBUF itself. Resumed coroutines are handed to the
+*   executor's schedule function; nothing here sleeps in the kernel, so
+*   thousands of logical consumers can share a few threads.
+*
+*   The schedule function is called outside the lock. Without one, the waiter
+*   is resumed inline on the thread that released it.
+*
+*   Requires C++20 coroutines.
+*
+****************************************************************************/
+
+#if !defined( CBUFCO_H )
+#define CBUFCO_H       /**< Include Guard                          */
+
+/* ---- Include Files ---------------------------------------------------- */
+
+#include <atomic>       /* std::atomic_flag */
+#include <coroutine>    /* std::coroutine_handle */
+#include <new>          /* placement new */
+#include <utility>      /* std::move */
+
+#include "cbuf.h"
+
+/* ---- Constants and Types ---------------------------------------------- */
+
+/**
+*   Executor hook. Called with a coroutine which is ready to run again;
+*   @c ctx is the pointer given to the CBUF_Await constructor.
+*/
+
+typedef void ( *CBUF_Schedule )( std::coroutine_handle<> h, void *ctx );
+
+template < class IndexType, unsigned Size, class EntryType >
+class CBUF_Await
+{
+public:
+
+    class PopAwaiter;
+    class PushAwaiter;
+
+    CBUF_Await( CBUF_Schedule schedule = NULL, void *ctx = NULL )
+        : m_schedule( schedule ), m_ctx( ctx ),
+          m_popHead( NULL ), m_popTail( NULL ),
+          m_pushHead( NULL ), m_pushTail( NULL )
+    {
+    }
+
+    CBUF_Await( const CBUF_Await & ) = delete;
+    CBUF_Await &operator =( const CBUF_Await & ) = delete;
+
+    /**
+    *   Returns the number of entries in the ring. Suspended pushers are not
+    *   counted.
+    */
+
+    IndexType Len()
+    {
+        Lock();
+        IndexType len = m_buf.Len();
+        Unlock();
+        return len;
+    }
+
+    /**
+    *   Awaitable pop: resumes with the oldest entry, suspending while the
+    *   ring is empty.
+    */
+
+    PopAwaiter Pop()
+    {
+        return PopAwaiter( this );
+    }
+
+    /**
+    *   Awaitable push: resumes once the entry is queued (or handed to a
+    *   waiting popper), suspending while the ring is full.
+    */
+
+    PushAwaiter Push( EntryType val )
+    {
+        return PushAwaiter( this, std::move( val ));
+    }
+
+    class PopAwaiter
+    {
+    public:
+
+        PopAwaiter( CBUF_Await *q ) : m_q( q ), m_next( NULL ), m_full( false )
+        {
+        }
+
+        PopAwaiter( const PopAwaiter & ) = delete;
+
+        ~PopAwaiter()
+        {
+            if ( m_full )
+                Entry()->~EntryType();
+        }
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        /**
+        *   Takes an entry if one is queued, otherwise registers this awaiter
+        *   as a waiter. Once the lock is released the coroutine may already
+        *   be running elsewhere, so no member is touched after Unlock().
+        */
+
+        bool await_suspend( std::coroutine_handle<> h )
+        {
+            PushAwaiter *pusher = NULL;
+
+            m_q->Lock();
+            if ( m_q->m_buf.IsEmpty() )
+            {
+                m_handle = h;
+                if ( m_q->m_popTail )
+                    m_q->m_popTail->m_next = this;
+                else
+                    m_q->m_popHead = this;
+                m_q->m_popTail = this;
+                m_q->Unlock();
+                return true;
+            }
+            Take( m_q->m_buf.Pop() );
+            pusher = m_q->RefillLocked();
+            m_q->Unlock();
+            if ( pusher )
+                m_q->Resume( pusher->m_handle );
+            return false;
+        }
+
+        EntryType await_resume()
+        {
+            return std::move( *Entry() );
+        }
+
+    private:
+
+        friend class CBUF_Await;
+
+        EntryType *Entry()
+        {
+            return reinterpret_cast< EntryType * >( m_entry );
+        }
+
+        void Take( EntryType &&val )
+        {
+            ::new ( static_cast< void * >( m_entry )) EntryType( std::move( val ));
+            m_full = true;
+        }
+
+        CBUF_Await                 *m_q;
+        PopAwaiter                 *m_next;
+        std::coroutine_handle<>     m_handle;
+        bool                        m_full;
+        alignas( EntryType ) unsigned char  m_entry[ sizeof( EntryType ) ];
+    };
+
+    class PushAwaiter
+    {
+    public:
+
+        PushAwaiter( CBUF_Await *q, EntryType &&val ) : m_q( q ), m_next( NULL ), m_val( std::move( val ))
+        {
+        }
+
+        PushAwaiter( const PushAwaiter & ) = delete;
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        /**
+        *   Hands the entry to the oldest waiting popper, or queues it if
+        *   there is room, otherwise registers this awaiter as a waiter.
+        */
+
+        bool await_suspend( std::coroutine_handle<> h )
+        {
+            PopAwaiter *popper = NULL;
+
+            m_q->Lock();
+            if (( popper = m_q->m_popHead ) != NULL )
+            {
+                if (( m_q->m_popHead = popper->m_next ) == NULL )
+                    m_q->m_popTail = NULL;
+                popper->Take( std::move( m_val ));
+                m_q->Unlock();
+                m_q->Resume( popper->m_handle );
+                return false;
+            }
+            if ( !m_q->m_buf.IsFull() )
+            {
+                m_q->m_buf.Push( std::move( m_val ));
+                m_q->Unlock();
+                return false;
+            }
+            m_handle = h;
+            if ( m_q->m_pushTail )
+                m_q->m_pushTail->m_next = this;
+            else
+                m_q->m_pushHead = this;
+            m_q->m_pushTail = this;
+            m_q->Unlock();
+            return true;
+        }
+
+        void await_resume()
+        {
+        }
+
+    private:
+
+        friend class CBUF_Await;
+
+        CBUF_Await                 *m_q;
+        PushAwaiter                *m_next;
+        std::coroutine_handle<>     m_handle;
+        EntryType                   m_val;
+    };
+
+private:
+
+    void Lock()
+    {
+        while ( m_lock.test_and_set( std::memory_order_acquire ))
+        {
+#if defined( __x86_64__ ) || defined( __i386__ )
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+
+    void Unlock()
+    {
+        m_lock.clear( std::memory_order_release );
+    }
+
+    /**
+    *   Called with the lock held after an entry was popped: moves the oldest
+    *   waiting pusher's entry into the freed slot and returns that pusher so
+    *   it can be resumed once the lock is dropped.
+    */
+
+    PushAwaiter *RefillLocked()
+    {
+        PushAwaiter *pusher = m_pushHead;
+
+        if ( pusher )
+        {
+            if (( m_pushHead = pusher->m_next ) == NULL )
+                m_pushTail = NULL;
+            m_buf.Push( std::move( pusher->m_val ));
+        }
+        return pusher;
+    }
+
+    void Resume( std::coroutine_handle<> h )
+    {
+        if ( m_schedule )
+            m_schedule( h, m_ctx );
+        else
+            h.resume();
+    }
+
+    std::atomic_flag                        m_lock = ATOMIC_FLAG_INIT;
+    CBUF_Schedule                           m_schedule;
+    void                                   *m_ctx;
+    PopAwaiter                             *m_popHead;
+    PopAwaiter                             *m_popTail;
+    PushAwaiter                            *m_pushHead;
+    PushAwaiter                            *m_pushTail;
+    CBUF< IndexType, Size, EntryType >      m_buf;
+};
+
+/** @} */
+
+#endif // CBUFCO_H
@@ -0,0 +1,253 @@
+/*! \file cq.c
+ *
+ * DRE 2024
+ *
+ * Conflating queue, one queued payload per key, see cq.h.
+ */
+
+#include <stdlib.h>     /* aligned_alloc, calloc, free */
+#include <string.h>     /* memcpy, memset */
+#include <errno.h>      /* errno, EINVAL, ENOMEM */
+#include "cq.h"         /* cq_t and external function prototypes */
+
+#define LOCK_C 0x01
+#define LOCK_P 0x02
+
+/// \def CQ_SLOT is the address of slot i
+#define CQ_SLOT(cqp, i) ((cqp)->slab + (size_t)(i) * (cqp)->stride)
+
+/**
+ * cq_hash - the home bucket of a key
+ *
+ * The splitmix64 finalizer, so keys that differ in a few low bits, sensor
+ * 1, 2, 3, still land far apart.
+ */
+inline static size_t cq_hash(const cq_t *cqp, uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return ((size_t)key & cqp->bmask);
+}
+
+/**
+ * cq_find - the bucket holding key, or the empty bucket ending its probe run
+ */
+static size_t cq_find(const cq_t *cqp, uint64_t key)
+{
+    size_t b = cq_hash(cqp, key);
+
+    while (cqp->bucket[b] != 0 && cqp->key[cqp->bucket[b] - 1] != key)
+        b = (b + 1) & cqp->bmask;
+    return (b);
+}
+
+/**
+ * cq_unindex - empty bucket b and close the gap in its probe run
+ * @cqp: the queue, locked
+ * @b: a full bucket
+ *
+ * Backward-shift deletion: a later entry of the run moves into the hole
+ * unless its home lies cyclically after the hole, where it would no longer
+ * be found.  No tombstones, so probe runs only ever hold live keys.
+ */
+static void cq_unindex(cq_t *cqp, size_t b)
+{
+    size_t j = b, home;
+
+    for (;;)
+    {
+        j = (j + 1) & cqp->bmask;
+        if (cqp->bucket[j] == 0)
+            break;
+        home = cq_hash(cqp, cqp->key[cqp->bucket[j] - 1]);
+        /* keep j where it is if home is in (b, j], cyclically */
+        if (((j - home) & cqp->bmask) < ((j - b) & cqp->bmask))
+            continue;
+        cqp->bucket[b] = cqp->bucket[j];
+        b = j;
+    }
+    cqp->bucket[b] = 0;
+}
+
+/**
+ * cq_create - allocate an empty conflating queue
+ * @depth: slots, the most distinct keys queued at once, a power of two
+ * @width: payload bytes per slot
+ *
+ * Starts in LOCK_SPIN mode.
+ *
+ * Return: the queue, or NULL with errno set to EINVAL or ENOMEM
+ */
+cq_t *cq_create(size_t depth, size_t width)
+{
+    cq_t *cqp;
+
+    if (width == 0 || depth == 0 || (depth & (depth - 1)) != 0 || depth >= UINT32_MAX / 2)
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+    cqp = aligned_alloc(CACHE_LINE, SQ_STRIDE(sizeof(cq_t)));
+    if (cqp == NULL)
+    {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    memset(cqp, 0, sizeof(cq_t));
+    cqp->buffer_width = width;
+    cqp->stride = SQ_STRIDE(width);
+    cqp->max = depth;
+    cqp->mask = depth - 1;
+    cqp->bmask = 2 * depth - 1;
+    cqp->slab = aligned_alloc(CACHE_LINE, depth * cqp->stride);
+    cqp->key = aligned_alloc(CACHE_LINE, SQ_STRIDE(depth * sizeof(uint64_t)));
+    cqp->bucket = calloc(2 * depth, sizeof(uint32_t));
+    if (cqp->slab == NULL || cqp->key == NULL || cqp->bucket == NULL)
+    {
+        free(cqp->slab);
+        free(cqp->key);
+        free(cqp->bucket);
+        free(cqp);
+        errno = ENOMEM;
+        return (NULL);
+    }
+    sqlock_init(&cqp->lock);
+    cqp->mode = LOCK_SPIN;
+    return (cqp);
+}
+
+/**
+ * cq_destroy - free the queue and every slot
+ * @cqp: the queue, no thread may be using it.  NULL is ignored.
+ */
+void cq_destroy(cq_t *cqp)
+{
+    if (cqp == NULL)
+        return;
+    sqlock_destroy(&cqp->lock);
+    free(cqp->bucket);
+    free(cqp->key);
+    free(cqp->slab);
+    free(cqp);
+}
+
+/**
+ * cq_set_mode - choose the lock, before the first cq_enq
+ * @cqp: the queue
+ * @mode: any locked mode
+ *
+ * Return: 0, or -1 with errno set to EINVAL for LOCK_FREE
+ */
+int cq_set_mode(cq_t *cqp, lockmode_t mode)
+{
+    if (mode == LOCK_FREE || mode >= LOCK_MODES)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+    cqp->mode = mode;
+    return (0);
+}
+
+/**
+ * cq_enq - queue the newest payload for a key
+ * @cqp: the queue
+ * @key: any 64-bit key
+ * @val: the payload, buffer_width bytes
+ *
+ * Return: 0 if the key was appended, 1 if the payload replaced the one
+ * queued for it, or -1 if the key is new and every slot is taken
+ */
+int cq_enq(cq_t *cqp, uint64_t key, buf_t val)
+{
+    size_t b;
+    int rc = 0;
+
+    sqlock_acquire(&cqp->lock, cqp->mode, LOCK_P);
+    b = cq_find(cqp, key);
+    if (cqp->bucket[b] != 0)
+    {
+        memcpy(CQ_SLOT(cqp, cqp->bucket[b] - 1), val, cqp->buffer_width);
+        cqp->conflated++;
+        rc = 1;
+    }
+    else if (cqp->count == cqp->max)
+    {
+        cqp->rejected++;
+        sqlock_release(&cqp->lock, cqp->mode);
+        return (-1);
+    }
+    else
+    {
+        memcpy(CQ_SLOT(cqp, cqp->enq), val, cqp->buffer_width);
+        cqp->key[cqp->enq] = key;
+        cqp->bucket[b] = (uint32_t)cqp->enq + 1;
+        cqp->enq = (cqp->enq + 1) & cqp->mask;
+        cqp->count++;
+    }
+    cqp->updates++;
+    sqlock_release(&cqp->lock, cqp->mode);
+    return (rc);
+}
+
+/**
+ * cq_take - copy out the oldest key's payload and forget the key, locked
+ */
+static void cq_take(cq_t *cqp, uint64_t *keyp, char *dst)
+{
+    uint64_t key = cqp->key[cqp->deq];
+
+    memcpy(dst, CQ_SLOT(cqp, cqp->deq), cqp->buffer_width);
+    if (keyp != NULL)
+        *keyp = key;
+    cq_unindex(cqp, cq_find(cqp, key));
+    cqp->deq = (cqp->deq + 1) & cqp->mask;
+    cqp->count--;
+}
+
+/**
+ * cq_deq - dequeue the key that has waited longest, with its newest payload
+ * @cqp: the queue
+ * @keyp: return the key, may be NULL
+ * @valp: return the payload, room for buffer_width bytes
+ *
+ * Return: 0 for success, -1 if the queue is empty
+ */
+int cq_deq(cq_t *cqp, uint64_t *keyp, buf_t *valp)
+{
+    sqlock_acquire(&cqp->lock, cqp->mode, LOCK_C);
+    if (cqp->count == 0)
+    {
+        sqlock_release(&cqp->lock, cqp->mode);
+        return (-1);
+    }
+    cq_take(cqp, keyp, *valp);
+    sqlock_release(&cqp->lock, cqp->mode);
+    return (0);
+}
+
+/**
+ * cq_deq_bulk - dequeue up to n keys under one lock
+ * @cqp: the queue
+ * @keys: room for n keys, may be NULL
+ * @dst: room for n payloads packed buffer_width apart
+ * @n: most keys to take
+ *
+ * Return: keys taken, oldest first, 0 if the queue was empty
+ */
+size_t cq_deq_bulk(cq_t *cqp, uint64_t *keys, void *dst, size_t n)
+{
+    char *p = dst;
+    size_t i;
+
+    sqlock_acquire(&cqp->lock, cqp->mode, LOCK_C);
+    if (n > cqp->count)
+        n = cqp->count;
+    for (i = 0; i < n; i++)
+        cq_take(cqp, keys != NULL ? &keys[i] : NULL, p + i * cqp->buffer_width);
+    sqlock_release(&cqp->lock, cqp->mode);
+    return (n);
+}
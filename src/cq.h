@@ -0,0 +1,88 @@
+/*! \file cq.h
+ *
+ * DRE 2024
+ *
+ * Conflating queue: at most one queued payload per key, the newest.
+ *
+ * For state updates, the latest price of an instrument or reading of a
+ * sensor, a consumer only wants the newest payload for each key; an sq_t
+ * hands it every update in between too.  A cq_t keeps a small hash index
+ * from key to slot:
+ *
+ * - cq_enq for a key that isn't queued appends it, as q_enq would.
+ * - cq_enq for a key already queued copies the payload over that slot in
+ *   place.  The key keeps its place in line, so keys leave in the order
+ *   they first arrived and an update never waits behind later keys.
+ * - cq_deq takes the oldest key and drops it from the index, so the next
+ *   update for it queues afresh at the back.
+ *
+ * Under a burst the consumer's work is the number of distinct keys, not
+ * the number of updates; conflated counts the updates it was spared.
+ *
+ * The index is open addressing with linear probing over twice as many
+ * buckets as slots, each bucket a slot number, and removal shifts the
+ * probe run back instead of leaving tombstones, so lookups stay short
+ * however long the queue runs.  The keys sit in their own array so a probe
+ * reads eight of them per cache line without touching the payloads.
+ *
+ * Overwriting in place needs the lock, so every mode but LOCK_FREE works.
+ * When every slot holds a different key cq_enq refuses a new one, the
+ * caller still has it; SQ_FAIL in sq_t terms.
+ */
+
+#ifndef _CQ_H
+#define _CQ_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint32_t, uint64_t */
+#include "vringbuffer.h" /* buf_t, CACHE_LINE, SQ_STRIDE */
+#include "sqlock.h"     /* lockmode_t, sqlock_t */
+
+/**
+ * struct cq - conflating queue
+ * @slab: the payload slots, stride apart
+ * @key: the key of each slot's payload
+ * @bucket: the index, slot number + 1 or 0 for an empty bucket
+ * @stride: bytes from one slot to the next, whole cache lines
+ * @buffer_width: the payload bytes copied in and out
+ * @max: slots, a power of two
+ * @mask: max - 1
+ * @bmask: buckets - 1, there are 2 * max
+ * @enq: the slot the next new key goes to
+ * @deq: the slot of the oldest key
+ * @count: keys queued
+ * @mode: the lock, never LOCK_FREE
+ * @updates: cq_enq calls accepted
+ * @conflated: of those, merged into a queued key
+ * @rejected: new keys refused because every slot was taken
+ * @lock: the lock words and histograms, see sqlock.h
+ */
+typedef struct cq
+{
+    char *slab;
+    uint64_t *key;
+    uint32_t *bucket;
+    size_t stride;
+    size_t buffer_width;
+    size_t max;
+    size_t mask;
+    size_t bmask;
+    size_t enq;
+    size_t deq;
+    size_t count;
+    lockmode_t mode;
+    size_t updates;
+    size_t conflated;
+    size_t rejected;
+    sqlock_t lock;
+} cq_t;
+
+/* externally visible prototypes */
+cq_t *cq_create(size_t depth, size_t width);
+void cq_destroy(cq_t *cqp);
+int cq_set_mode(cq_t *cqp, lockmode_t mode);
+int cq_enq(cq_t *cqp, uint64_t key, buf_t val);
+int cq_deq(cq_t *cqp, uint64_t *keyp, buf_t *valp);
+size_t cq_deq_bulk(cq_t *cqp, uint64_t *keys, void *dst, size_t n);
+
+#endif /* _CQ_H */
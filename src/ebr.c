@@ -0,0 +1,246 @@
+/*! \file ebr.c
+ *
+ * DRE 2024
+ *
+ * Epoch-based reclamation, see ebr.h
+ */
+
+#include <stdlib.h>     /* aligned_alloc, realloc, free */
+#include <string.h>     /* memset */
+#include <errno.h>      /* errno, EBUSY, ENOMEM */
+#include <sched.h>      /* sched_yield */
+#include "ebr.h"        /* ebr_t and external function prototypes */
+
+/**
+ * ebr_create - allocate a reclamation domain with no threads
+ *
+ * Return: the domain, or NULL with errno set to ENOMEM
+ */
+ebr_t *ebr_create(void)
+{
+    ebr_t *ebr = aligned_alloc(EBR_CACHE_LINE, sizeof(ebr_t));
+
+    if (ebr == NULL)
+    {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    memset(ebr, 0, sizeof(ebr_t));
+    atomic_init(&ebr->epoch, 1);
+    return (ebr);
+}
+
+/**
+ * ebr_free_limbo - free every object in a limbo list
+ *
+ * Return: objects freed
+ */
+static size_t ebr_free_limbo(ebr_limbo_t *l)
+{
+    size_t i, n = l->n;
+
+    for (i = 0; i < n; i++)
+    {
+        if (l->item[i].fn != NULL)
+            l->item[i].fn(l->item[i].ctx, l->item[i].obj);
+        else
+            free(l->item[i].obj);
+    }
+    l->n = 0;
+    return (n);
+}
+
+/**
+ * ebr_destroy - free the domain, every record and anything still retired
+ * @ebr: the domain, no thread may be using it.  NULL is ignored.
+ *
+ * With no thread left there are no readers, so limbo lists are freed
+ * whatever their epoch.
+ */
+void ebr_destroy(ebr_t *ebr)
+{
+    ebr_thread_t *t;
+    int i, k;
+
+    if (ebr == NULL)
+        return;
+    for (i = 0; i < EBR_MAX_THREADS; i++)
+    {
+        if ((t = atomic_load(&ebr->thread[i])) == NULL)
+            break;
+        for (k = 0; k < 3; k++)
+        {
+            ebr_free_limbo(&t->limbo[k]);
+            free(t->limbo[k].item);
+        }
+        free(t);
+    }
+    free(ebr);
+}
+
+/**
+ * ebr_register - give the calling thread a record
+ * @ebr: the domain
+ *
+ * Reuses the record of a thread that unregistered, else claims the next
+ * empty entry of the thread table.
+ *
+ * Return: the record, or NULL with errno set to EBUSY when EBR_MAX_THREADS
+ * threads are registered, or ENOMEM
+ */
+ebr_thread_t *ebr_register(ebr_t *ebr)
+{
+    ebr_thread_t *t, *none;
+    int i, unused;
+
+    for (i = 0; i < EBR_MAX_THREADS; i++)
+    {
+        t = atomic_load(&ebr->thread[i]);
+        if (t == NULL)
+        {
+            t = aligned_alloc(EBR_CACHE_LINE, sizeof(ebr_thread_t));
+            if (t == NULL)
+            {
+                errno = ENOMEM;
+                return (NULL);
+            }
+            memset(t, 0, sizeof(ebr_thread_t));
+            t->ebr = ebr;
+            atomic_init(&t->used, 1);
+            none = NULL;
+            if (atomic_compare_exchange_strong(&ebr->thread[i], &none, t))
+                return (t);
+            /* another thread claimed the entry first, try its record */
+            free(t);
+            t = none;
+        }
+        unused = 0;
+        if (atomic_load(&t->used) == 0 && atomic_compare_exchange_strong(&t->used, &unused, 1))
+            return (t);
+    }
+    errno = EBUSY;
+    return (NULL);
+}
+
+/**
+ * ebr_unregister - give a record back
+ * @t: the calling thread's record, outside any critical section
+ *
+ * Waits until everything the thread retired has been freed, so it may be
+ * kept waiting by readers of other threads.
+ */
+void ebr_unregister(ebr_thread_t *t)
+{
+    ebr_barrier(t);
+    t->retired = t->freed = 0;
+    atomic_store(&t->used, 0);
+}
+
+/**
+ * ebr_try_advance - move the global epoch on if every reader has caught up
+ * @ebr: the domain
+ *
+ * Return: 1 if the epoch moved, from here or another thread, else 0
+ */
+int ebr_try_advance(ebr_t *ebr)
+{
+    ebr_thread_t *t;
+    uint64_t e = atomic_load(&ebr->epoch), local;
+    int i;
+
+    for (i = 0; i < EBR_MAX_THREADS; i++)
+    {
+        if ((t = atomic_load(&ebr->thread[i])) == NULL)
+            break;
+        local = atomic_load(&t->epoch);
+        if ((local & EBR_ACTIVE) && (local >> 1) != e)
+            return (0);
+    }
+    /* a failed exchange means another thread advanced it */
+    atomic_compare_exchange_strong(&ebr->epoch, &e, e + 1);
+    return (1);
+}
+
+/**
+ * ebr_reclaim - free this thread's retired objects that are past their
+ * grace period
+ * @t: the calling thread's record
+ *
+ * Return: objects freed
+ */
+size_t ebr_reclaim(ebr_thread_t *t)
+{
+    uint64_t e = atomic_load(&t->ebr->epoch);
+    size_t n = 0;
+    int k;
+
+    for (k = 0; k < 3; k++)
+        if (t->limbo[k].n > 0 && t->limbo[k].epoch + 2 <= e)
+            n += ebr_free_limbo(&t->limbo[k]);
+    t->freed += n;
+    return (n);
+}
+
+/**
+ * ebr_retire - free an unlinked object once no reader can hold it
+ * @t: the calling thread's record, inside a critical section or not
+ * @obj: the object, already unreachable for readers that start from now on
+ * @fn: frees obj as fn(ctx, obj), NULL for free(obj)
+ * @ctx: first argument of fn
+ *
+ * Every EBR_BATCH retires the thread tries to advance the epoch and frees
+ * what it can.
+ *
+ * Return: 0, or -1 with errno set to ENOMEM if the limbo list couldn't
+ * grow; obj then still belongs to the caller
+ */
+int ebr_retire(ebr_thread_t *t, void *obj, ebr_free_t fn, void *ctx)
+{
+    uint64_t e = atomic_load(&t->ebr->epoch);
+    ebr_limbo_t *l = &t->limbo[e % 3];
+    ebr_retired_t *item;
+    size_t room;
+
+    /* the list last held epoch e - 3 or older, long past its grace period */
+    if (l->n > 0 && l->epoch != e)
+        t->freed += ebr_free_limbo(l);
+    if (l->n == l->room)
+    {
+        room = l->room ? 2 * l->room : EBR_BATCH;
+        item = realloc(l->item, room * sizeof(ebr_retired_t));
+        if (item == NULL)
+        {
+            errno = ENOMEM;
+            return (-1);
+        }
+        l->item = item;
+        l->room = room;
+    }
+    l->epoch = e;
+    l->item[l->n].obj = obj;
+    l->item[l->n].fn = fn;
+    l->item[l->n].ctx = ctx;
+    l->n++;
+    t->retired++;
+    if (++t->pending >= EBR_BATCH)
+    {
+        t->pending = 0;
+        ebr_try_advance(t->ebr);
+        ebr_reclaim(t);
+    }
+    return (0);
+}
+
+/**
+ * ebr_barrier - wait until everything this thread retired is freed
+ * @t: the calling thread's record, outside any critical section
+ */
+void ebr_barrier(ebr_thread_t *t)
+{
+    while (t->limbo[0].n + t->limbo[1].n + t->limbo[2].n > 0)
+    {
+        if (!ebr_try_advance(t->ebr))
+            sched_yield();
+        ebr_reclaim(t);
+    }
+}
@@ -0,0 +1,159 @@
+/*! \file ebr.h
+ *
+ * DRE 2024
+ *
+ * Epoch-based reclamation for objects shared by pointer.
+ *
+ * When queues carry pointers, buf_t being a void *, or a lock-free
+ * structure links objects that readers walk without a lock, whoever
+ * unlinks an object can't tell whether another thread still holds the
+ * pointer it read a moment ago.  Freeing it at once risks a use after free;
+ * reference counts make every read write a shared counter.  With ebr_t:
+ *
+ * - Readers bracket each access with ebr_enter and ebr_exit.  Entering
+ *   copies the global epoch into the thread's own cache line and exiting
+ *   clears it: no shared write, no atomic read-modify-write.
+ * - A thread that unlinks an object passes it to ebr_retire instead of
+ *   freeing it.  It goes on the thread's limbo list for the current epoch;
+ *   no other thread touches that list.
+ * - The global epoch only moves from e to e + 1 once every thread inside
+ *   a critical section has entered in epoch e.  An object retired in epoch
+ *   e was unlinked before any reader that entered in e + 1 started, so by
+ *   the time the epoch reaches e + 2 every reader that might hold it has
+ *   left, and it is freed.
+ * - Every EBR_BATCH retires a thread tries to advance the epoch and frees
+ *   whatever limbo lists have become safe, so freeing happens in batches
+ *   off the read path.  Three lists per thread, by epoch modulo 3, are all
+ *   that are ever needed.
+ *
+ * One reader stuck inside a critical section holds the epoch back and
+ * every thread's limbo lists grow until it leaves; keep critical sections
+ * short and never block in one.  Each thread registers once with
+ * ebr_register and must not be inside a critical section to unregister.
+ */
+
+#ifndef _EBR_H
+#define _EBR_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint64_t */
+#include <stdatomic.h>  /* atomic_ operations */
+
+/// \def EBR_CACHE_LINE keeps each thread's epoch word on its own line
+#define EBR_CACHE_LINE 64
+/// \def EBR_MAX_THREADS bounds the threads registered at once
+#define EBR_MAX_THREADS 64
+/// \def EBR_BATCH retires between attempts to advance and free
+#define EBR_BATCH 64
+/// \def EBR_ACTIVE marks a thread epoch word inside a critical section
+#define EBR_ACTIVE 1
+
+/// \typedef ebr_free_t frees a retired object, ctx is what was passed to ebr_retire
+typedef void (*ebr_free_t)(void *ctx, void *obj);
+
+/**
+ * struct ebr_retired - an object waiting for its grace period
+ * @obj: the object
+ * @fn: frees it, NULL for free()
+ * @ctx: first argument of fn, a slotpool_t for instance
+ */
+typedef struct ebr_retired
+{
+    void *obj;
+    ebr_free_t fn;
+    void *ctx;
+} ebr_retired_t;
+
+/**
+ * struct ebr_limbo - objects retired in one epoch
+ * @epoch: the epoch they were retired in
+ * @item: the objects
+ * @n: objects held
+ * @room: objects item has room for, grown by doubling
+ */
+typedef struct ebr_limbo
+{
+    uint64_t epoch;
+    ebr_retired_t *item;
+    size_t n;
+    size_t room;
+} ebr_limbo_t;
+
+/**
+ * struct ebr_thread - one registered thread
+ * @epoch: epoch << 1 | EBR_ACTIVE inside a critical section, else 0
+ * @used: 1 while a thread holds the record
+ * @ebr: the domain
+ * @depth: critical sections entered and not yet exited, they nest
+ * @pending: retires since the last attempt to free
+ * @limbo: retired objects by epoch modulo 3
+ * @retired: objects retired through this record
+ * @freed: of those, freed
+ *
+ * Records are never freed before the domain, so ebr_try_advance can read
+ * any of them; an unregistered record is only marked unused and handed to
+ * the next ebr_register.
+ */
+typedef struct ebr_thread
+{
+    _Alignas(EBR_CACHE_LINE) _Atomic(uint64_t) epoch;
+    _Alignas(EBR_CACHE_LINE) atomic_int used;
+    struct ebr *ebr;
+    unsigned depth;
+    size_t pending;
+    ebr_limbo_t limbo[3];
+    size_t retired;
+    size_t freed;
+} ebr_thread_t;
+
+/**
+ * struct ebr - a reclamation domain
+ * @epoch: the global epoch, advanced by ebr_try_advance
+ * @thread: the thread records, NULL past the last one ever registered
+ */
+typedef struct ebr
+{
+    _Alignas(EBR_CACHE_LINE) _Atomic(uint64_t) epoch;
+    _Alignas(EBR_CACHE_LINE) _Atomic(ebr_thread_t *) thread[EBR_MAX_THREADS];
+} ebr_t;
+
+/**
+ * ebr_enter - start a read-side critical section
+ * @t: the calling thread's record
+ *
+ * Pointers read from shared structures stay valid until the matching
+ * ebr_exit.  Sections nest; only the outermost publishes the epoch.
+ */
+inline static void ebr_enter(ebr_thread_t *t)
+{
+    if (t->depth++ == 0)
+    {
+        atomic_store_explicit(&t->epoch,
+                              atomic_load_explicit(&t->ebr->epoch, memory_order_relaxed) << 1 | EBR_ACTIVE,
+                              memory_order_relaxed);
+        /* the epoch must be visible before any shared pointer is read */
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+/**
+ * ebr_exit - end a read-side critical section
+ * @t: the calling thread's record
+ */
+inline static void ebr_exit(ebr_thread_t *t)
+{
+    if (--t->depth == 0)
+        atomic_store_explicit(&t->epoch, 0, memory_order_release);
+}
+
+/* externally visible prototypes */
+ebr_t *ebr_create(void);
+void ebr_destroy(ebr_t *ebr);
+ebr_thread_t *ebr_register(ebr_t *ebr);
+void ebr_unregister(ebr_thread_t *t);
+int ebr_retire(ebr_thread_t *t, void *obj, ebr_free_t fn, void *ctx);
+int ebr_try_advance(ebr_t *ebr);
+size_t ebr_reclaim(ebr_thread_t *t);
+void ebr_barrier(ebr_thread_t *t);
+
+#endif /* _EBR_H */
@@ -0,0 +1,263 @@
+/*! \file lanes.c
+ *
+ * DRE 2024
+ *
+ * Multi-lane priority queue, see lanes.h.
+ */
+
+#include <stdlib.h>     /* aligned_alloc, free */
+#include <string.h>     /* memset */
+#include <errno.h>      /* errno, EINVAL */
+#include "lanes.h"      /* lq_t and external function prototypes */
+
+/**
+ * lq_bit - the ready bit of a lane
+ * @lane: lane number, below LQ_MAX_LANES
+ */
+inline static uint64_t lq_bit(unsigned lane)
+{
+    return ((uint64_t)1 << lane);
+}
+
+/**
+ * lq_rotr - rotate a ready mask right so bit 0 is lane @n
+ * @r: the ready mask
+ * @n: lane number, below LQ_MAX_LANES
+ *
+ * Bits past nlanes are always clear, so the lowest set bit of the result is
+ * the first non-empty lane at or after n, wrapping past the last lane.
+ */
+inline static uint64_t lq_rotr(uint64_t r, unsigned n)
+{
+    return ((r >> n) | (r << ((LQ_MAX_LANES - n) & (LQ_MAX_LANES - 1))));
+}
+
+/**
+ * lq_schedule - lay the weights out as an interleaved schedule
+ * @lqp: the queue, nlanes set
+ * @weights: one weight per lane, each at least 1
+ *
+ * Smooth weighted round robin: at every position each lane earns its
+ * weight, the richest lane is picked and pays the total back.  Over one
+ * pass of the schedule lane i comes up weights[i] times, spread out
+ * instead of in one run, so weights {4, 2, 1} give 0 1 0 2 0 1 0.
+ *
+ * Return: 0, or -1 with errno set to EINVAL for a zero weight or a sum
+ * past LQ_SCHED_MAX
+ */
+static int lq_schedule(lq_t *lqp, const unsigned *weights)
+{
+    long credit[LQ_MAX_LANES];
+    unsigned total = 0;
+    unsigned i, pos, best;
+
+    for (i = 0; i < lqp->nlanes; i++)
+    {
+        if (weights[i] == 0 || weights[i] > LQ_SCHED_MAX - total)
+        {
+            errno = EINVAL;
+            return (-1);
+        }
+        total += weights[i];
+        credit[i] = 0;
+    }
+    for (pos = 0; pos < total; pos++)
+    {
+        best = 0;
+        for (i = 0; i < lqp->nlanes; i++)
+        {
+            credit[i] += weights[i];
+            if (credit[i] > credit[best])
+                best = i;
+        }
+        credit[best] -= total;
+        lqp->sched[pos] = (uint8_t)best;
+    }
+    lqp->nsched = total;
+    return (0);
+}
+
+/**
+ * lq_create - allocate a multi-lane queue and its rings
+ * @nlanes: number of lanes, 1 to LQ_MAX_LANES, lane 0 the most urgent
+ * @depth: slots per lane, a power of two as sq_create requires
+ * @width: payload bytes per slot, the same for every lane
+ * @policy: LQ_STRICT or LQ_WRR
+ * @weights: LQ_WRR, nlanes weights of at least 1, summing to at most
+ *           LQ_SCHED_MAX.  Ignored for LQ_STRICT and may be NULL.
+ * @full: nlanes fullpolicy_t, what lq_enq does on each full lane, so a
+ *        bulk lane can block or refuse while a control lane keeps only
+ *        the newest.  NULL for SQ_OVERWRITE on every lane.
+ *
+ * Every lane starts empty in LOCK_SPIN mode, see sq_create_policy.
+ *
+ * Return: the queue, or NULL with errno set to EINVAL for a bad lane count,
+ * policy or weight, or whatever sq_create_policy set
+ */
+lq_t *lq_create(unsigned nlanes, size_t depth, size_t width,
+                lqpolicy_t policy, const unsigned *weights, const fullpolicy_t *full)
+{
+    lq_t *lqp;
+    unsigned i;
+
+    if (nlanes == 0 || nlanes > LQ_MAX_LANES ||
+        (policy != LQ_STRICT && policy != LQ_WRR) ||
+        (policy == LQ_WRR && weights == NULL))
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+    /* aligned so ready and turn really get their own lines */
+    lqp = aligned_alloc( CACHE_LINE, SQ_STRIDE(sizeof(lq_t)) );
+    if (lqp == NULL)
+        return (NULL);
+    memset( lqp, 0, sizeof(lq_t) );
+    lqp->nlanes = nlanes;
+    lqp->policy = policy;
+    if (policy == LQ_WRR && lq_schedule(lqp, weights) != 0)
+    {
+        free(lqp);
+        return (NULL);
+    }
+    for (i = 0; i < nlanes; i++)
+    {
+        lqp->lane[i] = sq_create_policy(depth, width, full ? full[i] : SQ_OVERWRITE);
+        if (lqp->lane[i] == NULL)
+        {
+            lq_destroy(lqp);
+            return (NULL);
+        }
+    }
+    atomic_init(&lqp->ready, 0);
+    atomic_init(&lqp->turn, 0);
+    return (lqp);
+}
+
+/**
+ * lq_destroy - free every lane and the queue
+ * @lqp: the queue, no thread may be using it.  NULL is ignored.
+ */
+void lq_destroy(lq_t *lqp)
+{
+    unsigned i;
+
+    if (lqp == NULL)
+        return;
+    for (i = 0; i < lqp->nlanes; i++)
+        sq_destroy(lqp->lane[i]);
+    free(lqp);
+}
+
+/**
+ * lq_set_mode - set the lockmode_t of every lane
+ * @lqp: the queue, before the first lq_enq
+ * @mode: the lock, or LOCK_FREE for one producer per lane and one consumer
+ */
+void lq_set_mode(lq_t *lqp, lockmode_t mode)
+{
+    unsigned i;
+
+    for (i = 0; i < lqp->nlanes; i++)
+        lqp->lane[i]->mode = mode;
+}
+
+/**
+ * lq_reset - empty every lane between test runs
+ * @lqp: the queue, no thread may be using it
+ */
+void lq_reset(lq_t *lqp)
+{
+    unsigned i;
+
+    for (i = 0; i < lqp->nlanes; i++)
+        q_reset(lqp->lane[i]);
+    atomic_store(&lqp->ready, 0);
+    atomic_store(&lqp->turn, 0);
+}
+
+/**
+ * lq_enq - enqueue a payload on one lane
+ * @lqp: the queue
+ * @lane: lane number, below nlanes
+ * @val: the payload, width bytes
+ *
+ * q_enq, then mark the lane ready.  The bit is usually already set while a
+ * lane is busy, so it is read first and written only when clear; the fence
+ * orders the payload before that read against lq_deq clearing the bit and
+ * looking again, so either this producer sees the bit clear or the consumer
+ * sees the payload.  A payload the lane's full policy turned away leaves
+ * the bit alone.
+ *
+ * Return: q_enq's result, 0, or -1 when the lane is full and SQ_FAIL or
+ * SQ_DROP_NEWEST
+ */
+int lq_enq(lq_t *lqp, unsigned lane, buf_t val)
+{
+    uint64_t bit = lq_bit(lane);
+
+    if (q_enq(lqp->lane[lane], val) != 0)
+        return (-1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if ((atomic_load_explicit(&lqp->ready, memory_order_relaxed) & bit) == 0)
+        atomic_fetch_or_explicit(&lqp->ready, bit, memory_order_release);
+    return (0);
+}
+
+/**
+ * lq_try - dequeue from one lane whose ready bit was seen set
+ * @lqp: the queue
+ * @lane: the lane
+ * @valp: return the payload
+ *
+ * If the lane turns out empty its bit is cleared and the lane tried once
+ * more: a producer that queued in between may have found the bit still set
+ * and left it.  If that second try finds a payload the bit goes back on,
+ * since there may be more behind it.
+ *
+ * Return: 0 for a payload, -1 if the lane was empty and its bit is clear
+ */
+static int lq_try(lq_t *lqp, unsigned lane, buf_t *valp)
+{
+    uint64_t bit = lq_bit(lane);
+
+    if (q_deq(lqp->lane[lane], valp) == 0)
+        return (0);
+    atomic_fetch_and_explicit(&lqp->ready, ~bit, memory_order_seq_cst);
+    if (q_deq(lqp->lane[lane], valp) != 0)
+        return (-1);
+    atomic_fetch_or_explicit(&lqp->ready, bit, memory_order_release);
+    return (0);
+}
+
+/**
+ * lq_deq - dequeue the next payload the policy allows
+ * @lqp: the queue
+ * @valp: return the payload, room for width bytes
+ * @lanep: return the lane it came from, may be NULL
+ *
+ * LQ_STRICT tries the lowest set ready bit.  LQ_WRR takes the next schedule
+ * position and tries the first set bit at or after that lane.  A stale bit
+ * is cleared by lq_try and the search starts over, so an empty queue
+ * returns after at most one failed try per stale lane.
+ *
+ * Return: 0 for success, -1 if every lane is empty
+ */
+int lq_deq(lq_t *lqp, buf_t *valp, unsigned *lanep)
+{
+    uint64_t r;
+    unsigned start = 0, lane;
+
+    if (lqp->policy == LQ_WRR)
+        start = lqp->sched[atomic_fetch_add_explicit(&lqp->turn, 1, memory_order_relaxed) % lqp->nsched];
+    while ((r = atomic_load_explicit(&lqp->ready, memory_order_acquire)) != 0)
+    {
+        lane = (start + (unsigned)__builtin_ctzll(lq_rotr(r, start))) & (LQ_MAX_LANES - 1);
+        if (lq_try(lqp, lane, valp) == 0)
+        {
+            if (lanep != NULL)
+                *lanep = lane;
+            return (0);
+        }
+    }
+    return (-1);
+}
@@ -0,0 +1,89 @@
+/*! \file lanes.h
+ *
+ * DRE 2024
+ *
+ * Multi-lane priority queue built from sq_t rings.
+ *
+ * One sq_t carries everything in arrival order, so a control message waits
+ * behind every bulk payload queued before it.  An lq_t gives each priority
+ * level its own ring instead; lane 0 is the most urgent.  Producers pick a
+ * lane, consumers call lq_deq and get the next payload the policy allows:
+ *
+ * - LQ_STRICT always takes the lowest numbered non-empty lane, so a
+ *   control lane never waits behind data however much data is queued.
+ * - LQ_WRR serves the lanes round robin in proportion to their weights, so
+ *   a saturated urgent lane cannot starve the rest.  The weights are laid
+ *   out once at lq_create as an interleaved schedule and every lq_deq takes
+ *   the next position; a lane with nothing queued passes its turn on to the
+ *   next non-empty lane.
+ *
+ * Finding work costs O(1) whatever the number of lanes: ready has one bit
+ * per lane that may hold payloads, and count-trailing-zeros on it (after a
+ * rotate for LQ_WRR) names the lane to try.  A producer sets its lane's bit
+ * after q_enq; a consumer clears it only after q_deq found the lane empty,
+ * then tries once more, so a payload queued in between is never stranded
+ * behind a clear bit.  A set bit on an empty lane costs one failed q_deq.
+ *
+ * Each lane has its own full policy, given to lq_create: SQ_OVERWRITE by
+ * default, or SQ_BLOCK or SQ_FAIL for a bulk lane whose payloads must not
+ * be overwritten.  lq_enq returns q_enq's result.
+ *
+ * Each lane keeps its own lock, so producers on different lanes never
+ * contend.  Set the lanes' mode with lq_set_mode; LOCK_FREE needs one
+ * producer per lane and one consumer in all.
+ */
+
+#ifndef _LANES_H
+#define _LANES_H
+
+#include <stdint.h>     /* uint8_t, uint64_t */
+#include <stdatomic.h>  /* atomic_ operations */
+#include "vringbuffer.h" /* sq_t, buf_t, lockmode_t, fullpolicy_t */
+
+/// \def LQ_MAX_LANES one bit per lane in ready
+#define LQ_MAX_LANES 64
+/// \def LQ_SCHED_MAX longest LQ_WRR schedule, the sum of the weights
+#define LQ_SCHED_MAX 1024
+
+/**
+ * lqpolicy_t - which lane lq_deq serves next
+ * @LQ_STRICT: the lowest numbered non-empty lane (default)
+ * @LQ_WRR: weighted round robin over the non-empty lanes
+ */
+typedef enum lqpolicy
+{
+    LQ_STRICT = 0,
+    LQ_WRR = 1
+} lqpolicy_t;
+
+/**
+ * struct lq - multi-lane queue
+ * @ready: bit i set when lane i may hold payloads
+ * @turn: LQ_WRR, the next schedule position, taken by every lq_deq
+ * @nlanes: number of lanes, at most LQ_MAX_LANES
+ * @policy: the lqpolicy_t
+ * @nsched: LQ_WRR schedule length, the sum of the weights
+ * @sched: LQ_WRR schedule, lane numbers interleaved by weight
+ * @lane: the rings, lane 0 the most urgent
+ */
+typedef struct lq
+{
+    _Alignas(CACHE_LINE) _Atomic(uint64_t) ready;
+    _Alignas(CACHE_LINE) atomic_uint turn;
+    unsigned nlanes;
+    lqpolicy_t policy;
+    unsigned nsched;
+    uint8_t sched[LQ_SCHED_MAX];
+    sq_t *lane[LQ_MAX_LANES];
+} lq_t;
+
+/* externally visible prototypes */
+lq_t *lq_create(unsigned nlanes, size_t depth, size_t width,
+                lqpolicy_t policy, const unsigned *weights, const fullpolicy_t *full);
+void lq_destroy(lq_t *lqp);
+void lq_set_mode(lq_t *lqp, lockmode_t mode);
+void lq_reset(lq_t *lqp);
+int lq_enq(lq_t *lqp, unsigned lane, buf_t val);
+int lq_deq(lq_t *lqp, buf_t *valp, unsigned *lanep);
+
+#endif /* _LANES_H */
@@ -0,0 +1,119 @@
+/*
+ * logevt-decode - print a binary event log as the fprint_evts text.
+ *
+ * fdump_evts appends one segment per dump to a binary log: an
+ * evtbin_hdr_t and its evtbin_t records.  This maps the file and prints
+ * every segment the way fprint_evts would have written it at dump time,
+ * header, numbered records and total, so tools reading the text log work
+ * unchanged.  With -t each record line starts with the number of the
+ * thread that logged it.
+ *
+ * usage: logevt-decode [-t] [file]    file defaults to LOG_BIN_FILE
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logevt.h"
+
+/**
+ * decode - print the segments in len bytes at base
+ *
+ * Return: 0, or -1 at the first segment that isn't whole or isn't ours
+ */
+static int decode(const char *name, const char *base, size_t len, int threads)
+{
+    const evtbin_t *e;
+    evtbin_hdr_t hdr;
+    logrec_t rec;
+    size_t off = 0;
+    uint32_t i;
+
+    while (off < len)
+    {
+        if (len - off < sizeof(hdr))
+        {
+            fprintf(stderr, "%s: truncated header at byte %zu\n", name, off);
+            return (-1);
+        }
+        memcpy(&hdr, base + off, sizeof(hdr));
+        if (memcmp(hdr.magic, EVTBIN_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != EVTBIN_VERSION || hdr.recsize != sizeof(evtbin_t))
+        {
+            fprintf(stderr, "%s: no version %d dump at byte %zu\n", name, EVTBIN_VERSION, off);
+            return (-1);
+        }
+        off += sizeof(hdr);
+        if ((len - off) / sizeof(evtbin_t) < hdr.count)
+        {
+            fprintf(stderr, "%s: dump at byte %zu cut short\n", name, off - sizeof(hdr));
+            return (-1);
+        }
+        /* records follow a header that is a multiple of 8 bytes, so they are aligned */
+        e = (const evtbin_t *)(base + off);
+        fprint_evt_header(stdout, (time_t)hdr.wall);
+        for (i = 0; i < hdr.count; i++)
+        {
+            rec.id = (evtid_t)e[i].id;
+            rec.val = e[i].val;
+            rec.tstamp.tv_sec = (time_t)(e[i].ns / 1000000000ULL);
+            rec.tstamp.tv_nsec = (long)(e[i].ns % 1000000000ULL);
+            if (threads)
+                printf("t%u ", e[i].thread);
+            fprint_evt(stdout, (int)i, &rec);
+        }
+        printf("total log records = %u\n", hdr.count);
+        off += (size_t)hdr.count * sizeof(evtbin_t);
+    }
+    return (0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = LOG_BIN_FILE;
+    struct stat st;
+    void *base;
+    int fd, opt, threads = 0, rc;
+
+    while ((opt = getopt(argc, argv, "th")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threads = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t] [file]\n"
+                    " -t: start each record with the thread that logged it\n"
+                    " file: a binary log from fdump_evts (default %s)\n", argv[0], LOG_BIN_FILE);
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (optind < argc)
+        name = argv[optind];
+    fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+    if (st.st_size == 0)
+        exit(0);
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+    rc = decode(name, base, (size_t)st.st_size, threads);
+    munmap(base, (size_t)st.st_size);
+    close(fd);
+    exit(rc == 0 ? 0 : 1);
+}
@@ -7,11 +7,15 @@
  * the ringbuffer.c example.  evt_que calls are placed strategically in
  * the test code while running.  THen print_evts is called to display all
  * events.
+ *
+ * DRE 2024 - each thread logs into its own ring without a lock, and
+ * print_evts merges the threads' rings back into one time line.
  */
 
 #ifndef _LOGEVT_H
 #define _LOGEVT_H
 
+#include <stdio.h>      /* FILE */
 #include <stdint.h>     /* uint32_t, etc. */
 #include <time.h>       /* timespec */
 #include <pthread.h>    /* pthread_mutex */
@@ -47,6 +51,12 @@ inline static char *ts_delta()
     return (str);
 }
 
+/// \fn ts_delta_ns is the same interval as ts_delta in nanoseconds, for rate calculations
+inline static uint64_t ts_delta_ns()
+{
+    return (uint64_t)((int64_t)(te.tv_sec - ts.tv_sec) * 1000000000LL + (te.tv_nsec - ts.tv_nsec));
+}
+
 
 /** \enum evtid_t a simple event list
  * David T.'s event types to log (modified) - Explained by DRE 2024
@@ -58,12 +68,80 @@ typedef enum evtid
     EVT_DEQ_IDLE = 3,		// Q is idle - EVENT
     EVT_MAX_QUEUE = 4,  	// A maximum Q event 
     EVT_END = 5,			// EVENT - ENDING Q OPERATIONS
+    EVT_EXPIRE = 6,		// expired payloads dropped unread at dequeue, val is how many
 } evtid_t;
 
+/// \def LOG_QDEPTH ring slots per thread, a power of two; the newest LOG_QDEPTH - 1 events are kept
+#define LOG_QDEPTH 16384
+
+/**
+ * struct logrec - one logged event
+ * @id: what happened
+ * @val: the event's value, usually a queue count
+ * @tstamp: CLOCK_MONOTONIC when it was logged
+ */
+typedef struct logrec
+{
+    evtid_t id;
+    uint32_t val;
+    struct timespec tstamp;
+} logrec_t;
+
+/*
+ * Binary dumps, DRE 2024.  fdump_evts appends one segment per dump: an
+ * evtbin_hdr_t, then count evtbin_t records in time order, in the byte
+ * order of the machine that logged them.  logevt-decode turns a file of
+ * segments back into the fprint_evts text.
+ */
+/// \def LOG_BIN_FILE is where fdump_evts appends by default
+#define LOG_BIN_FILE "log_queue_evt.bin"
+/// \def EVTBIN_MAGIC opens every segment, 4 bytes, no NUL
+#define EVTBIN_MAGIC "EVTL"
+/// \def EVTBIN_VERSION changes whenever evtbin_hdr_t or evtbin_t do
+#define EVTBIN_VERSION 1
+
+/**
+ * struct evtbin_hdr - the start of one binary dump
+ * @magic: EVTBIN_MAGIC
+ * @version: EVTBIN_VERSION
+ * @recsize: sizeof(evtbin_t)
+ * @count: records in this dump
+ * @reserved: 0
+ * @wall: time() of the dump, for the text header
+ */
+typedef struct evtbin_hdr
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t recsize;
+    uint32_t count;
+    uint32_t reserved;
+    int64_t wall;
+} evtbin_hdr_t;
+
+/**
+ * struct evtbin - one event in a binary dump, 16 bytes
+ * @ns: CLOCK_MONOTONIC when it was logged, in nanoseconds
+ * @val: the event's value
+ * @id: the evtid_t
+ * @thread: which thread logged it, numbered in order of their first event
+ */
+typedef struct evtbin
+{
+    uint64_t ns;
+    uint32_t val;
+    uint16_t id;
+    uint16_t thread;
+} evtbin_t;
+
 /* externally visible prototypes */
 void evt_enq(evtid_t id, uint32_t val);
+int evt_deq(logrec_t *recp);
 void print_evts(void);
 void fprint_evts(void);
+void fprint_evt_header(FILE *out, time_t wall);
+void fprint_evt(FILE *out, int idx, const logrec_t *recp);
+long fdump_evts(const char *path);
 
 #endif /* _LOGEVT_H */
 
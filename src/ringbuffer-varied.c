@@ -18,6 +18,9 @@
  *
  * */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE    /* pthread_setaffinity_np, CPU_SET */
+#endif
 #include <stdlib.h>     /* atoi, malloc, strtol, strtoll, strtoul, exit, EXIT_FAILURE */
 #include <stdio.h>      /* char I/O, perror */
 #include <unistd.h>     /* getpid, usleep,  common typdefs, e.g. ssize_t, includes getopt.h */
@@ -27,31 +30,77 @@
 #include <pthread.h>    /* pthread_mutex, pthread_barrier */
 #include <stdatomic.h>  /* atomic_ operations */
 #include <stdbool.h>    /* boolean declaration and types: true, false */
+#include <sched.h>      /* sched_yield */
 #include "config.h"     /* meson generated configuration file */
 #include "logevt.h"     /* event logging */
+#include "vringbuffer.h" /* sq_t, q_enq, q_deq */
+#include "slotpool.h"   /* payload slots for -z */
 
 /* commandline args */
 char *cmd_arguments = "\n"					\
                       " -t id: test id to run\n"				\
+                      "    4: compare the throughput of every lock mode\n"	\
+                      " -P n: n producer pthreads (default 1)\n"	\
+                      " -C n: n consumer pthreads (default 1)\n"	\
+                      " -b n: producers enqueue bursts of n with q_enq_bulk (default 1, q_enq)\n"	\
+                      " -D: consumers drain everything queued with q_deq_bulk (default q_deq)\n"	\
+                      " -p: consumers read each payload in its slot with q_deq_peek and q_deq_release (default q_deq)\n"	\
+                      " -z: zero-copy, queue payload_t pointers to pool slots filled in place (not with -b, -D or -p)\n"	\
+                      " -O policy: full ring overwrite, block, fail or drop (drop newest) (default overwrite)\n"	\
+                      " -T usec: drop payloads still queued usec after they were enqueued (default never, not with -z)\n"	\
+                      " -a: pin each pthread to its own cpu, round robin (default unpinned)\n"	\
+                      " -s file: sweep modes, thread counts and payload widths, write CSV to file\n"	\
                       " -m: use mutex (default spinlock)\n"			\
+                      " -f: lock-free, one producer and one consumer (default spinlock)\n"	\
+                      " -L mode: spinlock, mutex, lock-free, ttas, ticket or mcs (default spinlock)\n"	\
+                      " -H: print lock wait and hold time histograms with each result\n"	\
                       " -c cnt: cnt events to enq (default 10000)\n"		\
+                      " -d depth: queue slots, a power of two of at least 8 (default 256)\n"	\
+                      " -w width: payload bytes per slot, at least sizeof(payload_t) (default sizeof(payload_t))\n"	\
                       " -l: event logging (default disabled)\n"		\
+                      " -B: dump the event log in binary to " LOG_BIN_FILE ", read it with logevt-decode (default text to log_queue_evt.log)\n"	\
                       " -h: this help\n"					\
                       ;
 
 static uint32_t debug_flag = 0;
 static uint32_t testid = 0;
-static uint32_t mutex_flag = 0;
+static const char *lock_mode_str[] = { "spinlock", "mutex", "lock-free", "ttas", "ticket", "mcs" };
+static const char *policy_str[] = { "overwrite", "block", "fail", "drop" };
+static fullpolicy_t full_policy = SQ_OVERWRITE; // -O
+static bool hist_flag = false;      // -H
+static lockmode_t lock_mode = LOCK_SPIN;
 static uint32_t cnt_events = 10000;
 //! \note default log flag is false
 //static bool log_flag = false;
 static bool log_flag = true;
-//! \var g_max_entries is the global max number of entries - it can be checked on during operations or at the end
-static size_t g_max_entries = 0;
+//! \var bin_flag dumps the event log with fdump_evts instead of fprint_evts, -B
+static bool bin_flag = false;
+//! \var deq_count is the number of payloads the consumers dequeued in the last run, not counting END
+static size_t deq_count = 0;
+//! \var enq_count is the number of payloads the producers enqueued in the last run, not counting END
+static size_t enq_count = 0;
+//! \var n_producers, n_consumers are the -P and -C pthread counts
+static int n_producers = 1, n_consumers = 1;
+//! \var pin_flag pins the pthreads to cpus with -a
+static bool pin_flag = false;
+//! \var bulk_n is the -b producer burst size, 1 for one q_enq per payload
+static size_t bulk_n = 1;
+//! \var zc_flag queues payload pointers instead of payloads with -z
+static bool zc_flag = false;
+//! \var drain_flag makes the consumers take the whole queue per q_deq_bulk with -D
+static bool drain_flag = false;
+//! \var peek_flag makes the consumers read payloads in place with -p
+static bool peek_flag = false;
+//! \var ttl_ns is the -T payload time to live, 0 never expires
+static uint64_t ttl_ns = 0;
+/// \def MAX_THREADS bounds -P plus -C
+#define MAX_THREADS 64
+/// \def WARMUP_EVENTS is the untimed run before every timed stress run
+#define WARMUP_EVENTS 1000
 #define ARRAY_SIZE(arr)  (sizeof(arr)/sizeof(arr[0]))
 #define INVALID_EL (0xffffffff)
 ///
-#define VERSION_STR 0.1
+#define VERSION_STR "0.1"
 /*
  * Producer sends this element immediately before exitting
  * Consumer deq this element and exits
@@ -59,36 +108,19 @@ static size_t g_max_entries = 0;
  */
 #define END_EL (0xdeadbeef)
 
-/// OLD CODE
-///typedef uint32_t buf_t;
-/** \struct buf_t \brief the void pointer placeholder
- *  The new varied size ringbuffer entry - which makes it more
- * relevant and useful for wider use - requires to exploit the
- * magical void * pointer as a universal placeholder for the memory that is
- * aimed at for replacement or recovery. David T.'s code enqueues an entry
- * and that means the data replaces where the enqueue pointer is aiming at.
- *
- * His code, and if you think about it, was for one integer. And he cheated by
- * calling everything a buf_t in the struct below and that made his logical
- * comparisons and pointer math was limited to one kind of struct type. His confused
- * allocating and logical comparisons made my life harder to expand his work.
- *
- * In the new version the "buffer" buf_t is a void pointer that acts like a placeholder
- * to aim at independently allocated buffers of BUFFER_SIZE size_t. You can now send a data
- * element of up to BUFFER_SIZE into a queue position and out of a queue position because
- * it accomodates any up to that max. Of course we are counting in size_t from 0.
- *
- * When this code is separated into a working #include that encapsulates all needed functionality
- * then all you need to do is redefine or define unique payload_t as the real contents
- * for each buffer. The payload_t can be up to BUFFER_SIZE wide.
- *
- * The beauty is that it will transfer by memcpy the entire buffer but when you type cast it to your
- * own format it will still have those data at proper offsets. As long as you keep the
- * typecast correct and use the same pointer referencing data will appear in the same format.
+/**
+ * experiment with pthread barrier construct. It does not seem to be needed
+ */
+//#define BARRIER
+#ifdef BARRIER
+/**
+ * barrier - pthread barrier to start pthreads at roughly the same time
  *
- * */
-/// \struct void * poiunter allows variable struct type casting with a varied data struct
-typedef void * buf_t; // every buffer slot is by default an address.
+ * This is created and used when the BARRIER define is set, otherwise all
+ * uses are removed from code.
+ */
+pthread_barrier_t barrier;
+#endif
 /**
  * die - helper function to stop immediately
  * @msg - an informational string to identify where program failed
@@ -117,12 +149,12 @@ inline static void nap(uint32_t ms)
 }
 
 /** \deprecated buf_debug is David T.'s code for int only buffers
- * buf_debug - helper function to display a queue bufs array element
- * @buf - pointer to bufs element
+ * buf_debug - helper function to display a queue slot as an int
+ * @buf - address of the slot
  */
-inline static void buf_debug(const buf_t *buf)
+inline static void buf_debug(buf_t buf)
 {
-    printf("%d ", *buf);
+    printf("%d ", *(uint32_t *)buf);
 }
 
 /* Fixed size of the array used for queuing */
@@ -161,6 +193,28 @@ typedef struct payload
 /// BUFFER_SIZE becomes the maximum store per ringbuffer entry
 // you can send and use smaller but it's restricted and will crash
 // if you exceed that level
+//! \var q_depth is the -d slot count given to sq_create
+static size_t q_depth = QDEPTH;
+//! \var q_width is the -w slot width given to sq_create, every payload buffer below is this wide
+static size_t q_width = BUFFER_SIZE;
+/**
+ * rb_test - test ring buffer using sq_t
+ *
+ * Created by main with sq_create once the -d and -w options are known, so
+ * the same test program exercises any queue shape.
+ */
+static sq_t *rb_test = NULL;
+//! \var payload_width is the payload size of the current rb_test, its buffer_width unless -z
+static size_t payload_width = BUFFER_SIZE;
+/**
+ * pool - the -z payload slots
+ *
+ * Created by run_test with depth - n_consumers slots.  A producer can hold
+ * no slot that isn't in the queue or in its own hands, so the queue never
+ * fills far enough for q_enq to overwrite (and lose) a pointer, and the
+ * END pointers always fit.  An empty pool is the producer's backpressure.
+ */
+static slotpool_t *pool = NULL;
 void payload_init ( payload_t * out )
 {
     //a = b = c = d = e = f = g = h = i = j = 0;
@@ -234,6 +288,17 @@ void  payload_set8( payload_t * out, float a, float b, float c, float d, float e
     out->g = g;
     out->h = h;
 }
+/// \fn payload_set_end marks the producer's last payload, the consumer exits when it dequeues it
+void  payload_set_end( payload_t * out )
+{
+    payload_init( out );
+    out->j = (float)END_EL;
+}
+/// \fn payload_is_end is true for a payload marked by payload_set_end
+bool  payload_is_end( const payload_t * in )
+{
+    return in->j == (float)END_EL;
+}
 void  payload_printf( payload_t * out )
 {
     fprintf(stdout, "[%2f][%2f][%2f][%2f][%2f][%2f][%2f][%2f][%2f][%2f]\n", out->a, out->b, out->c, out->d, out->e, out->f, out->g, out->h, out->i, out->j  );
@@ -259,441 +324,33 @@ char * payload_sprintf( payload_t * out )
 /// \def PAYLOADCOPY for a simple one to one copy that assumes memory doesn't overlap...
 #define PAYLOADCOPY(dst,src) memcpy(dst,src, sizeof(payload_t))
 /**
- * struct sq - simple queue
- * @bufs: fix array of buffers
- * @enq: pointer to the bufs element to fill for the newest value,
- *       the element will either be invalid or, if valid, the
- *       oldest filled.
- * @deq: pointer to the bufs element to drain next,
- *       always the oldest element.
- * @count: the number of bufs elements containing data ///!!! WRONG ITS A POINTER ALSO but in address form!!!
- * @first: pointer to the first bufs element
- * @last: pointer to the last bufs element
- * @max: the number of total bufs in the array.
- * @cb: debug callback
- *
- * This is the main simple queue structure.
- * DRE 2024
- *  It's now more than an array of ints and fancy names.
- * simple buffer is an array of buffers with identical pointers and a real counter.
- *
- * The easy way to get at a location, a single pointer in an array of pointers is
- *
- * sq->first + sq->count which then moves to sq->bufs[count]
- * sq->first and sq->last are maintained aiming at the buffer first and last locations for comparison.
- *
- * The current to encode sq->enq can be refound by
- * sq->first + sq->count
- * BUT
- * sq->deq is relative generally as sq->first + ?
- * It now allocates for separate data for each point
- *
- * It is instantiated once for each queue.  The bufs array fills and empties going higher. If the
- * bufs array fills to the last element then it loops back to the first element
- * and starts to overwrite the oldest elements.
- *
- * This structure does not include concurrency mechanisms.  See mutexes and spinlocks
- */
-typedef struct sq
-{
-    //! \var bufs is the modified longer than one element memallocated stores as array destinations
-    buf_t bufs[QDEPTH];
-    //!
-    buf_t * enq; // relative ring buffer write into placeholder pointer
-    //!
-    buf_t * deq; // relative ring buffer read from placeholder pointer
-    //! \var first is supposed to be the enqueuing
-    // absolute pointer to first target
-    buf_t * first;
-    // absolute pointer to last target - he got lazy because types were the same and he mixes counts and pointers
-    buf_t * last;
-    //! \var max is an absolute for the total possible
-    buf_t * max;
-    //
-    /// \note pointers are volatile and David T.'s accesses them unwittingly in his code so I put var placeholder below 
-    /// \note to avoid overwrite knowing that
-    //
-    //! \var placeholder is a protection against accidental overwrites above,,,
-    buf_t * placeholder;  // gives an overwrite buffer one 8 byte spacer
-    //! \var count modified to actual count - he got lazy and that's why portability wasn't there...
-    size_t count;	// an absolute not a reference - but what he didn't use is it can be added as a simple offset if needed
-    //! \var buffer_width is an unsure variable  added while trying to get the others to work
-    size_t buffer_width; // in sizeof value
-    //! \note I have left callback and it can be replaced
-    //! \var cb is the local callback that David T. used for debugging it must have a function that printfs out the actual contents of the buffer.
-    void (*cb)(const buf_t *);//
-} sq_t;
-/**
- * rb_test - test ring buffer using sq_t
- *
- * Initial values can be defined at compile time but can also be dynamically set
- * before the first enqueue operation.
- *
- * NOTE: better to create on local stack if ringbuffer is only accessible to a
- * function/subfunction.
- *
- * \note basic values initialized here get overwritten... DRE 2024
- */
-static sq_t rb_test =
-{
-    .bufs[0]=INVALID_EL, .bufs[1]=INVALID_EL, .bufs[3]=INVALID_EL,
-    .enq = rb_test.bufs,
-    .deq = rb_test.bufs,
-    .count = 0,
-
-    .first = rb_test.bufs,
-    .last = &rb_test.bufs[ARRAY_SIZE(rb_test.bufs)-1],// declared as last entry
-    .max = ARRAY_SIZE(rb_test.bufs),
-    .cb = buf_debug, // never used - this was David T.'s original debug
-};
-/// \fn Init_sq initializes every bufs buffer slot to the maximum size BUFFER_SIZE
-void Init_sq ( sq_t * rb )
-{
-    int i = 0;// raw single row
-    // resize for variable width
-    rb->buffer_width = BUFFER_SIZE;
-
-    // iterate and allocate
-    for (i = 0; i < QDEPTH; i++)
-    {
-        // clear and allocate
-        rb->bufs[i] = calloc( BUFFER_SIZE,0 ); /// just allocate
-    }
-    fprintf(stdout, "allocated %d buffer slots...\n", i);
-    // reset actual count to zero
-    rb->count = 0;
-
-    // set the new callback
-    rb->cb = payload_printf;
-    // nothing else changes
-}
-/// \fn Destroy_sq initializes every bufs buffer slot the the maximum size
-void Destroy_sq ( sq_t * rb )
-{
-    int i = 0;// raw single row
-    rb->buffer_width = 0;
-    for (i = 0; i < QDEPTH; i++)
-    {
-        free(&rb->bufs[i]); /// de allocate
-    }
-    // there is nothing left to find
-    rb->max = 0; // one less than actual number as array starts from 0
-    rb->first = 0; // one less than actual number as array starts from 0
-    rb->last = 0; // one less than actual number as array starts from 0
-    rb->count = 0; // one less than actual number as array starts from 0
-}
-/**
- * q_print: display the all bufs in the queue
- * @label: an informational string used to identify the queue state
+ * q_enq_end: enqueue the END payload that stops q_consumer
  * @sqp: the simple queue context structure
  *
- * Start with first bufs element assigned to a tmp variable
- * print the element value
- * increment tmp until last bufs element
+ * Uses its own payload so the producer's payload isn't left marked for the
+ * next run.  It is a full slot wide because q_enq copies buffer_width bytes.
+ * With -z the END is a NULL payload pointer.  It never expires, whatever
+ * the -T time to live, or the consumer would never stop, and when an -O
+ * policy turns it away from a full ring it is offered again.
  */
-void q_print(const char* label, const sq_t* sqp)
+void q_enq_end(sq_t* sqp)
 {
-    const buf_t *tmp = sqp->first;
-    printf("%s count=%d bufs=%p enq=%p deq=%p\n", label, sqp->count, sqp->bufs, sqp->enq, sqp->deq);
-    do
-    {
-        sqp->cb(tmp);// now works with latest modifications...
-    }
-    while (tmp++ != sqp->last);
-    printf("\n");
-}
-
-/**
- * experiment with pthread barrier construct. It does not seem to be needed
- */
-//#define BARRIER
-#ifdef BARRIER
-/**
- * barrier - pthread barrier to start pthreads at roughly the same time
- *
- * This is created and used when the BARRIER define is set, otherwise all
- * uses are removed from code.
- */
-pthread_barrier_t barrier;
-#endif
-static pthread_mutex_t sq_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-/*
- * lock_t - type for the spinlock bit array
- * C11 spec says to use an atomic for atomic lock value
- */
-typedef atomic_uint lock_t;
+    payload_t *end;
 
-/**
- * lockholder - bit array marking the thread holding the spinlock
- *
- * This will be 0 if no thread holds lock, otherwise ONE of the defined lock
- * bits: LOCK_C for consumer and LOCK_P for producer.  Using a bitarray allows
- * for better metrics in the lock function
- */
-lock_t lockholder = 0;
-#define LOCK_C 0x01
-#define LOCK_P 0x02
-
-/*
- * lock_held_c, lock_held_p: metrics when trying to lock, indicating thread
- * currently holding the lock. Each is a counter incremented in the lock
- * function when lock acquire fails.
- */
-static atomic_int lock_held_c, lock_held_p;
-
-/**
- * lock - try to acquire lock atomically, spin until achieved
- * @bitarrayp: pointer to lock bitarray
- * @desired: bit value used to update lock
- *
- * Loop, testing for all lock bits cleared.  The current value is returned in
- * expected, which can then be used to updates metrics about which thread
- * currently holds the lock.
- * When the lock is cleared, atomically update it to the desired holder.
- *
- * Uses the gcc 7.5+ implementation of atomic_compare_exchange_weak
- * defined in
- * https://en.cppreference.com/w/c/atomic/atomic_compare_exchange
- *
- */
-void lock(lock_t *bitarrayp, uint32_t desired)
-{
-    uint32_t expected = 0; /* lock is not held */
-    uint32_t hung_lock = 0;
-    /* When the lock is released (see release below) then
-     * *bitarrayp is expected to be 0. If it is then *bitarrayp
-     * is updated with the desired value - which will be either LOCK_P
-     * or LOCK_C.
-     * If the comparison fails (meaning the lock is still held), then
-     * the current value of *bitarrayp is copied to expected.
-     * The expected variable is compared with the two lock flags and an
-     * the consumer or producer lock counter is incremented to record that
-     * the lock is held.
-     */
-    do
+    if (zc_flag)
     {
-        if (expected & LOCK_P) lock_held_p++;
-        if (expected & LOCK_C) lock_held_c++;
-        expected = 0;
-        /* occasionally see test timeouts, could be a deadlock
-         * so put some code in that kills the task if lock is held too long
-         */
-        if (++hung_lock > 2000)
-        {
-            fprintf(stderr, "%s: lock may be hung at %u\n", __FUNCTION__, hung_lock);
-            if (hung_lock > 4000)
-                die("probably deadlock");
-        }
-#if 1
-    }
-    while (!atomic_compare_exchange_weak(bitarrayp, &expected, desired));
-#else
-        /* Try different memory models from
-           /usr/lib/gcc/x86_64-linux-gnu/7/include/stdatomic.h
-           memory model: SUC, FAIL
-           __ATOMIC_SEQ_CST
-           __ATOMIC_RELEASE
-           __ATOMIC_ACQUIRE
-           __ATOMIC_ACQ_REL: invalid for call
-         */
+        end = NULL;
+        while (q_enq_by(sqp, &end, SQ_NEVER) != 0)
+            sched_yield();
+        return;
     }
-    while (!atomic_compare_exchange_weak_explicit(bitarrayp,
-            &expected,
-            desired,
-            __ATOMIC_ACQUIRE,
-            __ATOMIC_ACQUIRE
-                                                 ));
-#endif
-}
-
-/**
- * release - clear the bitarray, making the lock available to be acquired.
- * @bitarrayp: pointer to lock bitarray
- *
- * The current thread will have its bit set in the lock variable and be
- * the holder of the lock.  This call effectively releases the lock.
- * Note that *bitarrayp is of type lock_t, which is a C11 atomic.
- */
-void release(lock_t *bitarrayp)
-{
-    *bitarrayp = 0;
-}
-
-/**
- * q_enq: enqueue a new value into the oldest ringbuffer element
- * @sqp: the simple queue context structure
- * @val: value to enter into current bufs element
- *
- * Logic:
- * - update element value and wrap or increment enq pointer
- * - if all bufs are being used then move the deq pointer to the
- *   current oldest (one more than the newest!),
- *   if bufs still available then increment buf count
- */
-void q_enq(sq_t* sqp, buf_t val)
-{
-    /* command line argument to determine if mutex lock or spinlock */
-    if (mutex_flag)
-    {
-        pthread_mutex_lock(&sq_mutex);
-    }
-    else
-    {
-        lock(&lockholder, LOCK_P);
-    }
-    /// if (debug_flag)
-    //  printf("q_enq enter count=%d val=%s enq=%s deq=%s sqp->last=%p sqp->first=%p \n", sqp->count, payload_sprintf((payload_t *)&val), payload_sprintf((payload_t *)sqp->enq), payload_sprintf((payload_t *)sqp->deq), sqp->last, sqp->first);
-    /// OLD CODE
-    /// NEW CODE - copy IN FROM external variable
-    //
-    memcpy( &sqp->enq, val, BUFFER_SIZE );/// NEW COPY INTO START OF STRUCT NO MATTER SIZE
-    // for now a constant buffer size which would be the maximal
-    /// ITERATOR FOR ENQUEUE OPERATION
-    /** compare to last buf first and then increment to next buf
-     * if match last then set to first
-     * the enq pointer after last is never used
-     */
-    if (sqp->enq++ == sqp->last)
-        sqp->enq = sqp->first; // roll around buffer array to lowest
-
-    // increment regardless
-    sqp->count++;
-
-    /// GLOBAL Update for maximum entries
-    if ( g_max_entries < sqp->count )
-    {
-        g_max_entries = sqp->count;
-        if (log_flag)
-        {
-            /// log event before releasing lock = note largest number of queue entries at once
-            evt_enq(EVT_MAX_QUEUE, g_max_entries);
-        }
-
-    }
-
-    /* When the the array is full, q_enq will be overwriting the oldest buffer
-     * so after enq updates the oldest buffer with the newest datum,
-     * move the deq pointer to the NEXT oldest.
-     * If the array is not full, then deq will still point to the oldest so just
-     * increment the buffer count.
-     */
-    /// again because he's lazy ("efficient" meaning limited usefulness) he mixes counts and pointers
-    if (sqp->first + sqp->count == sqp->max) // OLD CODE  if (sqp->count == sqp->max)
-    {
-        if (sqp->deq == sqp->last)
-            sqp->deq = sqp->first + 1; // aim dequeue at the lowest absolute pointer plus one
-        else
-            sqp->deq = sqp->enq + 1; // move to just after enqueue
-    }
-    else // majority case - just iterate the count on the ring buffer for most
-    {
-        printf("q_enq exit count=%u \n", sqp->count );
-
-    }
-    //if (debug_flag)
-    //  printf("q_enq exit count=%d enq=%s deq=%s sqp->last=%p sqp->first=%p \n", sqp->count, payload_sprintf((payload_t *)sqp->enq), payload_sprintf((payload_t *)sqp->deq), sqp->last, sqp->first);
-    if (log_flag)
-    {
-        /* log event before releasing lock.  This makes the critical section
-         * longer but logs the event accurately; outside of the critical
-         * section will result in out-of-sequence events being logged.
-         */
-        evt_enq(EVT_ENQ, val);
-    }
-    /* command line argument to determine if mutex lock or spinlock */
-    if (mutex_flag)
-    {
-        pthread_mutex_unlock(&sq_mutex);
-    }
-    else
-    {
-        release(&lockholder);
-    }
-}
-/**
- * q_deq: dequeue the oldest ringbuffer element
- * @sqp: the simple queue context structure
- * @valp: return the value in the current deq element
- *
- * Logic:
- * - If no valid elements, return -1
- * - get value from bufs element
- * - mark queue element as invalid (for debugging) and decrement counter
- * - if last element then wrap to first, otherwise move to next element
- *
- * Return:
- *   0 for success, negative otherwise
- */
-int q_deq(sq_t* sqp, buf_t* valp)
-{
-    /* if no valid entries, return error */
-    if (sqp->count == 0)
-    {
-        fprintf(stdout, " WARNING no count in sq on dequeue!!!\n");
-        return (-1);
-    }
-    /* command line argument to determine if mutex lock or spinlock */
-    if (mutex_flag)
-    {
-        pthread_mutex_lock(&sq_mutex);
-    }
-    else
-    {
-        lock(&lockholder, LOCK_C);
-    }
-    //if (debug_flag) // raw output for now...
-    //  printf("q_deq enter count=%d val=%s enq=%s deq=%s sqp->last=%p sqp->first=%p \n", sqp->count, payload_sprintf((payload_t *)valp), payload_sprintf((payload_t *)sqp->enq), payload_sprintf((payload_t *)sqp->deq), sqp->last, sqp->first);
-    //
-    ///
-    // CRITICAL CODE - THE ACTUAL PURPOSE OF DEQUEUE FCN
-    ///
-    /// ORIGINAL CODE
-    /// NEW CODE - copy out to external variable
-    //
-/// void *memcpy(void dest[restrict .n], const void src[restrict .n], size_t n);
-    memcpy( *valp, &sqp->deq, BUFFER_SIZE );// for now a constant buffer size which would be the maximal
-    /* set bufs element to invalid for debugging */
-    //if (debug_flag)
-    ///  *(sqp->deq) = INVALID_EL; /// OLD CODE - just a simple one address
-    //  printf("q_deq exit count=%d val=%s enq=%s deq=%s sqp->last=%p sqp->first=%p \n", sqp->count, payload_sprintf((payload_t *)valp), payload_sprintf((payload_t *)sqp->enq), payload_sprintf((payload_t *)sqp->deq), sqp->last, sqp->first);
-
-    ///
-    // END CRITICAL CODE  - REST IS HOUSKEEPING
-    //
-    /* dec count because bufs element can be reused now */
-    sqp->count--; // decrease valid available elements - because the total amount "available" never changes
-    // This is David T's buffer decrement / dequeue interpretation
-    //
-    /* compare to last buf first and then increment to next buf
-     * if match last then set to first
-     * the enq pointer after last is never used
-     */
-    // increments queue buffer up towards sqp->deq
-    if (sqp->deq++ == sqp->last)/// wraparound to the lowest buffer
-        sqp->deq = sqp->first;
-    if (log_flag)
-    {
-        /* log event before releasing lock.  This makes the critical section
-         * longer but logs the event accurately; outside of the critical
-         * section will result in out-of-sequence events being logged.
-         */
-        evt_enq(EVT_DEQ, *valp);
-    }
-    //if (debug_flag)
-    //  printf("q_deq exit count=%d ep=%p val=%s dp=%p val=%s\n", sqp->count, sqp->enq, *(sqp->enq), sqp->deq, *(sqp->deq));
-    fprintf(stdout, "q_deq exit sqp->count=%u\n", sqp->count);
-
-    /* command line argument to determine if mutex lock or spinlock */
-    if (mutex_flag)
-    {
-        pthread_mutex_unlock(&sq_mutex);
-    }
-    else
-    {
-        release(&lockholder);
-    }
-    return (0);
+    end = calloc(1, sqp->buffer_width);
+    if (end == NULL)
+        die("q_enq_end");
+    payload_set_end( end );
+    while (q_enq_by(sqp, end, SQ_NEVER) != 0)
+        sched_yield();
+    free(end);
 }
 
 /**
@@ -701,8 +358,9 @@ int q_deq(sq_t* sqp, buf_t* valp)
  * @arg: pthread arguments passed from pthread_create (not used)
  *
  * This pthread only enqueues values to the ringbuffer.  The values increase to
- * represent a chronologically order.  When the thread exits, it enqueus an
- * END_EL value for the consumer to recognize there are no more enqueued values.
+ * represent a chronologically order.  The END payloads that stop the
+ * consumers are enqueued by run_test once every producer has exited, one
+ * per consumer.
  *
  * NOTES:
  * I experimented with allowing the thread to relax (short sleep) after
@@ -710,7 +368,7 @@ int q_deq(sq_t* sqp, buf_t* valp)
  * I experimented with a pthread barrier wait so producer/consumer start at roughly
  * the same time but this appears to be unnecesasry.
  *
- * Return: NULL
+ * Return: the number of payloads enqueued, cast to a pointer
  */
 void* q_producer_ut(void *arg)
 {
@@ -718,20 +376,25 @@ void* q_producer_ut(void *arg)
 /// NEW CODE
     buf_t * val = (buf_t *)( arg ); /// recast the function parameter as a payload_t
     
-    void (*fnenq)(sq_t*, buf_t) = q_enq;
+    int (*fnenq)(sq_t*, buf_t) = q_enq;
 #ifdef BARRIER
     pthread_barrier_wait(&barrier);
 #endif
     fprintf(stderr, "%s: several small enq tests\n", __FUNCTION__);
     /* test enq works before wrapping */
     for (int i=1; i<3; i++)
-        fnenq(&rb_test, base_idx+i);
+    {
+        payload_set1 ( (payload_t *) arg, (float)base_idx+i );
+        fnenq(rb_test, arg);
+    }
     /* test one loop around the ringbuffer works */
     base_idx += 100;
-    for (int i=1; i<QDEPTH; i++)
-        fnenq(&rb_test, base_idx+i);
-    fnenq(&rb_test, END_EL);
-    return (NULL);
+    for (int i=1; i<rb_test->store.max; i++)
+    {
+        payload_set1 ( (payload_t *) arg, (float)base_idx+i );
+        fnenq(rb_test, arg);
+    }
+    return ((void *)(uintptr_t)(2 + rb_test->store.max - 1));
 }
 /*
  * q_producer_empty - a minimal test of the producer/consumer
@@ -749,10 +412,8 @@ void *q_producer_empty(void *arg)
 #endif
     fprintf(stderr, "%s: a single q_enq\n", __FUNCTION__);
     /* single enq to start consumer */
-    q_enq(&rb_test, val);
-    /* end of enqueue */
-    // REMOVED last enqueue
-    return (NULL);
+    q_enq(rb_test, val);
+    return ((void *)(uintptr_t)1);
 }
 /**
  * q_producer_stress2 - a relatively short stress test of the ringbuffer
@@ -778,7 +439,7 @@ void *q_producer_stress2(void *arg)
         {
 			// set a novel float into the a value...
 			payload_set2 ( (payload_t *) arg, 1.0, (float)base_idx+i );
-            q_enq(&rb_test, arg);// enque 
+            q_enq(rb_test, arg);// enque 
         }// end inner for
         base_idx += 100;
     }// end outer for
@@ -789,13 +450,11 @@ void *q_producer_stress2(void *arg)
 //        {
 //			// set a novel float into the a value...
 //			payload_set1 ( (payload_t *) arg, (float)base_idx+i );
-//            q_enq(&rb_test, arg);// enqueue 
+//            q_enq(rb_test, arg);// enqueue 
 //        }
 //        base_idx += 100;
 //    }
-    /* end of enqueue */
-	/// removed old code
-    return (NULL);
+    return ((void *)(uintptr_t)(20 * 29));
 }
 /*
  * q_producer_stress3 - a long stress test of the ringbuffer
@@ -810,23 +469,35 @@ void *q_producer_stress3(void *arg)
 	//
     buf_t * val = (buf_t *)( arg ); /// recast the function parameter as a payload_t
     fprintf(stderr, "%s: a dynamically sized stress test sending %u events\n", __FUNCTION__, cnt_events);
+    if (bulk_n > 1)
+    {
+        /* bursts: arg holds bulk_n payloads, one q_enq_bulk per full burst */
+        size_t fill = 0;
+        for (int i=0; i<cnt_events; i++)
+        {
+            payload_set3 ( (payload_t *)((char *)arg + fill * rb_test->buffer_width), -1.0, -99.0, (float)base_idx+i );
+            if (++fill == bulk_n || i == cnt_events - 1)
+            {
+                q_enq_bulk(rb_test, arg, fill);
+                fill = 0;
+            }
+        }
+        return ((void *)(uintptr_t)cnt_events);
+    }
     /* stress enq loop */
     for (int i=0; i<cnt_events; i++)
     {
 		// set a novel float into the a value...
 		payload_set3 ( (payload_t *) arg, -1.0, -99.0, (float)base_idx+i );
-        q_enq(&rb_test, arg);// enque 
+        q_enq(rb_test, arg);// enque 
     }    
-	/// removed old code
-    /* end of enqueue */
-	//
-    return (NULL);
+    return ((void *)(uintptr_t)cnt_events);
 }
 /**
  * q_consumer: pthread to call q_deq
- * @arg: pthread arguments passed from pthread_create (not used)
+ * @arg: pthread arguments passed from pthread_create, the payload to dequeue into
  *
- * This pthread loops until the END_EL value is received. It trys to dequeue a
+ * This pthread loops until the END payload is received (see payload_set_end). It trys to dequeue a
  * value. If one is available the function logs it, otherwise it increases and
  * idle counter. After a value is dequeued it will also log the idle counter.
  *
@@ -842,6 +513,8 @@ void *q_producer_stress3(void *arg)
  * the same time but this appears to be unnecesasry.
  * 
  *  consumes all data payloads on the queue list
+ *
+ * Return: the number of payloads dequeued, not counting END, cast to a pointer
  */
 void* q_consumer(void *arg)
 {
@@ -849,9 +522,10 @@ void* q_consumer(void *arg)
 	/// NEW CODE
 	// type casts the pthread argument into a buf_t
 	//
-    buf_t * val = (buf_t *)( arg ); /// recast the function parameter as a payload_t
+    buf_t val = arg; /// q_deq copies each payload out into the memory arg aims at
 
     int idlecnt = 0;
+    size_t count = 0;
     int (*fndeq)(sq_t*, buf_t*) = q_deq; /* use a fn pointer for easy management */
 #ifdef BARRIER
     pthread_barrier_wait(&barrier);
@@ -862,34 +536,67 @@ void* q_consumer(void *arg)
     /// David T.'s terrible naive consumer - there's no error checking in a perpetual consumer that might need to exit
     //
     /// Remember - when you are coding servers the reply may have been stopped because an asteroid fell on the remote host.
-    /* race condition busy-wait until producer enqueues something
+    /* busy-wait until producer enqueues something, then loop until the
+     * producer sends the END payload.  The END payload can arrive at any
+     * time so it is checked on every successful dequeue.
      */
-    int result =0; // new conditional variable
-    //
-    /// NEW CODE - EXPANDED TO FULL DO WHILE LOOP...
-    //
-    do
+    while (!done && drain_flag)
     {
-		// result checking
-		result = (fndeq(&rb_test, val));// consume always but too cutesy
-        idlecnt++;
+        /* drain-all: arg has room for the whole queue, take whatever is there */
+        size_t k = q_deq_bulk(rb_test, arg, rb_test->store.max);
+        size_t ends = 0;
+        for (size_t i = 0; i < k; i++)
+        {
+            if (payload_is_end((payload_t *)((char *)arg + i * rb_test->buffer_width)))
+                ends++;
+            else
+                count++;
+        }
+        if (k == 0)
+        {
+            idlecnt++;
+            continue;
+        }
+        if (log_flag && idlecnt > 0)
+            evt_enq(EVT_DEQ_IDLE, idlecnt);
+        idlecnt = 0;
+        /* one END is ours, put back any we took from the other consumers */
+        if (ends > 0)
+        {
+            done = 1;
+            while (--ends > 0)
+                q_enq_end(rb_test);
+        }
     }
-    while ( result != -1);// now consume always exits when empty queue so race condition isn't maxxed out.
-    if (log_flag)
+    while (!done && peek_flag)
     {
-        /* log how many idle loops before producer starts writing to queue */
-        evt_enq(EVT_DEQ_IDLE, idlecnt);
+        /* in place: nothing is copied, the slot is ours until the release */
+        const payload_t *p = q_deq_peek(rb_test, NULL);
+
+        if (p == NULL)
+        {
+            idlecnt++;
+            continue;
+        }
+        done = payload_is_end(p);
+        q_deq_release(rb_test);
+        if (!done)
+        {
+            count++;
+            if (log_flag && idlecnt > 0)
+                evt_enq(EVT_DEQ_IDLE, idlecnt);
+            idlecnt = 0;
+        }
     }
-    idlecnt = 0;
-    /* loop until the producer sends the END element */
     while (!done)
     {
-        if (0 == fndeq(&rb_test, val))
+        if (0 == fndeq(rb_test, &val))
         {
-            if (val == END_EL)
+            if (payload_is_end(val))
                 done = 1;
             else
             {
+                count++;
                 if (log_flag)
                 {
                     /* log how many idle loops before a new element
@@ -908,67 +615,350 @@ void* q_consumer(void *arg)
     }
     if (debug_flag)
         fprintf(stderr, "%s: exiting\n", __FUNCTION__);
+    return ((void *)(uintptr_t)count);
+}
+
+/**
+ * q_producer_zc - the stress3 producer passing ownership instead of copies
+ * @arg: not used, payloads are filled in pool slots
+ *
+ * Takes a slot from the pool, waiting while every slot is in flight, fills
+ * the payload in place and enqueues just the pointer.  Nothing is copied
+ * but the pointer and nothing is allocated, whatever the payload width.
+ *
+ * Return: the number of payloads enqueued, cast to a pointer
+ */
+void *q_producer_zc(void *arg)
+{
+    int base_idx = 0;  /* a unique number to differentiate q_enq entries */
+    payload_t *p;
+    uint32_t spins;
+
+    fprintf(stderr, "%s: a zero-copy stress test sending %u events\n", __FUNCTION__, cnt_events);
+    for (int i=0; i<cnt_events; i++)
+    {
+        spins = 0;
+        while ((p = slotpool_get(pool)) == NULL)
+            spin_wait(&spins);
+        payload_set3 ( p, -1.0, -99.0, (float)base_idx+i );
+        q_enq(rb_test, &p);
+    }
+    return ((void *)(uintptr_t)cnt_events);
+}
+
+/**
+ * q_consumer_zc - q_consumer for payload pointers
+ * @arg: not used
+ *
+ * Each dequeued pointer is the consumer's until it returns the slot to the
+ * pool.  A NULL pointer is the END.
+ *
+ * Return: the number of payloads dequeued, not counting END, cast to a pointer
+ */
+void *q_consumer_zc(void *arg)
+{
+    payload_t *p = NULL;
+    buf_t val = &p; /// q_deq copies each pointer out into p
+    size_t count = 0;
+    int idlecnt = 0;
+
+    for (;;)
+    {
+        if (0 != q_deq(rb_test, &val))
+        {
+            idlecnt++;
+            continue;
+        }
+        if (p == NULL)
+            break;
+        /* the consumer owns the payload here, look at it like q_consumer does */
+        if (!payload_is_end(p))
+            count++;
+        slotpool_put(pool, p);
+        if (log_flag && idlecnt > 0)
+            evt_enq(EVT_DEQ_IDLE, idlecnt);
+        idlecnt = 0;
+    }
+    return ((void *)(uintptr_t)count);
+}
+
+/**
+ * queue_create - replace rb_test with an empty queue for payloads of width bytes
+ * @width: payload bytes
+ *
+ * With -z the queue itself only carries payload_t pointers; the payloads
+ * live in the pool run_test creates.
+ */
+void queue_create(size_t width)
+{
+    sq_destroy(rb_test);
+    rb_test = sq_create_policy(q_depth, zc_flag ? sizeof(payload_t *) : width, full_policy);
+    if (rb_test == NULL)
+        die("sq_create_policy");
+    rb_test->log = log_flag;
+    rb_test->lock.stat = hist_flag;
+    if (ttl_ns && sq_set_ttl(rb_test, ttl_ns) != 0)
+        die("sq_set_ttl");
+    payload_width = width;
+}
+
+/**
+ * worker_t - one producer or consumer pthread of a run_test
+ * @tid: the pthread
+ * @fn: q_producer_* or q_consumer
+ * @buf: the payload buffer handed to fn, a full slot wide
+ * @cpu: cpu to pin to, -1 to leave it to the scheduler
+ * @ops: payloads fn enqueued or dequeued, its return value
+ * @ns: how long fn ran
+ */
+typedef struct worker
+{
+    pthread_t tid;
+    void* (*fn)(void *);
+    buf_t buf;
+    int cpu;
+    size_t ops;
+    uint64_t ns;
+} worker_t;
+
+//! \var workers holds the producers then the consumers of the last run_test, for report_throughput
+static worker_t workers[MAX_THREADS];
+
+/// \fn now_ns is CLOCK_MONOTONIC in nanoseconds, the per-thread timer
+inline static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec);
+}
+
+/**
+ * q_worker - pthread start routine wrapping a producer or consumer
+ * @arg: the worker_t
+ *
+ * Pins the calling pthread when asked, then runs and times the worker
+ * function and keeps its count.
+ */
+void *q_worker(void *arg)
+{
+    worker_t *w = arg;
+    uint64_t t0;
+
+    if (w->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if (0 != pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            fprintf(stderr, "%s: cannot pin to cpu %d\n", __FUNCTION__, w->cpu);
+    }
+    t0 = now_ns();
+    w->ops = (size_t)(uintptr_t)w->fn(w->buf);
+    w->ns = now_ns() - t0;
     return (NULL);
 }
 
+/**
+ * run_test - time n_producers and n_consumers pthreads over rb_test
+ * @fn_producer: the producer pthread function
+ * @fn_consumer: the consumer pthread function
+ * @pdata: payload each producer's buffer starts from
+ *
+ * With -z the payload pool is created here and destroyed after the run.
+ * Each pthread gets its own payload buffer of payload_width bytes
+ * per payload: one for q_enq/q_deq, a -b burst for producers, the whole
+ * queue for -D consumers.
+ * With -a pthreads are pinned round robin over the online cpus, producers
+ * first.  Once the last producer has exited one END payload per consumer is
+ * enqueued, so every consumer stops after the queue is drained.  Totals are
+ * left in enq_count and deq_count.
+ *
+ * Return: nanoseconds from before the first pthread_create to after the
+ * last pthread_join
+ */
+uint64_t run_test(void* (*fn_producer)(void *), void* (*fn_consumer)(void *), payload_t *pdata)
+{
+    int nthreads = n_producers + n_consumers;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    if (zc_flag && (pool = slotpool_create(rb_test->store.max - n_consumers, payload_width)) == NULL)
+        die("slotpool_create");
+    for (i = 0; i < nthreads; i++)
+    {
+        workers[i].fn = (i < n_producers) ? fn_producer : fn_consumer;
+        /* producers need room for a -b burst, drain-all consumers for the whole queue */
+        workers[i].buf = calloc((i < n_producers) ? bulk_n : (drain_flag ? rb_test->store.max : 1), payload_width);
+        if (workers[i].buf == NULL)
+            die("calloc");
+        if (i < n_producers)
+            memcpy(workers[i].buf, pdata, BUFFER_SIZE);
+        workers[i].cpu = (pin_flag && ncpu > 0) ? (int)(i % ncpu) : -1;
+        workers[i].ops = 0;
+        workers[i].ns = 0;
+    }
+    ts_start();
+    for (i = 0; i < nthreads; i++)
+    {
+        if (0 != pthread_create(&workers[i].tid, NULL, q_worker, &workers[i]))
+            die("pthread_create");
+    }
+    /* wait for the producers, then stop each consumer with its own END */
+    for (i = 0; i < n_producers; i++)
+        pthread_join(workers[i].tid, NULL);
+    for (i = 0; i < n_consumers; i++)
+        q_enq_end(rb_test);
+    // CONSUMERS MUST JOIN LAST THEY'RE STILL CONSUMING DATA UP UNTIL THERE'S NO QUEUE DATA LEFT...
+    for (i = n_producers; i < nthreads; i++)
+        pthread_join(workers[i].tid, NULL);
+    ts_end();
+
+    enq_count = deq_count = 0;
+    for (i = 0; i < nthreads; i++)
+    {
+        if (i < n_producers)
+            enq_count += workers[i].ops;
+        else
+            deq_count += workers[i].ops;
+        free(workers[i].buf);
+        workers[i].buf = NULL;
+    }
+    slotpool_destroy(pool);
+    pool = NULL;
+    return (ts_delta_ns());
+}
+
+/**
+ * bench - warm up, then time one run_test
+ * @fn_producer: the producer pthread function
+ * @fn_consumer: the consumer pthread function
+ * @pdata: payload each producer's buffer starts from
+ *
+ * The untimed warm-up sends WARMUP_EVENTS per producer (fewer if -c is
+ * smaller) so the timed run doesn't pay for first-touch page faults on the
+ * slab, cold caches and thread creation ramp-up.  Only the stress3 producer
+ * takes its count from cnt_events; the others repeat their fixed runs.
+ *
+ * Return: nanoseconds of the timed run
+ */
+uint64_t bench(void* (*fn_producer)(void *), void* (*fn_consumer)(void *), payload_t *pdata)
+{
+    uint32_t cnt = cnt_events;
+
+    cnt_events = (cnt < WARMUP_EVENTS) ? cnt : WARMUP_EVENTS;
+    q_reset(rb_test);
+    run_test(fn_producer, fn_consumer, pdata);
+    cnt_events = cnt;
+    q_reset(rb_test);
+    return (run_test(fn_producer, fn_consumer, pdata));
+}
+
+/**
+ * report_throughput - summary of a run_test, then one line per pthread
+ * @ns: elapsed time returned by run_test
+ * @csv: if not NULL, also append one CSV row here
+ *
+ * Throughput counts the payloads the consumers received; with the locked
+ * modes a producer that laps the consumers overwrites payloads, which are
+ * then never received, so enqueued is reported too, and with -T so are the
+ * payloads dropped for being stale.  What a full ring cost under the -O
+ * policy comes next, and lost is every sequence number no consumer saw.
+ * Per-thread ops/sec is over that pthread's own run time.
+ */
+void report_throughput(uint64_t ns, FILE *csv)
+{
+    double secs = ns / 1e9;
+    int i;
+
+    fprintf(stderr, "%-9s P=%d C=%d burst=%zu%s payload=%zu bytes depth=%zu enqueued=%zu dequeued=%zu expired=%zu max queued=%zu %s ops/sec=%.0f ns/op=%.1f\n",
+            lock_mode_str[rb_test->mode], n_producers, n_consumers, bulk_n, drain_flag ? " drain" : (peek_flag ? " peek" : ""),
+            payload_width, rb_test->store.max, enq_count, deq_count, rb_test->expired, rb_test->max_entries, ts_delta(),
+            deq_count / secs, deq_count ? ns / (double)deq_count : 0.0);
+    fprintf(stderr, "    full=%s overwritten=%zu dropped=%zu rejected=%zu lost=%zu\n",
+            policy_str[rb_test->policy], rb_test->overwritten, rb_test->dropped, rb_test->rejected, rb_test->lost);
+    for (i = 0; i < n_producers + n_consumers; i++)
+    {
+        fprintf(stderr, "    %s %d cpu=%d ops=%zu ops/sec=%.0f\n",
+                i < n_producers ? "producer" : "consumer",
+                i < n_producers ? i : i - n_producers, workers[i].cpu, workers[i].ops,
+                workers[i].ns ? workers[i].ops / (workers[i].ns / 1e9) : 0.0);
+    }
+    if (rb_test->lock.stat && rb_test->mode != LOCK_FREE)
+        sqlock_print_stats(stderr, lock_mode_str[rb_test->mode], &rb_test->lock);
+    if (csv)
+    {
+        fprintf(csv, "%s,%d,%d,%zu,%zu,%zu,%zu,%llu,%.0f,%.1f\n",
+                lock_mode_str[rb_test->mode], n_producers, n_consumers, payload_width, rb_test->store.max,
+                enq_count, deq_count, (unsigned long long)ns,
+                deq_count / secs, deq_count ? ns / (double)deq_count : 0.0);
+        fflush(csv);
+    }
+}
+
+/**
+ * sweep - benchmark every mode over thread counts and payload widths
+ * @path: the CSV file to write
+ * @pdata: payload each producer's buffer starts from
+ *
+ * Uses the stress3 producer with -c events per producer and the -d depth.
+ * Thread counts run P=C=1,2,4,8; payload widths double from
+ * sizeof(payload_t) to 4096 bytes.  The lock-free mode only takes part at
+ * P=C=1.  rb_test is recreated for every width.
+ */
+void sweep(const char *path, payload_t *pdata)
+{
+    static const int threads[] = { 1, 2, 4, 8 };
+    FILE *csv = fopen(path, "w");
+    size_t width;
+    size_t t;
+    lockmode_t mode;
+
+    if (csv == NULL)
+        die(path);
+    fprintf(csv, "mode,producers,consumers,payload,depth,enqueued,dequeued,ns,ops_per_sec,ns_per_op\n");
+    for (width = BUFFER_SIZE; width <= 4096; width = (width < 64) ? 64 : width * 2)
+    {
+        queue_create(width);
+        for (t = 0; t < ARRAY_SIZE(threads); t++)
+        {
+            n_producers = n_consumers = threads[t];
+            for (mode = LOCK_SPIN; mode < LOCK_MODES; mode++)
+            {
+                if (mode == LOCK_FREE && threads[t] > 1)
+                    continue;
+                rb_test->mode = mode;
+                if (zc_flag)
+                    report_throughput(bench(q_producer_zc, q_consumer_zc, pdata), csv);
+                else
+                    report_throughput(bench(q_producer_stress3, q_consumer, pdata), csv);
+            }
+        }
+    }
+    fclose(csv);
+    fprintf(stderr, "sweep written to %s\n", path);
+}
+
 int main(int argc, char *argv[])
 {
     int opt;
-    pthread_t producer, consumer;		// David T.'s two thread stressors
+    uint64_t ns;
     void* (*fn_producer)(void *arg); 	// pointer to function of a pthread-safe kind...
     void* (*fn_consumer)(void *arg);	// 
+    char *sweep_path = NULL;            // -s CSV file
 
 	// sending into a thread a buffer type which is just a pointer masquerading as a type
     buf_t tbuffer;
-    // buffer of a payload_t type size that is large enough 
-    tbuffer = (buf_t)malloc(sizeof(payload_t)); // a generic payload type is the same as the specific buffer
     //
-    /// generic data structs 
+    /// generic data structs - every one is a full slot wide, q_enq and q_deq copy q_width bytes
     //
-    payload_t data1; // allocated on heap but not initialized as is.
-    payload_t data2;
-    payload_t data3;
+    payload_t *data1;
+    payload_t *data2;
+    payload_t *data3;
     // data4 is the ultimate consumer data destination
-    payload_t data4;
-	// first version has heap allocated only
-	///
-	// Initializing payloads for traffic
-	///
-    //! initialize the payload 1 & 2
-    // 1 is the enqueue entry
-    payload_init( &data1 );  // payload_init byte zeros all data
-    
-    // 2 is the enqueue entry - as per David T's terminology
-    payload_init( &data2 );
-    // 3 is the enqueue entry - as per David T's terminology
-    payload_init( &data3 );
-    // 4 is the dequeue entry - as per David T's terminology
-    payload_init( &data4 );  // zeroed but not initialized
-    
-    // set 3 in data1
-    payload_set3 ( &data1, 1.4, 10.5, -12.6  );
-    // set 3 in data2
-    payload_set5 ( &data2, -10.1, -88.4, 100, 200, 600  );
-
-    // set 3 in data1
-    payload_set6 ( &data3, -10.1, -88.4, 100, 200, 600, -1100  );
-    // set but not allocate data pointed at by tbuffer 
-    payload_set5 ( tbuffer, -99.0, -99.4, -100, -200, -600  );
-    // output what these look like to stdout
-    payload_printf(  &data1 ); // passed as address of / pass by reference 
-    payload_printf(  &data2 );
-    payload_printf(  &data3 );
-    // &data4 is not 
-    payload_printf(  tbuffer ); // tbuffer passed by value which is a pass by reference.
-
-    /* handle commandline options (see usage) */
-
-    /// NEW INITIALIZATION - LOCAL SCOPE INIT FOR NOW
-    // 
-    Init_sq( &rb_test );
+    payload_t *data4;
 
 	//! \note argument optins deciphered from command line...
-    while ((opt = getopt(argc, argv, "t:c:mlh")) != -1)
+    while ((opt = getopt(argc, argv, "t:c:d:w:P:C:s:b:L:O:T:DpzamfHlBh")) != -1)
     {
         switch (opt)
         {
@@ -976,14 +966,66 @@ int main(int argc, char *argv[])
             testid = strtol(optarg, NULL, 0);
             break;
         case 'm':
-            mutex_flag = 1;
+            lock_mode = LOCK_MUTEX;
+            break;
+        case 'f':
+            lock_mode = LOCK_FREE;
+            break;
+        case 'L':
+            for (lock_mode = LOCK_SPIN; lock_mode < LOCK_MODES; lock_mode++)
+                if (strcmp(optarg, lock_mode_str[lock_mode]) == 0)
+                    break;
+            break;
+        case 'H':
+            hist_flag = true;
             break;
         case 'c':
             cnt_events = strtol(optarg, NULL, 0);
             break;
+        case 'd':
+            q_depth = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            q_width = strtoul(optarg, NULL, 0);
+            break;
+        case 'P':
+            n_producers = strtol(optarg, NULL, 0);
+            break;
+        case 'C':
+            n_consumers = strtol(optarg, NULL, 0);
+            break;
+        case 'a':
+            pin_flag = true;
+            break;
+        case 'b':
+            bulk_n = strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            drain_flag = true;
+            break;
+        case 'p':
+            peek_flag = true;
+            break;
+        case 'z':
+            zc_flag = true;
+            break;
+        case 'O':
+            for (full_policy = SQ_OVERWRITE; full_policy < SQ_POLICIES; full_policy++)
+                if (strcmp(optarg, policy_str[full_policy]) == 0)
+                    break;
+            break;
+        case 'T':
+            ttl_ns = strtoull(optarg, NULL, 0) * 1000;
+            break;
+        case 's':
+            sweep_path = optarg;
+            break;
         case 'l':
             log_flag = true;
             break;
+        case 'B':
+            bin_flag = true;
+            break;
         case 'h':
         default:
 			// insert default test number to the least difficult q producer
@@ -992,6 +1034,70 @@ int main(int argc, char *argv[])
             exit(0);
         }
     }
+    /* the smoke test below queues 7 payloads, which the lock-free mode can't overwrite.
+     * Every consumer needs a slot for its END payload and the lock-free
+     * mode has exactly one pthread on each side.  An expired -z pointer
+     * would never go back to the pool; the pool is small enough that the
+     * ring never fills, so no -O policy ever drops one.
+     */
+    if (q_depth < 8 || q_width < BUFFER_SIZE ||
+            n_producers < 1 || n_consumers < 1 || bulk_n < 1 ||
+            (zc_flag && (bulk_n > 1 || drain_flag || peek_flag || ttl_ns)) || (drain_flag && peek_flag) ||
+            full_policy >= SQ_POLICIES || n_producers + n_consumers > MAX_THREADS ||
+            (size_t)n_consumers >= q_depth || lock_mode >= LOCK_MODES ||
+            (lock_mode == LOCK_FREE && (n_producers > 1 || n_consumers > 1)))
+    {
+        fprintf(stderr, "Usage: %s %s\n", argv[0], cmd_arguments);
+        exit(EXIT_FAILURE);
+    }
+
+    /// NEW INITIALIZATION - the queue and every payload buffer are sized from the options
+    //
+    queue_create( q_width );
+    fprintf(stdout, "allocated %zu buffer slots of %zu bytes...\n", rb_test->store.max, rb_test->stride);
+    rb_test->mode = lock_mode;
+    rb_test->log = log_flag;
+    // set the new callback
+    rb_test->cb = (void (*)(buf_t))payload_printf;
+
+    tbuffer = calloc(1, q_width); // a generic payload type is the same as the specific buffer
+    data1 = calloc(1, q_width);
+    data2 = calloc(1, q_width);
+    data3 = calloc(1, q_width);
+    data4 = calloc(1, q_width);
+    if (!tbuffer || !data1 || !data2 || !data3 || !data4)
+        die("calloc");
+	// first version has heap allocated only
+	///
+	// Initializing payloads for traffic
+	///
+    //! initialize the payload 1 & 2
+    // 1 is the enqueue entry
+    payload_init( data1 );  // payload_init byte zeros all data
+    
+    // 2 is the enqueue entry - as per David T's terminology
+    payload_init( data2 );
+    // 3 is the enqueue entry - as per David T's terminology
+    payload_init( data3 );
+    // 4 is the dequeue entry - as per David T's terminology
+    payload_init( data4 );  // zeroed but not initialized
+    
+    // set 3 in data1
+    payload_set3 ( data1, 1.4, 10.5, -12.6  );
+    // set 3 in data2
+    payload_set5 ( data2, -10.1, -88.4, 100, 200, 600  );
+
+    // set 3 in data1
+    payload_set6 ( data3, -10.1, -88.4, 100, 200, 600, -1100  );
+    // set but not allocate data pointed at by tbuffer 
+    payload_set5 ( tbuffer, -99.0, -99.4, -100, -200, -600  );
+    // output what these look like to stdout
+    payload_printf(  data1 ); // passed as address of / pass by reference 
+    payload_printf(  data2 );
+    payload_printf(  data3 );
+    // data4 is not 
+    payload_printf(  tbuffer ); // tbuffer passed by value which is a pass by reference.
+
     fprintf(stderr, "%s: ver=%s running testid=%d\n", argv[0], VERSION_STR, testid);
     if (log_flag)
         fprintf(stderr, "%s: event logger enabled with -l option\n"    "this signficantly increases the execution time\n", argv[0] );
@@ -1009,6 +1115,7 @@ int main(int argc, char *argv[])
 			fn_producer = q_producer_stress2;
 			break;
 		case 3:
+		case 4:
 			fn_producer = q_producer_stress3;
 			break;
 		default:
@@ -1021,91 +1128,107 @@ int main(int argc, char *argv[])
     
     /* queue consumer is generic for all tests */
     fn_consumer = q_consumer;
+    /* -z passes pool slots, whatever the test id */
+    if (zc_flag)
+    {
+        fn_producer = q_producer_zc;
+        fn_consumer = q_consumer_zc;
+    }
 #ifdef BARRIER
   /* multithread, separate producer and consumer threads
      use a barrier to start them at the same time
    */
-  if (0 != pthread_barrier_init(&barrier, NULL, 2))
+  if (0 != pthread_barrier_init(&barrier, NULL, n_producers + n_consumers))
     die("pthread_barrier_init");
 #endif // BARRIER
 //
 ///  TEST CODE
-//
-    ts_start();
-  if (0 != pthread_create(&producer, NULL, fn_producer, &data1))
-    die("pthread_create");
-  if (0 != pthread_create(&consumer, NULL, fn_consumer, &data4)) // passing data4 as the repository for data consumed
-    die("pthread_create");
-
-//  /// CRITICAL SECTION - WHERE ACTION IN THREADS HAPPENS
-
-
-//  /// TEST SECTION - WHERE ACTION IN THREADS HAPPENS
-
 //
 	///
 	// USING A BUFFER POINTER TO ANOTHER DATA PAYLOAD...
 	///
-    buf_t d = (void *) &data2;
+    /* single threaded smoke test before the pthreads start, the consumer
+     * drains what is left.  Running it alongside the pthreads made main a
+     * second consumer that could steal the END payload, and a third party
+     * the lock-free mode can't allow.
+     */
+    buf_t d = (void *) data2;
     
     // RANDOM ENQUEUEING AND DEQUEUEING
-    q_enq(&rb_test, d);
-    q_enq(&rb_test, &data1);
-    q_enq(&rb_test, &data1);
-    q_enq(&rb_test, &data2);
-    q_enq(&rb_test, &data1);
+    q_enq(rb_test, d);
+    q_enq(rb_test, data1);
+    q_enq(rb_test, data1);
+    q_enq(rb_test, data2);
+    q_enq(rb_test, data1);
     fprintf(stdout,"testing callback...\n ");
     // you can see a data buffer with one call to callback like this...
     /// \note this is the proper refencing method for callback use
-    // call by address to a pointer that aims at memory buffer
-    rb_test.cb(&rb_test.enq);
+    // call with the address of the oldest slot
+    rb_test->cb(SQ_BUF(rb_test, rb_test->deq));
 
     fprintf(stdout,"end testing callback...\n ");
 
-    q_enq(&rb_test, &data2);
-    q_enq(&rb_test, &data1);
-    fprintf(stdout, " sq->count:%d  \n", rb_test.count );
+    q_enq(rb_test, data2);
+    q_enq(rb_test, data1);
+    fprintf(stdout, " sq->count:%zu  \n", rb_test->count );
 
     // test deq - SUCCESS
     /// \note this is the propery way to reference a buffer of a void * so that the data is updated
     /// by David T's code convention
-    int a = q_deq( &rb_test, &tbuffer);
+    int a = q_deq( rb_test, &tbuffer);
     if ( a == -1 )// don't write if garbage
         ;
     else
         payload_printf( tbuffer );
+    /* with -z the queue carries pointers, what the smoke test left isn't one */
+    if (zc_flag)
+        q_reset(rb_test);
 
-	/// pthreads are added to the time stamps - ts evaluation
-	/* wait for threads to exit */
-	pthread_join(producer, NULL);
-	
-	// CONSUMER MUST JOIN LAST IT'S STILL CONSUMING DATA UP UNTIL THERE'S NO QUEUE DATA LEFT...
-	pthread_join(consumer, NULL);
-
-	///
-	//  
-	///
-    ts_end();
-    
-    
-    
-    fprintf(stderr, "elapsed time from before first pthread_create to after last pthread_join: %s\n", ts_delta());
+    if (sweep_path)
+    {
+        sweep(sweep_path, data1);
+    }
+    else if (testid == 4)
+    {
+        /* same producers/consumers under each locking mode, lock-free only with one of each */
+        for (lock_mode = LOCK_SPIN; lock_mode < LOCK_MODES; lock_mode++)
+        {
+            if (lock_mode == LOCK_FREE && (n_producers > 1 || n_consumers > 1))
+                continue;
+            rb_test->mode = lock_mode;
+            ns = bench(fn_producer, fn_consumer, data1);
+            report_throughput(ns, NULL);
+        }
+        lock_mode = LOCK_SPIN;
+    }
+    else
+    {
+        /// pthreads are added to the time stamps - ts evaluation
+        if (testid == 3)
+            ns = bench(fn_producer, fn_consumer, data1);
+        else
+            ns = run_test(fn_producer, fn_consumer, data1);
+        fprintf(stderr, "elapsed time from before first pthread_create to after last pthread_join: %s\n", ts_delta());
+        report_throughput(ns, NULL);
+    }
     if (log_flag)
     {
         /* dump all event log records to stdout AFTER the execution timer
          * has stopped. */
         //print_evts(); // replaced with log to file
         /// NEW CODE
-        fprint_evts(); // replaced with log to file
-    }
-    if (!mutex_flag)
-    {
-        fprintf(stderr, "consumer contention lock_held_c=%d "
-                "producer contention lock_held_p=%d\n", lock_held_c, lock_held_p);
+        if (bin_flag)
+            fdump_evts(NULL); // binary, logevt-decode prints it as below
+        else
+            fprint_evts(); // replaced with log to file
     }
 
     /// NEW DECONSTRUCTION
-    //Destroy_sq ( &rb_test ); // can't deconstruct a heap allocated static struct so for stack loaded only
+    sq_destroy ( rb_test ); // frees the slab and the queue
     free(tbuffer);
+    free(data1);
+    free(data2);
+    free(data3);
+    free(data4);
 
 }
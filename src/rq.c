@@ -0,0 +1,207 @@
+/*! \file rq.c
+ *
+ * DRE 2024
+ *
+ * Reorder ring, see rq.h.
+ */
+
+#include <stdlib.h>     /* aligned_alloc, free */
+#include <string.h>     /* memcpy, memset */
+#include <errno.h>      /* errno, EINVAL, ENOMEM, EAGAIN */
+#include "rq.h"         /* rq_t and external function prototypes */
+
+/// \def RQ_SLOT is the address of the slot for sequence number s
+#define RQ_SLOT(rqp, s) ((rqp)->slab + ((s) & (rqp)->mask) * (rqp)->stride)
+
+/**
+ * rq_create - allocate an empty reorder ring
+ * @depth: slots, how far ahead of the consumer a payload may arrive, a
+ *         power of two of at least 2
+ * @width: payload bytes per slot
+ * @max_wait_ns: how long a missing payload may hold back later ones, 0 to
+ *               skip holes as soon as something later is there
+ *
+ * Return: the ring, or NULL with errno set to EINVAL or ENOMEM
+ */
+rq_t *rq_create(size_t depth, size_t width, uint64_t max_wait_ns)
+{
+    rq_t *rqp;
+    size_t i;
+
+    if (width == 0 || depth < 2 || (depth & (depth - 1)) != 0)
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+    rqp = aligned_alloc(CACHE_LINE, SQ_STRIDE(sizeof(rq_t)));
+    if (rqp == NULL)
+    {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    memset(rqp, 0, sizeof(rq_t));
+    rqp->buffer_width = width;
+    rqp->stride = SQ_STRIDE(width);
+    rqp->max = depth;
+    rqp->mask = depth - 1;
+    rqp->max_wait_ns = max_wait_ns;
+    rqp->slab = aligned_alloc(CACHE_LINE, depth * rqp->stride);
+    rqp->word = aligned_alloc(CACHE_LINE, SQ_STRIDE(depth * sizeof(rqp->word[0])));
+    if (rqp->slab == NULL || rqp->word == NULL)
+    {
+        free(rqp->slab);
+        free(rqp->word);
+        free(rqp);
+        errno = ENOMEM;
+        return (NULL);
+    }
+    /* slot i waits for sequence number i */
+    for (i = 0; i < depth; i++)
+        atomic_init(&rqp->word[i], i);
+    atomic_init(&rqp->highest, 0);
+    atomic_init(&rqp->late, 0);
+    atomic_init(&rqp->ahead, 0);
+    return (rqp);
+}
+
+/**
+ * rq_destroy - free the ring and every slot
+ * @rqp: the ring, no thread may be using it.  NULL is ignored.
+ */
+void rq_destroy(rq_t *rqp)
+{
+    if (rqp == NULL)
+        return;
+    free(rqp->word);
+    free(rqp->slab);
+    free(rqp);
+}
+
+/**
+ * rq_enq - put payload seq in its slot
+ * @rqp: the ring
+ * @seq: the payload's sequence number
+ * @val: the payload, buffer_width bytes
+ *
+ * Return: 0 if stored, 1 if the consumer has already released or skipped
+ * seq and the payload is dropped, or -1 with errno set to EAGAIN if seq is
+ * depth or more ahead of the consumer; retry once it has caught up
+ */
+int rq_enq(rq_t *rqp, uint64_t seq, buf_t val)
+{
+    _Atomic(uint64_t) *w = &rqp->word[seq & rqp->mask];
+    uint64_t v = seq, h;
+
+    if (!atomic_compare_exchange_strong_explicit(w, &v, seq | RQ_BUSY,
+            memory_order_acquire, memory_order_relaxed))
+    {
+        /* the word still belongs to an earlier lap */
+        if ((v & ~RQ_BUSY) < seq)
+        {
+            atomic_fetch_add_explicit(&rqp->ahead, 1, memory_order_relaxed);
+            errno = EAGAIN;
+            return (-1);
+        }
+        atomic_fetch_add_explicit(&rqp->late, 1, memory_order_relaxed);
+        return (1);
+    }
+    memcpy(RQ_SLOT(rqp, seq), val, rqp->buffer_width);
+    atomic_store_explicit(w, seq + 1, memory_order_release);
+    h = atomic_load_explicit(&rqp->highest, memory_order_relaxed);
+    while (h < seq + 1 && !atomic_compare_exchange_weak_explicit(&rqp->highest, &h, seq + 1,
+            memory_order_release, memory_order_relaxed))
+        ;
+    return (0);
+}
+
+/**
+ * rq_ready - is payload next there, skipping a hole that has waited long
+ * enough
+ * @rqp: the ring, consumer side
+ *
+ * A hole is only skipped once a later payload has arrived, and then the
+ * whole run of missing payloads up to the next one there goes at once: each
+ * of them has waited at least as long as the first.  A slot a producer is
+ * filling right now isn't a hole.
+ *
+ * Return: 1 if rq_take can go ahead, else 0
+ */
+static int rq_ready(rq_t *rqp)
+{
+    _Atomic(uint64_t) *w = &rqp->word[rqp->next & rqp->mask];
+    uint64_t v = atomic_load_explicit(w, memory_order_acquire), now, e;
+
+    if (v == rqp->next + 1)
+        return (1);
+    if (v != rqp->next || atomic_load_explicit(&rqp->highest, memory_order_acquire) <= rqp->next)
+        return (0);
+    now = sq_clock_ns();
+    if (rqp->hole_ns == 0)
+        rqp->hole_ns = now;
+    if (now - rqp->hole_ns < rqp->max_wait_ns)
+        return (0);
+    while (v == rqp->next && atomic_load_explicit(&rqp->highest, memory_order_acquire) > rqp->next)
+    {
+        /* a producer claiming the slot first makes it in time after all */
+        e = rqp->next;
+        if (!atomic_compare_exchange_strong(w, &e, rqp->next + rqp->max))
+            break;
+        rqp->next++;
+        rqp->skipped++;
+        w = &rqp->word[rqp->next & rqp->mask];
+        v = atomic_load_explicit(w, memory_order_acquire);
+    }
+    rqp->hole_ns = 0;
+    return (v == rqp->next + 1);
+}
+
+/**
+ * rq_take - copy payload next out and free its slot for next + depth
+ */
+static void rq_take(rq_t *rqp, uint64_t *seqp, char *dst)
+{
+    memcpy(dst, RQ_SLOT(rqp, rqp->next), rqp->buffer_width);
+    if (seqp != NULL)
+        *seqp = rqp->next;
+    atomic_store_explicit(&rqp->word[rqp->next & rqp->mask], rqp->next + rqp->max,
+                          memory_order_release);
+    rqp->next++;
+    rqp->released++;
+    rqp->hole_ns = 0;
+}
+
+/**
+ * rq_deq - release the next payload in sequence order
+ * @rqp: the ring, one consumer
+ * @seqp: return its sequence number, may be NULL.  A jump from the last
+ *        one means the payloads in between were skipped.
+ * @valp: return the payload, room for buffer_width bytes
+ *
+ * Return: 0 for success, -1 if the next payload hasn't arrived
+ */
+int rq_deq(rq_t *rqp, uint64_t *seqp, buf_t *valp)
+{
+    if (!rq_ready(rqp))
+        return (-1);
+    rq_take(rqp, seqp, *valp);
+    return (0);
+}
+
+/**
+ * rq_deq_bulk - release up to n payloads of the in-order run
+ * @rqp: the ring, one consumer
+ * @seqs: room for n sequence numbers, may be NULL
+ * @dst: room for n payloads packed buffer_width apart
+ * @n: most payloads to release
+ *
+ * Return: payloads released, in sequence order
+ */
+size_t rq_deq_bulk(rq_t *rqp, uint64_t *seqs, void *dst, size_t n)
+{
+    char *p = dst;
+    size_t i;
+
+    for (i = 0; i < n && rq_ready(rqp); i++)
+        rq_take(rqp, seqs != NULL ? &seqs[i] : NULL, p + i * rqp->buffer_width);
+    return (i);
+}
@@ -0,0 +1,88 @@
+/*! \file rq.h
+ *
+ * DRE 2024
+ *
+ * Reorder ring: payloads that arrive slightly out of order leave in
+ * strict sequence order.
+ *
+ * When several threads feed one stage, say the consumers of an sq_t
+ * passing on what q_deq_seq numbered, payload 41 can arrive after 42.  An
+ * rq_t puts payload s in slot s mod depth as it arrives and the consumer
+ * releases the run of consecutive payloads from the next one it expects.
+ * No sorting, no allocation after rq_create, O(1) per payload.
+ *
+ * Each slot has a sequence word, as in Vyukov's bounded queue:
+ *
+ * - s, or s's slot is free for s.  Producer s claims it by swapping s for
+ *   s | RQ_BUSY, copies the payload in, then stores s + 1: full.
+ * - The consumer takes s when the word is s + 1 and stores s + depth, free
+ *   for the payload depth later.
+ * - A payload more than depth ahead of the consumer finds an older word
+ *   and rq_enq returns EAGAIN; the caller retries.  One the consumer has
+ *   already passed finds a newer word and is dropped as late.
+ *
+ * A hole, a payload that never comes, would stall the consumer for good,
+ * so once a later payload has arrived and the consumer has waited
+ * max_wait_ns on the hole it skips the run of missing payloads, swapping
+ * each empty word for s + depth.  Producer and consumer race for the word
+ * with the same compare-and-swap, so a payload is either in time and
+ * released, or late and refused, never written into a slot the consumer
+ * gave away.
+ *
+ * Any number of producers, one consumer.  Sequence numbers start at 0.
+ */
+
+#ifndef _RQ_H
+#define _RQ_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint64_t */
+#include <stdatomic.h>  /* atomic_ operations */
+#include "vringbuffer.h" /* buf_t, CACHE_LINE, SQ_STRIDE, sq_clock_ns */
+
+/// \def RQ_BUSY marks a slot word whose producer is copying its payload in
+#define RQ_BUSY (1ULL << 63)
+
+/**
+ * struct rq - reorder ring
+ * @slab: the payload slots, stride apart
+ * @word: each slot's sequence word, see above
+ * @stride: bytes from one slot to the next, whole cache lines
+ * @buffer_width: the payload bytes copied in and out
+ * @max: slots, a power of two, at least 2
+ * @mask: max - 1
+ * @max_wait_ns: how long a hole may hold back later payloads
+ * @highest: one past the highest sequence number that has arrived
+ * @late: payloads dropped because the consumer had passed them
+ * @ahead: rq_enq calls refused with EAGAIN
+ * @next: the sequence number the consumer releases next
+ * @hole_ns: when the consumer first found next missing, 0 if it isn't
+ * @released: payloads handed to the consumer
+ * @skipped: sequence numbers given up on
+ */
+typedef struct rq
+{
+    char *slab;
+    _Atomic(uint64_t) *word;
+    size_t stride;
+    size_t buffer_width;
+    size_t max;
+    size_t mask;
+    uint64_t max_wait_ns;
+    _Alignas(CACHE_LINE) _Atomic(uint64_t) highest;
+    atomic_size_t late;
+    atomic_size_t ahead;
+    _Alignas(CACHE_LINE) uint64_t next;
+    uint64_t hole_ns;
+    size_t released;
+    size_t skipped;
+} rq_t;
+
+/* externally visible prototypes */
+rq_t *rq_create(size_t depth, size_t width, uint64_t max_wait_ns);
+void rq_destroy(rq_t *rqp);
+int rq_enq(rq_t *rqp, uint64_t seq, buf_t val);
+int rq_deq(rq_t *rqp, uint64_t *seqp, buf_t *valp);
+size_t rq_deq_bulk(rq_t *rqp, uint64_t *seqs, void *dst, size_t n);
+
+#endif /* _RQ_H */
@@ -0,0 +1,324 @@
+/*! \file shard.c
+ *
+ * DRE 2024
+ *
+ * Sharded queue with work stealing between consumers, see shard.h.
+ */
+
+#include <stdlib.h>     /* calloc, free */
+#include <string.h>     /* memcpy */
+#include <errno.h>      /* errno, EINVAL, ENOMEM */
+#include "shard.h"      /* shq_t and external function prototypes */
+
+/**
+ * shq_shard - shard i, or NULL if it isn't attached yet
+ */
+inline static sq_t *shq_shard(shq_t *shq, unsigned i)
+{
+    return (atomic_load_explicit(&shq->shard[i], memory_order_acquire));
+}
+
+/**
+ * shq_create - allocate a sharded queue with no shards attached
+ * @nshards: number of shards, 1 to SHQ_MAX_SHARDS
+ * @depth: slots per shard, a power of two as sq_create requires
+ * @width: payload bytes per slot
+ *
+ * The shards themselves are created by shq_attach, or by the first
+ * shq_enq on each, from the producer's thread.
+ *
+ * Return: the queue, or NULL with errno set to EINVAL or ENOMEM
+ */
+shq_t *shq_create(unsigned nshards, size_t depth, size_t width)
+{
+    shq_t *shq;
+    unsigned i;
+
+    if (nshards == 0 || nshards > SHQ_MAX_SHARDS ||
+        width == 0 || depth == 0 || (depth & (depth - 1)) != 0)
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+    shq = calloc(1, sizeof(shq_t));
+    if (shq == NULL)
+    {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    shq->nshards = nshards;
+    shq->depth = depth;
+    shq->width = width;
+    shq->mode = LOCK_SPIN;
+    for (i = 0; i < SHQ_MAX_SHARDS; i++)
+        atomic_init(&shq->shard[i], NULL);
+    atomic_init(&shq->dropped, 0);
+    return (shq);
+}
+
+/**
+ * shq_destroy - free every shard and the queue
+ * @shq: the queue, no thread may be using it.  NULL is ignored.
+ */
+void shq_destroy(shq_t *shq)
+{
+    unsigned i;
+
+    if (shq == NULL)
+        return;
+    for (i = 0; i < shq->nshards; i++)
+        sq_destroy(shq_shard(shq, i));
+    free(shq);
+}
+
+/**
+ * shq_set_mode - set the lock of every shard, attached now or later
+ * @shq: the queue, before the first shq_enq
+ * @mode: any locked mode
+ *
+ * Return: 0, or -1 with errno set to EINVAL for LOCK_FREE
+ */
+int shq_set_mode(shq_t *shq, lockmode_t mode)
+{
+    unsigned i;
+    sq_t *sqp;
+
+    if (mode == LOCK_FREE || mode >= LOCK_MODES)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+    shq->mode = mode;
+    for (i = 0; i < shq->nshards; i++)
+    {
+        if ((sqp = shq_shard(shq, i)) != NULL)
+            sqp->mode = mode;
+    }
+    return (0);
+}
+
+/**
+ * shq_attach - create a shard from the thread that will fill it
+ * @shq: the queue
+ * @shard: the shard, below nshards
+ *
+ * Call it from the producer after pinning it: sq_create clears the slab,
+ * so its pages are first touched, and allocated, on the producer's node.
+ * Attaching a shard that is already there does nothing.
+ *
+ * Return: 0, or -1 with errno set to EINVAL for a shard past nshards, or
+ * by sq_create
+ */
+int shq_attach(shq_t *shq, unsigned shard)
+{
+    sq_t *sqp, *none = NULL;
+
+    if (shard >= shq->nshards)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+    if (shq_shard(shq, shard) != NULL)
+        return (0);
+    sqp = sq_create_policy(shq->depth, shq->width, SQ_BLOCK);
+    if (sqp == NULL)
+        return (-1);
+    sqp->mode = shq->mode;
+    if (!atomic_compare_exchange_strong_explicit(&shq->shard[shard], &none, sqp,
+            memory_order_acq_rel, memory_order_acquire))
+        sq_destroy(sqp);
+    return (0);
+}
+
+/**
+ * shq_enq_bulk - a producer enqueues n payloads on its own shard
+ * @shq: the queue
+ * @shard: the producer's shard, attached on first use
+ * @src: n payloads packed width apart, oldest first
+ * @n: number of payloads
+ *
+ * The shards are SQ_BLOCK queues, so the producer waits while its shard
+ * is full and never overwrites a payload nobody has dequeued.
+ *
+ * Return: payloads queued, n, or 0 with errno set by shq_attach if the
+ * shard couldn't be attached
+ */
+size_t shq_enq_bulk(shq_t *shq, unsigned shard, const void *src, size_t n)
+{
+    sq_t *sqp = shard < shq->nshards ? shq_shard(shq, shard) : NULL;
+
+    if (sqp == NULL)
+    {
+        if (shq_attach(shq, shard) != 0)
+            return (0);
+        sqp = shq_shard(shq, shard);
+    }
+    return (q_enq_bulk(sqp, src, n));
+}
+
+/**
+ * shq_enq - a producer enqueues one payload on its own shard
+ * @shq: the queue
+ * @shard: the producer's shard
+ * @val: the payload
+ *
+ * Return: 0, or -1 with errno set by shq_attach
+ */
+int shq_enq(shq_t *shq, unsigned shard, buf_t val)
+{
+    return (shq_enq_bulk(shq, shard, val, 1) == 1 ? 0 : -1);
+}
+
+/**
+ * shq_count - payloads queued over all shards
+ * @shq: the queue
+ *
+ * The sum of each shard's q_count, read without any lock, so a snapshot.
+ */
+size_t shq_count(shq_t *shq)
+{
+    size_t n = 0;
+    unsigned i;
+    sq_t *sqp;
+
+    for (i = 0; i < shq->nshards; i++)
+    {
+        if ((sqp = shq_shard(shq, i)) != NULL)
+            n += q_count(sqp);
+    }
+    return (n);
+}
+
+/**
+ * shq_consumer_init - set up a consumer and its stash
+ * @c: the consumer, private to one thread
+ * @shq: the queue
+ * @home: the shard tried first, usually the consumer's number modulo nshards
+ * @batch: most payloads taken from a shard at once, at least 1
+ *
+ * Return: 0, or -1 with errno set to EINVAL or ENOMEM
+ */
+int shq_consumer_init(shq_consumer_t *c, shq_t *shq, unsigned home, size_t batch)
+{
+    if (home >= shq->nshards || batch == 0)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+    memset(c, 0, sizeof(*c));
+    c->stash = calloc(batch, shq->width);
+    if (c->stash == NULL)
+    {
+        errno = ENOMEM;
+        return (-1);
+    }
+    c->shq = shq;
+    c->home = home;
+    c->batch = batch;
+    return (0);
+}
+
+/**
+ * shq_consumer_fini - free a consumer's stash
+ * @c: the consumer
+ *
+ * Payloads still in the stash have left their shard and can't go back
+ * without breaking its order, or waiting on a full SQ_BLOCK shard whose
+ * producer may be gone.  They are dropped and counted in the queue's
+ * dropped; a consumer that must lose nothing keeps calling shq_deq until
+ * it fails before calling this.
+ *
+ * Return: payloads dropped from the stash
+ */
+size_t shq_consumer_fini(shq_consumer_t *c)
+{
+    size_t lost = c->nstash - c->next;
+
+    if (lost > 0)
+        atomic_fetch_add_explicit(&c->shq->dropped, lost, memory_order_relaxed);
+    free(c->stash);
+    c->stash = NULL;
+    c->next = c->nstash = 0;
+    return (lost);
+}
+
+/**
+ * shq_take - fill the stash from one shard
+ * @c: the consumer
+ * @sqp: the shard
+ * @n: most payloads to take, at most batch
+ *
+ * Return: payloads now in the stash
+ */
+inline static size_t shq_take(shq_consumer_t *c, sq_t *sqp, size_t n)
+{
+    c->next = 0;
+    c->nstash = q_deq_bulk(sqp, c->stash, n);
+    return (c->nstash);
+}
+
+/**
+ * shq_steal - take half of the fullest other shard
+ * @c: the consumer, stash empty
+ *
+ * The fullest shard is found from q_count snapshots, so the victim may be
+ * empty by the time the bulk dequeue runs; then the steal simply fails.
+ *
+ * Return: payloads now in the stash
+ */
+static size_t shq_steal(shq_consumer_t *c)
+{
+    shq_t *shq = c->shq;
+    sq_t *sqp, *victim = NULL;
+    size_t n, most = 0;
+    unsigned i;
+
+    for (i = 0; i < shq->nshards; i++)
+    {
+        if (i == c->home || (sqp = shq_shard(shq, i)) == NULL)
+            continue;
+        if ((n = q_count(sqp)) > most)
+        {
+            most = n;
+            victim = sqp;
+        }
+    }
+    if (victim == NULL)
+        return (0);
+    n = (most + 1) / 2;
+    if (n > c->batch)
+        n = c->batch;
+    if (shq_take(c, victim, n) > 0)
+    {
+        c->steals++;
+        c->stolen += c->nstash;
+    }
+    return (c->nstash);
+}
+
+/**
+ * shq_deq - a consumer dequeues the next payload
+ * @c: the consumer
+ * @valp: return the payload, room for width bytes
+ *
+ * From the stash first, then a batch from the home shard, then a batch
+ * stolen from the fullest other shard.  Payloads from one shard reach one
+ * consumer in the order they were queued.
+ *
+ * Return: 0 for success, -1 if every shard looked empty
+ */
+int shq_deq(shq_consumer_t *c, buf_t *valp)
+{
+    sq_t *home;
+
+    if (c->next == c->nstash)
+    {
+        home = shq_shard(c->shq, c->home);
+        if ((home == NULL || q_count(home) == 0 || shq_take(c, home, c->batch) == 0) &&
+            shq_steal(c) == 0)
+            return (-1);
+    }
+    memcpy(*valp, c->stash + c->next * c->shq->width, c->shq->width);
+    c->next++;
+    return (0);
+}
@@ -0,0 +1,97 @@
+/*! \file shard.h
+ *
+ * DRE 2024
+ *
+ * Sharded queue: one sq_t per producer, consumers with home shards that
+ * steal from the others when their own runs dry.
+ *
+ * With one sq_t every producer and consumer takes the same lock, so adding
+ * threads past two or three only adds waiting.  An shq_t gives each
+ * producer its own shard, so producers never contend with each other and a
+ * consumer normally only meets its home shard's producer:
+ *
+ * - Producer p enqueues on shard p and nothing else.  The shard is created
+ *   by shq_attach from the producer's own thread, so when that thread is
+ *   pinned the slab is first touched, and placed, on its NUMA node.
+ * - A consumer dequeues from its home shard in batches.  When home is empty
+ *   it picks the fullest shard by q_count and steals half of what is queued
+ *   there, up to its batch size, with one q_deq_bulk.  Stolen payloads wait
+ *   in the consumer's stash and are handed out before anything else.
+ * - shq_count adds up the shards' q_count snapshots; no global lock and no
+ *   shared counter every enqueue would have to write.
+ * - The shards are SQ_BLOCK queues: a producer waits when its shard is
+ *   full instead of overwriting the oldest payload, so nothing is lost
+ *   whoever is slow.  The one loss is a consumer finishing with payloads
+ *   still in its stash: shq_consumer_fini counts them in dropped.
+ *
+ * Each shard keeps its own lock.  LOCK_FREE can't be used: a shard has its
+ * home consumer and every thief on the consumer side.
+ */
+
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <stddef.h>     /* size_t */
+#include <stdatomic.h>  /* atomic_ operations */
+#include "vringbuffer.h" /* sq_t, buf_t, lockmode_t */
+
+/// \def SHQ_MAX_SHARDS bounds the number of producers
+#define SHQ_MAX_SHARDS 64
+
+/**
+ * struct shq - sharded queue
+ * @nshards: number of shards, one per producer
+ * @depth: slots per shard, a power of two
+ * @width: payload bytes, the same for every shard
+ * @mode: lock of every shard, never LOCK_FREE
+ * @shard: the shards, NULL until shq_attach
+ * @dropped: payloads left in a stash at shq_consumer_fini
+ */
+typedef struct shq
+{
+    unsigned nshards;
+    size_t depth;
+    size_t width;
+    lockmode_t mode;
+    _Atomic(sq_t *) shard[SHQ_MAX_SHARDS];
+    atomic_size_t dropped;
+} shq_t;
+
+/**
+ * struct shq_consumer - one consumer's view of an shq_t
+ * @shq: the queue
+ * @home: the shard tried first
+ * @batch: most payloads taken from a shard at once
+ * @stash: batch payloads taken but not yet handed out
+ * @next: next stash payload to hand out
+ * @nstash: payloads in the stash
+ * @steals: batches taken from other shards
+ * @stolen: payloads in those batches
+ *
+ * Private to its thread, initialized with shq_consumer_init.
+ */
+typedef struct shq_consumer
+{
+    shq_t *shq;
+    unsigned home;
+    size_t batch;
+    char *stash;
+    size_t next;
+    size_t nstash;
+    size_t steals;
+    size_t stolen;
+} shq_consumer_t;
+
+/* externally visible prototypes */
+shq_t *shq_create(unsigned nshards, size_t depth, size_t width);
+void shq_destroy(shq_t *shq);
+int shq_set_mode(shq_t *shq, lockmode_t mode);
+int shq_attach(shq_t *shq, unsigned shard);
+int shq_enq(shq_t *shq, unsigned shard, buf_t val);
+size_t shq_enq_bulk(shq_t *shq, unsigned shard, const void *src, size_t n);
+size_t shq_count(shq_t *shq);
+int shq_consumer_init(shq_consumer_t *c, shq_t *shq, unsigned home, size_t batch);
+size_t shq_consumer_fini(shq_consumer_t *c);
+int shq_deq(shq_consumer_t *c, buf_t *valp);
+
+#endif /* _SHARD_H */
@@ -0,0 +1,142 @@
+/*! \file slotpool.c
+ *
+ * DRE 2024
+ *
+ * Lock-free payload slot pool, see slotpool.h
+ */
+
+#include <stdlib.h>     /* aligned_alloc, malloc, free */
+#include <string.h>     /* memset */
+#include "slotpool.h"   /* slotpool_t and external function prototypes */
+
+/// \def SLOTPOOL_HEAD packs a tag and a slot index into a head value
+#define SLOTPOOL_HEAD(tag, idx) (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+
+/**
+ * slotpool_alloc - allocate a pool with every slot free
+ * @nslots: number of slots, less than SLOTPOOL_NIL
+ * @width: usable bytes per slot
+ * @align: slots start this many bytes apart at least, a power of two
+ *
+ * Return: the pool or NULL if out of memory or the arguments are zero
+ */
+static slotpool_t *slotpool_alloc(size_t nslots, size_t width, size_t align)
+{
+    slotpool_t *pool;
+    size_t i, bytes;
+
+    if (nslots == 0 || nslots >= SLOTPOOL_NIL || width == 0)
+        return (NULL);
+    pool = aligned_alloc(SLOTPOOL_CACHE_LINE, sizeof(slotpool_t));
+    if (pool == NULL)
+        return (NULL);
+    memset(pool, 0, sizeof(slotpool_t));
+    pool->nslots = nslots;
+    pool->width = width;
+    pool->stride = (width + align - 1) & ~(align - 1);
+    /* aligned_alloc wants a whole number of alignments */
+    bytes = (nslots * pool->stride + SLOTPOOL_CACHE_LINE - 1) & ~(size_t)(SLOTPOOL_CACHE_LINE - 1);
+    pool->slab = aligned_alloc(SLOTPOOL_CACHE_LINE, bytes);
+    pool->next = malloc(nslots * sizeof(pool->next[0]));
+    if (pool->slab == NULL || pool->next == NULL)
+    {
+        slotpool_destroy(pool);
+        return (NULL);
+    }
+    /* slot 0 on top so a fresh pool hands out the slab in address order */
+    for (i = 0; i < nslots; i++)
+        atomic_init(&pool->next[i], (i + 1 < nslots) ? (uint32_t)(i + 1) : SLOTPOOL_NIL);
+    atomic_init(&pool->head, SLOTPOOL_HEAD(0, 0));
+    return (pool);
+}
+
+/**
+ * slotpool_create - allocate a pool of cache line slots, every slot free
+ * @nslots: number of slots, less than SLOTPOOL_NIL
+ * @width: usable bytes per slot, rounded up to whole cache lines
+ *
+ * Return: the pool or NULL if out of memory or the arguments are zero
+ */
+slotpool_t *slotpool_create(size_t nslots, size_t width)
+{
+    return (slotpool_alloc(nslots, width, SLOTPOOL_CACHE_LINE));
+}
+
+/**
+ * slotpool_create_packed - allocate a pool of densely packed slots
+ * @nslots: number of slots, less than SLOTPOOL_NIL
+ * @width: usable bytes per slot, rounded up to 8
+ *
+ * Neighbouring slots share cache lines, so two owners writing them at once
+ * falsely share; the slab start is still cache line aligned.
+ *
+ * Return: the pool or NULL if out of memory or the arguments are zero
+ */
+slotpool_t *slotpool_create_packed(size_t nslots, size_t width)
+{
+    return (slotpool_alloc(nslots, width, sizeof(uint64_t)));
+}
+
+/**
+ * slotpool_destroy - free the slab and the pool
+ * @pool: the pool, no slot may still be in use. NULL is ignored.
+ */
+void slotpool_destroy(slotpool_t *pool)
+{
+    if (pool == NULL)
+        return;
+    free(pool->next);
+    free(pool->slab);
+    free(pool);
+}
+
+/**
+ * slotpool_get - take a free slot
+ * @pool: the pool
+ *
+ * The acquire on head pairs with the release in slotpool_put, so the next
+ * link read here and the slot contents left by the last owner are visible.
+ *
+ * Return: the slot, width bytes, or NULL when every slot is in use
+ */
+void *slotpool_get(slotpool_t *pool)
+{
+    uint64_t old = atomic_load_explicit(&pool->head, memory_order_acquire);
+    uint32_t idx, next;
+
+    do
+    {
+        idx = (uint32_t)old;
+        if (idx == SLOTPOOL_NIL)
+            return (NULL);
+        next = atomic_load_explicit(&pool->next[idx], memory_order_relaxed);
+    }
+    while (!atomic_compare_exchange_weak_explicit(&pool->head, &old,
+            SLOTPOOL_HEAD((old >> 32) + 1, next),
+            memory_order_acquire,
+            memory_order_acquire));
+    return (pool->slab + (size_t)idx * pool->stride);
+}
+
+/**
+ * slotpool_put - give a slot back
+ * @pool: the pool
+ * @slot: a pointer returned by slotpool_get on this pool
+ *
+ * The release publishes the link and everything the owner wrote to the
+ * slot to the next slotpool_get.
+ */
+void slotpool_put(slotpool_t *pool, void *slot)
+{
+    uint32_t idx = (uint32_t)(((char *)slot - pool->slab) / pool->stride);
+    uint64_t old = atomic_load_explicit(&pool->head, memory_order_relaxed);
+
+    do
+    {
+        atomic_store_explicit(&pool->next[idx], (uint32_t)old, memory_order_relaxed);
+    }
+    while (!atomic_compare_exchange_weak_explicit(&pool->head, &old,
+            SLOTPOOL_HEAD((old >> 32) + 1, idx),
+            memory_order_release,
+            memory_order_relaxed));
+}
@@ -0,0 +1,64 @@
+/*! \file slotpool.h
+ *
+ * DRE 2024
+ *
+ * Lock-free pool of fixed-size payload slots.
+ *
+ * For ownership transfer instead of copying: a producer takes a slot from
+ * the pool, fills it in place and queues only the pointer; whoever ends up
+ * with the pointer gives the slot back when it is done.  The payload never
+ * moves and nothing is allocated after slotpool_create.
+ *
+ * - All slots live in one cache line aligned slab, each slot a whole
+ *   number of cache lines so two owners never share a line.
+ * - The free slots form a Treiber stack linked by slot index.  The stack
+ *   head packs the top index with a tag that changes on every push and
+ *   pop, so a compare-and-swap that raced a pop-push-pop of the same slot
+ *   (ABA) fails instead of corrupting the list.
+ * - Slots are never freed while the pool exists, so a stale read of a
+ *   next index is harmless; the tag rejects it.
+ *
+ * slotpool_create_packed drops the whole cache line per slot for pools of
+ * small slots that should sit densely, such as the size-class slabs of
+ * vq_t: there slots are only rounded to 8 bytes and neighbours share lines.
+ */
+
+#ifndef _SLOTPOOL_H
+#define _SLOTPOOL_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint32_t, uint64_t */
+#include <stdatomic.h>  /* atomic_ operations */
+
+/// \def SLOTPOOL_CACHE_LINE slot and head alignment
+#define SLOTPOOL_CACHE_LINE 64
+/// \def SLOTPOOL_NIL the empty index, ends the free list
+#define SLOTPOOL_NIL UINT32_MAX
+
+/**
+ * struct slotpool - pool of nslots slots of width bytes
+ * @head: free list top, tag in the upper 32 bits, slot index in the lower
+ * @slab: the slots, slot i at slab + i * stride
+ * @next: free list links by slot index, only meaningful while free
+ * @nslots: number of slots
+ * @width: usable bytes per slot
+ * @stride: width rounded up to whole cache lines, or to 8 bytes if packed
+ */
+typedef struct slotpool
+{
+    _Alignas(SLOTPOOL_CACHE_LINE) _Atomic(uint64_t) head;
+    _Alignas(SLOTPOOL_CACHE_LINE) char *slab;
+    _Atomic(uint32_t) *next;
+    size_t nslots;
+    size_t width;
+    size_t stride;
+} slotpool_t;
+
+/* externally visible prototypes */
+slotpool_t *slotpool_create(size_t nslots, size_t width);
+slotpool_t *slotpool_create_packed(size_t nslots, size_t width);
+void slotpool_destroy(slotpool_t *pool);
+void *slotpool_get(slotpool_t *pool);
+void slotpool_put(slotpool_t *pool, void *slot);
+
+#endif /* _SLOTPOOL_H */
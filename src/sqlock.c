@@ -0,0 +1,237 @@
+/*! \file sqlock.c
+ *
+ * DRE 2024
+ *
+ * Spin, TTAS, ticket, MCS and mutex locks for sq_t, see sqlock.h
+ */
+
+#include <string.h>     /* memset */
+#include <time.h>       /* clock_gettime */
+#include "sqlock.h"     /* sqlock_t and external function prototypes */
+#include "sqtrace.h"    /* SQ_TRACE_CONTEND */
+
+/// \def SQLOCK_BACKOFF_MAX caps the TTAS pause loop after a lost race
+#define SQLOCK_BACKOFF_MAX 1024
+
+/**
+ * mcs_me - this thread's MCS queue node, see the nesting note in sqlock.h
+ */
+static _Thread_local mcs_node_t mcs_me;
+
+/// \fn sqlock_now is CLOCK_MONOTONIC in nanoseconds
+inline static uint64_t sqlock_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec);
+}
+
+/// \fn sqlock_bucket is the log2 histogram bucket of ns, 0 for 0 ns
+inline static unsigned sqlock_bucket(uint64_t ns)
+{
+    unsigned b = ns ? 64 - __builtin_clzll(ns) : 0;
+    return (b < SQLOCK_BUCKETS ? b : SQLOCK_BUCKETS - 1);
+}
+
+/// \fn cpu_relax is one pause, a hint to the core that this is a spin loop
+inline static void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * sqlock_init - every lock free, statistics off and cleared
+ * @l: the lock
+ */
+void sqlock_init(sqlock_t *l)
+{
+    atomic_init(&l->holder, 0);
+    atomic_init(&l->next, 0);
+    atomic_init(&l->serving, 0);
+    atomic_init(&l->tail, NULL);
+    pthread_mutex_init(&l->mutex, NULL);
+    l->stat = false;
+    sqlock_reset_stats(l);
+}
+
+/**
+ * sqlock_destroy - release what sqlock_init allocated
+ * @l: the lock, not held
+ */
+void sqlock_destroy(sqlock_t *l)
+{
+    pthread_mutex_destroy(&l->mutex);
+}
+
+/**
+ * sqlock_reset_stats - clear both histograms
+ * @l: the lock, not held
+ */
+void sqlock_reset_stats(sqlock_t *l)
+{
+    l->acquired = 0;
+    memset(l->wait, 0, sizeof(l->wait));
+    memset(l->hold, 0, sizeof(l->hold));
+}
+
+/**
+ * sqlock_acquire - take the lock, waiting as long as it takes
+ * @l: the lock
+ * @mode: which lock, not LOCK_FREE
+ * @desired: LOCK_SPIN and LOCK_TTAS holder bit, nonzero
+ *
+ * LOCK_SPIN is the original lock(): when the holder bits are clear,
+ * atomically set them to desired, otherwise go through spin_wait and try
+ * the exchange again.  LOCK_TTAS only tries the exchange once a plain load
+ * sees the lock free, and pauses 1, 2, 4 ... SQLOCK_BACKOFF_MAX times after
+ * each lost race, yielding once the pause is at its longest.
+ * A caller that had to wait fires the lock_contend tracepoint once it has
+ * the lock, see sqtrace.h.
+ */
+void sqlock_acquire(sqlock_t *l, lockmode_t mode, uint32_t desired)
+{
+    uint64_t t0 = l->stat ? sqlock_now() : 0;
+    uint32_t spins = 0;
+    uint32_t expected;
+    uint32_t backoff, i;
+    unsigned ticket;
+    mcs_node_t *pred;
+    bool contended = false;
+
+    switch (mode)
+    {
+    case LOCK_MUTEX:
+        /* the try tells a wait apart from a free mutex */
+        if (pthread_mutex_trylock(&l->mutex) != 0)
+        {
+            contended = true;
+            pthread_mutex_lock(&l->mutex);
+        }
+        break;
+    case LOCK_TTAS:
+        backoff = 1;
+        for (;;)
+        {
+            while (atomic_load_explicit(&l->holder, memory_order_relaxed) != 0)
+                spin_wait(&spins);
+            expected = 0;
+            if (atomic_compare_exchange_weak_explicit(&l->holder, &expected, desired,
+                    memory_order_acquire,
+                    memory_order_relaxed))
+                break;
+            contended = true;
+            for (i = 0; i < backoff; i++)
+                cpu_relax();
+            /* still losing at the longest pause: let the holder run */
+            if (backoff < SQLOCK_BACKOFF_MAX)
+                backoff <<= 1;
+            else
+                sched_yield();
+        }
+        break;
+    case LOCK_TICKET:
+        ticket = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+        while (atomic_load_explicit(&l->serving, memory_order_acquire) != ticket)
+            spin_wait(&spins);
+        break;
+    case LOCK_MCS:
+        atomic_store_explicit(&mcs_me.next, NULL, memory_order_relaxed);
+        atomic_store_explicit(&mcs_me.locked, true, memory_order_relaxed);
+        pred = atomic_exchange_explicit(&l->tail, &mcs_me, memory_order_acq_rel);
+        if (pred != NULL)
+        {
+            /* queue behind pred and spin on our own node until it hands over */
+            atomic_store_explicit(&pred->next, &mcs_me, memory_order_release);
+            while (atomic_load_explicit(&mcs_me.locked, memory_order_acquire))
+                spin_wait(&spins);
+        }
+        break;
+    default:
+        expected = 0;
+        while (!atomic_compare_exchange_weak(&l->holder, &expected, desired))
+        {
+            contended = true;
+            expected = 0;
+            spin_wait(&spins);
+        }
+        break;
+    }
+    if (contended || spins > 0)
+        SQ_TRACE_CONTEND(l, mode, spins);
+    if (l->stat)
+    {
+        l->acquired = sqlock_now();
+        l->wait[sqlock_bucket(l->acquired - t0)]++;
+    }
+}
+
+/**
+ * sqlock_release - give the lock up
+ * @l: the lock, held by the caller
+ * @mode: the mode it was taken with
+ *
+ * The MCS holder with no successor in sight swings tail back to NULL; if a
+ * new waiter got in first it waits for that waiter to link itself.
+ */
+void sqlock_release(sqlock_t *l, lockmode_t mode)
+{
+    uint32_t spins = 0;
+    mcs_node_t *succ;
+    mcs_node_t *me;
+
+    if (l->stat)
+        l->hold[sqlock_bucket(sqlock_now() - l->acquired)]++;
+    switch (mode)
+    {
+    case LOCK_MUTEX:
+        pthread_mutex_unlock(&l->mutex);
+        break;
+    case LOCK_TICKET:
+        /* only the holder writes serving */
+        atomic_store_explicit(&l->serving,
+                              atomic_load_explicit(&l->serving, memory_order_relaxed) + 1,
+                              memory_order_release);
+        break;
+    case LOCK_MCS:
+        succ = atomic_load_explicit(&mcs_me.next, memory_order_acquire);
+        if (succ == NULL)
+        {
+            me = &mcs_me;
+            if (atomic_compare_exchange_strong_explicit(&l->tail, &me, NULL,
+                    memory_order_release,
+                    memory_order_relaxed))
+                return;
+            while ((succ = atomic_load_explicit(&mcs_me.next, memory_order_acquire)) == NULL)
+                spin_wait(&spins);
+        }
+        atomic_store_explicit(&succ->locked, false, memory_order_release);
+        break;
+    default:
+        atomic_store_explicit(&l->holder, 0, memory_order_release);
+        break;
+    }
+}
+
+/**
+ * sqlock_print_stats - one line per nonempty histogram bucket
+ * @fp: where to print
+ * @label: names the queue or the run
+ * @l: the lock
+ */
+void sqlock_print_stats(FILE *fp, const char *label, const sqlock_t *l)
+{
+    uint64_t nwait = 0;
+    unsigned b;
+
+    for (b = 0; b < SQLOCK_BUCKETS; b++)
+        nwait += l->wait[b];
+    fprintf(fp, "%s: %llu acquisitions, ns below      wait       hold\n", label, (unsigned long long)nwait);
+    for (b = 0; b < SQLOCK_BUCKETS; b++)
+    {
+        if (l->wait[b] || l->hold[b])
+            fprintf(fp, "    %20llu %10llu %10llu\n", b ? 1ULL << b : 1ULL,
+                    (unsigned long long)l->wait[b], (unsigned long long)l->hold[b]);
+    }
+}
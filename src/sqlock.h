@@ -0,0 +1,138 @@
+/*! \file sqlock.h
+ *
+ * DRE 2024
+ *
+ * The locks q_enq and q_deq can take around an sq_t, selected per queue
+ * with lockmode_t, plus wait-time and hold-time histograms.
+ *
+ * - LOCK_SPIN is David T.'s original: a compare-and-swap loop on a holder
+ *   bit with no test before the exchange and no fairness, kept as the
+ *   baseline.
+ * - LOCK_TTAS spins reading the flag until it looks free and only then
+ *   tries to take it, backing off exponentially after a lost race, so
+ *   waiters don't keep stealing the cache line from the holder.
+ * - LOCK_TICKET hands the lock out in arrival order: take a ticket, wait
+ *   until it is served.
+ * - LOCK_MCS queues waiters on a linked list and each spins on its own
+ *   node, so a release touches only the next waiter's cache line.
+ * - LOCK_MUTEX is the pthread mutex, which sleeps in the kernel.
+ *
+ * The MCS node is per thread, so a thread must not hold two sqlock_t at
+ * once in LOCK_MCS mode.  q_enq and q_deq never nest.
+ *
+ * Every waiter goes through spin_wait, which pauses and then yields the
+ * cpu after a short while, or in LOCK_TTAS yields once its backoff is at
+ * its longest, instead of giving up: the old lock() killed the process
+ * after 4000 failed attempts.
+ */
+
+#ifndef _SQLOCK_H
+#define _SQLOCK_H
+
+#include <stdint.h>     /* uint32_t, uint64_t */
+#include <stdbool.h>    /* boolean declaration and types: true, false */
+#include <stdio.h>      /* FILE */
+#include <pthread.h>    /* pthread_mutex */
+#include <stdatomic.h>  /* atomic_ operations */
+#include <sched.h>      /* sched_yield */
+
+/// \def SQLOCK_CACHE_LINE keeps the lock words off the histogram line
+#define SQLOCK_CACHE_LINE 64
+/// \def SQLOCK_BUCKETS log2 histogram buckets, bucket b counts times in [2^(b-1), 2^b) ns
+#define SQLOCK_BUCKETS 32
+
+/**
+ * lockmode_t - how q_enq and q_deq keep producers and consumers apart
+ * @LOCK_SPIN: CAS spinlock on a holder bit (default)
+ * @LOCK_MUTEX: the pthread mutex
+ * @LOCK_FREE: no lock. Only valid with exactly one producer and one
+ *             consumer thread.
+ * @LOCK_TTAS: test-and-test-and-set with exponential backoff
+ * @LOCK_TICKET: fair ticket lock
+ * @LOCK_MCS: MCS queue lock
+ * @LOCK_MODES: number of modes
+ */
+typedef enum lockmode
+{
+    LOCK_SPIN = 0,
+    LOCK_MUTEX = 1,
+    LOCK_FREE = 2,
+    LOCK_TTAS = 3,
+    LOCK_TICKET = 4,
+    LOCK_MCS = 5,
+    LOCK_MODES
+} lockmode_t;
+
+/*
+ * lock_t - type for the spinlock bit array
+ * C11 spec says to use an atomic for atomic lock value
+ */
+typedef atomic_uint lock_t;
+
+/**
+ * struct mcs_node - one waiter in an MCS queue
+ * @next: the waiter queued behind this one
+ * @locked: true until the predecessor hands over the lock
+ */
+typedef struct mcs_node
+{
+    _Atomic(struct mcs_node *) next;
+    atomic_bool locked;
+} mcs_node_t;
+
+/**
+ * struct sqlock - every lock word a queue may use, and its statistics
+ * @holder: LOCK_SPIN and LOCK_TTAS, 0 when free, else the holder bit
+ * @next: LOCK_TICKET, the next ticket to hand out
+ * @serving: LOCK_TICKET, the ticket that holds the lock
+ * @tail: LOCK_MCS, the last waiter or NULL when free
+ * @mutex: LOCK_MUTEX
+ * @stat: record the histograms, costs two clock reads per lock
+ * @acquired: when the current holder got the lock
+ * @wait: histogram of ns from asking for the lock to getting it
+ * @hold: histogram of ns from getting the lock to releasing it
+ *
+ * The histograms are only written by the lock holder, so they need no
+ * atomics of their own.
+ */
+typedef struct sqlock
+{
+    _Alignas(SQLOCK_CACHE_LINE) lock_t holder;
+    atomic_uint next;
+    atomic_uint serving;
+    _Atomic(mcs_node_t *) tail;
+    pthread_mutex_t mutex;
+    _Alignas(SQLOCK_CACHE_LINE) bool stat;
+    uint64_t acquired;
+    uint64_t wait[SQLOCK_BUCKETS];
+    uint64_t hold[SQLOCK_BUCKETS];
+} sqlock_t;
+
+/**
+ * spin_wait - back off inside a busy-wait loop
+ * @spins: caller's loop counter, zero it before the loop
+ *
+ * pause for the first few spins, then give the cpu away so the other
+ * thread can make progress even when both share a core.
+ */
+inline static void spin_wait(uint32_t *spins)
+{
+    if (++(*spins) < 64)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else
+        sched_yield();
+}
+
+/* externally visible prototypes */
+void sqlock_init(sqlock_t *l);
+void sqlock_destroy(sqlock_t *l);
+void sqlock_acquire(sqlock_t *l, lockmode_t mode, uint32_t desired);
+void sqlock_release(sqlock_t *l, lockmode_t mode);
+void sqlock_reset_stats(sqlock_t *l);
+void sqlock_print_stats(FILE *fp, const char *label, const sqlock_t *l);
+
+#endif /* _SQLOCK_H */
@@ -0,0 +1,52 @@
+/*! \file sqtrace.h
+ *
+ * DRE 2024
+ *
+ * Static tracepoints on the sq_t hot paths, in place of the printf calls
+ * q_enq and q_deq used to make on every payload.
+ *
+ * With systemtap's <sys/sdt.h> (configure defines HAVE_SYS_SDT_H) each
+ * SQ_TRACE_ macro is a USDT probe in provider "ringbuffers": a single nop
+ * in the code plus a note in the ELF file naming the probe and where its
+ * arguments live.  Nothing else runs unless a tracer attaches, and the
+ * arguments are values the caller already has in registers.  Without the
+ * header the macros compile to nothing.
+ *
+ * Probe             arguments
+ * enq               queue, payloads queued by the call, payloads now queued
+ * deq               queue, payloads taken by the call, payloads still queued
+ * full              queue, fullpolicy_t applied to the payload that didn't fit
+ * empty             queue, a dequeue found nothing to take
+ * lock_contend      lock, lockmode_t, spin_wait rounds before it was taken
+ *
+ * For example, payloads queued per enqueue call across a running test-rb:
+ *
+ *   bpftrace -e 'usdt:./test-rb:ringbuffers:enq { @[arg1] = count(); }'
+ *
+ * or perf probe, then perf record -e sdt_ringbuffers:full.  In LOCK_FREE
+ * mode the queued counts are what the producer or consumer saw, the other
+ * side may have moved since.
+ */
+
+#ifndef _SQTRACE_H
+#define _SQTRACE_H
+
+#include "config.h"     /* HAVE_SYS_SDT_H */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>    /* DTRACE_PROBEn */
+
+#define SQ_TRACE_ENQ(sqp, n, count)   DTRACE_PROBE3(ringbuffers, enq, sqp, n, count)
+#define SQ_TRACE_DEQ(sqp, n, count)   DTRACE_PROBE3(ringbuffers, deq, sqp, n, count)
+#define SQ_TRACE_FULL(sqp, policy)    DTRACE_PROBE2(ringbuffers, full, sqp, policy)
+#define SQ_TRACE_EMPTY(sqp)           DTRACE_PROBE1(ringbuffers, empty, sqp)
+#define SQ_TRACE_CONTEND(l, mode, spins) DTRACE_PROBE3(ringbuffers, lock_contend, l, mode, spins)
+#else
+#define SQ_TRACE_ENQ(sqp, n, count)   do { } while (0)
+#define SQ_TRACE_DEQ(sqp, n, count)   do { } while (0)
+#define SQ_TRACE_FULL(sqp, policy)    do { } while (0)
+#define SQ_TRACE_EMPTY(sqp)           do { } while (0)
+#define SQ_TRACE_CONTEND(l, mode, spins) do { } while (0)
+#endif
+
+#endif /* _SQTRACE_H */
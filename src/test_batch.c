@@ -0,0 +1,233 @@
+/*
+ * test_batch - a consumer woken for batches, with a latency bound.
+ *
+ * Single threaded first: a lone payload is handed over at once while
+ * target is 1, payloads short of target wait for max_wait_ns and no
+ * longer, and a stopped queue hands out what is left and then 0.  One
+ * payload left behind a full max_batch take still comes out within
+ * max_wait_ns, alone and with producers racing the take.  Then a
+ * producer flooding the queue, where batches should grow, and a producer
+ * trickling payloads, where every payload should reach the consumer within
+ * max_wait_ns plus scheduling slack, in the spinlock and the lock-free mode.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "bq.h"
+#include "test_check.h"
+
+#define DEPTH	4096
+#define BATCH	256
+#define EVENTS	200000
+#define TRICKLE	100
+#define WAIT_NS	5000000ULL
+#define SLACK_NS	50000000ULL
+#define SMALL	4
+#define ROUNDS	200
+
+static bq_t *bq;
+static int bad;
+static uint64_t worst;
+static atomic_size_t got;
+
+void single(void)
+{
+    uint64_t v[BATCH], t0, dt;
+    int ok;
+
+    bq = bq_create(DEPTH, sizeof(uint64_t), SQ_FAIL, BATCH, WAIT_NS);
+    v[0] = 7;
+    bq_enq(bq, v);
+    t0 = sq_clock_ns();
+    ok = bq_deq(bq, v) == 1 && v[0] == 7 && bq->full_wakes == 1;
+    check(ok && sq_clock_ns() - t0 < WAIT_NS, "a lone payload is handed over at once");
+
+    /* pretend the queue is busy */
+    atomic_store(&bq->target, 100);
+    t0 = sq_clock_ns();
+    for (v[0] = 0; v[0] < 3; v[0]++)
+        bq_enq(bq, v);
+    ok = bq_deq(bq, v) == 3 && v[0] == 0 && v[2] == 2 && bq->timed_wakes == 1;
+    dt = sq_clock_ns() - t0;
+    printf("3 payloads short of target waited %llu us\n", (unsigned long long)(dt / 1000));
+    check(ok && dt >= WAIT_NS && dt < WAIT_NS + SLACK_NS, "payloads short of target wait max_wait_ns");
+
+    atomic_store(&bq->target, 100);
+    for (v[0] = 0; v[0] < 5; v[0]++)
+        bq_enq(bq, v);
+    bq_stop(bq);
+    ok = bq_deq(bq, v) == 5 && bq_deq(bq, v) == 0;
+    check(ok, "a stopped queue hands out the rest, then 0");
+    check(bq_create(64, 8, SQ_FAIL, 65, WAIT_NS) == NULL, "max_batch above depth is refused");
+    bq_destroy(bq);
+}
+
+/* rounds of SMALL + 1 stamped payloads, each waiting for the last to arrive */
+void *burst(void *arg)
+{
+    uint64_t v, t0;
+    size_t r, i;
+
+    for (r = 0; r < ROUNDS && !bad; r++)
+    {
+        for (i = 0; i <= SMALL; i++)
+        {
+            v = sq_clock_ns();
+            bq_enq(bq, &v);
+        }
+        t0 = sq_clock_ns();
+        while (atomic_load(&got) < (r + 1) * (SMALL + 1))
+        {
+            if (sq_clock_ns() - t0 > WAIT_NS + SLACK_NS)
+            {
+                bad = 1;
+                break;
+            }
+            sched_yield();
+        }
+    }
+    bq_stop(bq);
+    return (NULL);
+}
+
+void *taker(void *arg)
+{
+    uint64_t v[SMALL], now;
+    size_t i, k;
+
+    while ((k = bq_deq(bq, v)) > 0)
+    {
+        now = sq_clock_ns();
+        for (i = 0; i < k; i++)
+            if (now - v[i] > worst)
+                worst = now - v[i];
+        atomic_fetch_add(&got, k);
+    }
+    return (NULL);
+}
+
+void leftover(void)
+{
+    uint64_t v[SMALL], t0, dt;
+    pthread_t p, c;
+    int ok;
+
+    bq = bq_create(16, sizeof(uint64_t), SQ_FAIL, SMALL, WAIT_NS);
+    atomic_store(&bq->target, SMALL);
+    for (v[0] = 0; v[0] <= SMALL; v[0]++)
+        bq_enq(bq, v);
+    ok = bq_deq(bq, v) == SMALL && v[0] == 0;
+    t0 = sq_clock_ns();
+    ok = ok && bq_deq(bq, v) == 1 && v[0] == SMALL;
+    dt = sq_clock_ns() - t0;
+    check(ok && dt < WAIT_NS + SLACK_NS, "one payload left behind a full batch waits max_wait_ns at most");
+    bq_destroy(bq);
+
+    bq = bq_create(16, sizeof(uint64_t), SQ_BLOCK, SMALL, WAIT_NS);
+    bad = 0;
+    worst = 0;
+    atomic_store(&got, 0);
+    pthread_create(&c, NULL, taker, NULL);
+    pthread_create(&p, NULL, burst, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    bq_print_stats(stdout, "leftover", bq);
+    printf("leftover: worst latency %llu us\n", (unsigned long long)(worst / 1000));
+    check(!bad && worst < WAIT_NS + SLACK_NS, "payloads racing a full batch are never stranded");
+    bq_destroy(bq);
+}
+
+void *flood(void *arg)
+{
+    uint64_t v;
+
+    for (v = 0; v < EVENTS; v++)
+        bq_enq(bq, &v);
+    bq_stop(bq);
+    return (NULL);
+}
+
+void *trickle(void *arg)
+{
+    struct timespec pause = { 0, 1000000 };
+    uint64_t v, i;
+
+    for (i = 0; i < TRICKLE; i++)
+    {
+        v = sq_clock_ns();
+        bq_enq(bq, &v);
+        nanosleep(&pause, NULL);
+    }
+    bq_stop(bq);
+    return (NULL);
+}
+
+/* payloads are 0, 1, 2... or, with stamps set, enqueue times */
+void *consumer(void *arg)
+{
+    uint64_t v[BATCH], next = 0, now;
+    int stamps = arg != NULL;
+    size_t i, k;
+
+    while ((k = bq_deq(bq, v)) > 0)
+    {
+        now = sq_clock_ns();
+        for (i = 0; i < k; i++)
+        {
+            if (stamps && now - v[i] > worst)
+                worst = now - v[i];
+            if (!stamps && v[i] != next)
+                bad = 1;
+            next++;
+        }
+    }
+    if (next != (stamps ? TRICKLE : EVENTS))
+        bad = 1;
+    return (NULL);
+}
+
+void run(lockmode_t mode, const char *name)
+{
+    pthread_t p, c;
+    char what[80];
+
+    bq = bq_create(DEPTH, sizeof(uint64_t), SQ_BLOCK, BATCH, WAIT_NS);
+    bq->ring->mode = mode;
+    bad = 0;
+    pthread_create(&c, NULL, consumer, NULL);
+    pthread_create(&p, NULL, flood, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    bq_print_stats(stdout, name, bq);
+    snprintf(what, sizeof(what), "%s: a flood comes out in order in batches", name);
+    check(!bad && bq->batches < EVENTS / 4, what);
+    bq_destroy(bq);
+
+    bq = bq_create(DEPTH, sizeof(uint64_t), SQ_BLOCK, BATCH, WAIT_NS);
+    bq->ring->mode = mode;
+    bad = 0;
+    worst = 0;
+    pthread_create(&c, NULL, consumer, &worst);
+    pthread_create(&p, NULL, trickle, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    bq_print_stats(stdout, name, bq);
+    printf("%s: worst latency %llu us\n", name, (unsigned long long)(worst / 1000));
+    snprintf(what, sizeof(what), "%s: a trickle arrives within max_wait_ns", name);
+    check(!bad && worst < WAIT_NS + SLACK_NS, what);
+    bq_destroy(bq);
+}
+
+int main(int argc, char **argv)
+{
+    single();
+    leftover();
+    run(LOCK_SPIN, "spinlock");
+    run(LOCK_FREE, "lock-free");
+    exit(failures ? 1 : 0);
+}
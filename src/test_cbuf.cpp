@@ -0,0 +1,89 @@
+/*
+ * test_cbuf - exercise the C++ CBUF template with entries that are not
+ * trivially copyable: move-only owners, types without a default constructor
+ * and entries left in the queue when it is destroyed.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory>
+
+/* the C macro section of cbuf.h expects the example queue size */
+#define myQ_SIZE    64
+#include "cbuf.h"
+#include "test_check.h"
+
+#define RING_BUFFER	8
+
+// count live message objects to catch leaks and double destroys
+static int live = 0;
+
+// a message that owns a heap buffer and has no default constructor
+class Message
+{
+public:
+    Message( int id, size_t len ) : m_id( id ), m_len( len ), m_data( new char[ len ] )
+    {
+        live++;
+    }
+    Message( Message &&other ) : m_id( other.m_id ), m_len( other.m_len ), m_data( other.m_data )
+    {
+        other.m_data = NULL;
+        live++;
+    }
+    Message( const Message & ) = delete;
+    Message &operator =( const Message & ) = delete;
+    ~Message()
+    {
+        delete [] m_data;
+        live--;
+    }
+
+    int     m_id;
+    size_t  m_len;
+    char   *m_data;
+};
+
+int main( int argc, char **argv )
+{
+    int i = 0;
+    {
+        // move-only entries
+        CBUF< uint8_t, RING_BUFFER, std::unique_ptr< int > >   ptrQ;
+        for ( i = 0; i < RING_BUFFER; i++ )
+            ptrQ.Push( std::unique_ptr< int >( new int( i )));
+        check( ptrQ.IsFull(), "unique_ptr queue full" );
+        bool inorder = true;
+        for ( i = 0; i < RING_BUFFER; i++ )
+        {
+            std::unique_ptr< int > p = ptrQ.Pop();
+            if ( !p || *p != i )
+                inorder = false;
+        }
+        check( inorder && ptrQ.IsEmpty(), "unique_ptr entries pop in order" );
+    }
+    {
+        // in place construction, wrapping the index several times
+        CBUF< uint8_t, RING_BUFFER, Message >   msgQ;
+        bool inorder = true;
+        for ( i = 0; i < 5 * RING_BUFFER; i++ )
+        {
+            msgQ.Emplace( i, 64 + i );
+            if ( msgQ.Len() == RING_BUFFER / 2 )
+            {
+                Message m = msgQ.Pop();
+                if ( m.m_id != i - RING_BUFFER / 2 + 1 || m.m_data == NULL )
+                    inorder = false;
+            }
+        }
+        check( inorder, "emplaced entries pop in order" );
+        check( live == RING_BUFFER / 2 - 1, "popped entries destroyed" );
+    }
+    // the leftover entries were destroyed with the queue
+    check( live == 0, "leftover entries destroyed with the queue" );
+
+    printf( "test_cbuf: %d failures\n", failures.load() );
+    exit( failures ? 1 : 0 );
+}
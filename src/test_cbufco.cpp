@@ -0,0 +1,164 @@
+/*
+ * test_cbufco - co_await Push/Pop on a small CBUF_Await ring.
+ *
+ * Many logical consumer coroutines share a tiny ring with a few producer
+ * coroutines, first on a single-threaded run queue and then on a run queue
+ * drained by several worker threads.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cbufco.h"
+#include "test_check.h"
+
+#define RING_BUFFER	4
+#define CONSUMERS	1000
+#define PRODUCERS	4
+#define WORKERS		4
+
+/*
+ * Task - fire and forget coroutine. It starts suspended so the test can put
+ * it on the run queue and destroys itself when it finishes.
+ */
+struct Task
+{
+    struct promise_type
+    {
+        Task get_return_object()
+        {
+            return Task{ std::coroutine_handle< promise_type >::from_promise( *this ) };
+        }
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            abort();
+        }
+    };
+    std::coroutine_handle<> m_handle;
+};
+
+/*
+ * RunQueue - the executor, a locked FIFO of runnable coroutines
+ */
+struct RunQueue
+{
+    std::mutex                              m_mutex;
+    std::deque< std::coroutine_handle<> >   m_ready;
+
+    void Post( std::coroutine_handle<> h )
+    {
+        std::lock_guard< std::mutex > guard( m_mutex );
+        m_ready.push_back( h );
+    }
+
+    bool RunOne()
+    {
+        std::coroutine_handle<> h;
+        {
+            std::lock_guard< std::mutex > guard( m_mutex );
+            if ( m_ready.empty() )
+                return false;
+            h = m_ready.front();
+            m_ready.pop_front();
+        }
+        h.resume();
+        return true;
+    }
+};
+
+static void schedule( std::coroutine_handle<> h, void *ctx )
+{
+    static_cast< RunQueue * >( ctx )->Post( h );
+}
+
+typedef CBUF_Await< uint16_t, RING_BUFFER, uint32_t >   ValQ;
+
+static std::atomic< uint64_t >  consumed_sum;
+static std::atomic< int >       consumed;
+static std::atomic< int >       produced;
+
+Task consumer( ValQ &q )
+{
+    uint32_t v = co_await q.Pop();
+    consumed_sum += v;
+    consumed++;
+}
+
+Task producer( ValQ &q, uint32_t first, uint32_t n )
+{
+    for ( uint32_t i = 0; i < n; i++ )
+    {
+        co_await q.Push( first + i );
+        produced++;
+    }
+}
+
+static void run_test( int workers )
+{
+    RunQueue    rq;
+    ValQ        q( schedule, &rq );
+    int         i = 0;
+    uint64_t    expect = 0;
+
+    consumed_sum = 0;
+    consumed = 0;
+    produced = 0;
+    // consumers first so most of them suspend on an empty ring
+    for ( i = 0; i < CONSUMERS; i++ )
+        rq.Post( consumer( q ).m_handle );
+    for ( i = 0; i < PRODUCERS; i++ )
+        rq.Post( producer( q, i * ( CONSUMERS / PRODUCERS ) + 1, CONSUMERS / PRODUCERS ).m_handle );
+    for ( i = 1; i <= CONSUMERS; i++ )
+        expect += i;
+
+    if ( workers == 0 )
+    {
+        while ( rq.RunOne() )
+            ;
+    }
+    else
+    {
+        std::vector< std::thread > pool;
+        for ( i = 0; i < workers; i++ )
+            pool.emplace_back( [ & ]
+        {
+            while ( consumed < CONSUMERS || produced < CONSUMERS )
+            {
+                if ( !rq.RunOne() )
+                    std::this_thread::yield();
+            }
+        } );
+        for ( std::thread &t : pool )
+            t.join();
+    }
+    printf( "workers=%d consumed=%d produced=%d ring len=%u\n", workers, consumed.load(), produced.load(), q.Len() );
+    check( consumed == CONSUMERS && produced == CONSUMERS, "every consumer resumed exactly once" );
+    check( consumed_sum == expect, "every entry delivered exactly once" );
+    check( q.Len() == 0, "ring drained" );
+}
+
+int main( int argc, char **argv )
+{
+    run_test( 0 );
+    run_test( WORKERS );
+    printf( "test_cbufco: %d failures\n", failures.load() );
+    exit( failures ? 1 : 0 );
+}
@@ -0,0 +1,54 @@
+/*! \file test_check.h
+ *
+ * DRE 2024
+ *
+ * PASS/FAIL lines for the test programs, C and C++.  Each check prints
+ * one line and counts a failure; main ends with exit(failures ? 1 : 0) so
+ * make check sees the result.  failures is atomic, so threads may check,
+ * or count a failure with failures++, too.
+ */
+
+#ifndef _TEST_CHECK_H
+#define _TEST_CHECK_H
+
+#include <stdio.h>      /* printf, vprintf */
+#include <stdarg.h>     /* va_list */
+#ifdef __cplusplus
+#include <atomic>       /* std::atomic */
+
+static std::atomic<int> failures;
+#else
+#include <stdatomic.h>  /* atomic_int */
+
+static atomic_int failures;
+#endif
+
+/**
+ * checkf - print PASS or FAIL and a printf formatted description
+ * @ok: the check passed
+ * @fmt: format of what was checked, with its arguments after
+ */
+static inline void checkf(int ok, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (!ok)
+        failures++;
+    printf("%s: ", ok ? "PASS" : "FAIL");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+/**
+ * check - print PASS or FAIL and what was checked
+ * @ok: the check passed
+ * @what: what was checked
+ */
+static inline void check(int ok, const char *what)
+{
+    checkf(ok, "%s", what);
+}
+
+#endif /* _TEST_CHECK_H */
@@ -0,0 +1,194 @@
+/*
+ * test_conflate - one queued payload per key, the newest.
+ *
+ * Single threaded first: a burst of updates over a few keys comes out as
+ * one payload per key, newest value, in first-arrival order; a key taken
+ * by the consumer queues afresh at the back; a full queue refuses a new
+ * key but still merges a queued one.  Then a long random run against a
+ * simple model, so the index survives many removals.  Last a producer
+ * flooding a few keys against a slower consumer: each key's values only
+ * go up and its last value always arrives.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "cq.h"
+#include "test_check.h"
+
+#define DEPTH	64
+#define KEYS	16
+#define EVENTS	200000
+#define ROUNDS	100000
+
+static cq_t *cq;
+static atomic_int done;
+static int bad;
+
+void burst(void)
+{
+    uint64_t key, v, i;
+    buf_t vp = &v;
+    int ok = 1;
+
+    cq = cq_create(DEPTH, sizeof(uint64_t));
+    /* keys 30, 10, 20 arrive in that order, then 100 updates each */
+    for (i = 0; i < 100; i++)
+    {
+        v = i;
+        ok = ok && cq_enq(cq, 30, &v) == (i ? 1 : 0);
+        ok = ok && cq_enq(cq, 10, &v) == (i ? 1 : 0);
+        ok = ok && cq_enq(cq, 20, &v) == (i ? 1 : 0);
+    }
+    ok = ok && cq->count == 3 && cq->updates == 300 && cq->conflated == 297;
+    ok = ok && cq_deq(cq, &key, &vp) == 0 && key == 30 && v == 99;
+    v = 1000;
+    ok = ok && cq_enq(cq, 30, &v) == 0;
+    ok = ok && cq_deq(cq, &key, &vp) == 0 && key == 10 && v == 99;
+    ok = ok && cq_deq(cq, &key, &vp) == 0 && key == 20 && v == 99;
+    ok = ok && cq_deq(cq, &key, &vp) == 0 && key == 30 && v == 1000;
+    ok = ok && cq_deq(cq, &key, &vp) == -1;
+    check(ok, "newest payload per key, first-arrival order, taken keys requeue");
+
+    for (key = 0; key < DEPTH; key++)
+        cq_enq(cq, key, &key);
+    v = 7;
+    ok = cq_enq(cq, DEPTH, &v) == -1 && cq->rejected == 1;
+    ok = ok && cq_enq(cq, 5, &v) == 1;
+    check(ok, "a full queue refuses a new key, merges a queued one");
+    check(cq_set_mode(cq, LOCK_FREE) == -1 && cq_set_mode(cq, LOCK_MUTEX) == 0,
+          "every lock mode but lock-free");
+    cq_destroy(cq);
+}
+
+void model(void)
+{
+    uint64_t order[DEPTH], val[DEPTH], key, v, kk[4], vv[4];
+    size_t n = 0, i, j, r;
+    buf_t vp = &v;
+    int ok = 1, want;
+
+    cq = cq_create(DEPTH, sizeof(uint64_t));
+    srand(1);
+    for (r = 0; r < ROUNDS && ok; r++)
+    {
+        /* phases of mostly enqueues, to fill it, then mostly dequeues */
+        if (rand() % 6 < ((r / 1000) & 1 ? 5 : 3))
+        {
+            /* keys collide on purpose: 3 * DEPTH of them, some 1 << 40 apart */
+            key = (uint64_t)(rand() % (3 * DEPTH)) << ((rand() & 1) ? 40 : 0);
+            v = r;
+            for (i = 0; i < n && order[i] != key; i++)
+                ;
+            if (i < n)
+            {
+                want = 1;
+                val[i] = v;
+            }
+            else if (n < DEPTH)
+            {
+                want = 0;
+                order[n] = key;
+                val[n++] = v;
+            }
+            else
+                want = -1;
+            ok = cq_enq(cq, key, &v) == want;
+        }
+        else if (rand() & 1)
+        {
+            ok = n == 0 ? cq_deq(cq, &key, &vp) == -1 :
+                 cq_deq(cq, &key, &vp) == 0 && key == order[0] && v == val[0];
+            if (n > 0)
+            {
+                memmove(order, order + 1, --n * sizeof(order[0]));
+                memmove(val, val + 1, n * sizeof(val[0]));
+            }
+        }
+        else
+        {
+            j = cq_deq_bulk(cq, kk, vv, 4);
+            ok = j == (n < 4 ? n : 4);
+            for (i = 0; i < j; i++)
+                ok = ok && kk[i] == order[i] && vv[i] == val[i];
+            n -= j;
+            memmove(order, order + j, n * sizeof(order[0]));
+            memmove(val, val + j, n * sizeof(val[0]));
+        }
+        ok = ok && cq->count == n;
+    }
+    check(ok && cq->rejected > 0, "random updates and dequeues match a simple model");
+    cq_destroy(cq);
+}
+
+void *producer(void *arg)
+{
+    uint64_t v;
+
+    for (v = 0; v < EVENTS; v++)
+    {
+        cq_enq(cq, v % KEYS, &v);
+        if (v % 1000 == 0)
+            sched_yield();
+    }
+    atomic_store(&done, 1);
+    return (NULL);
+}
+
+void *consumer(void *arg)
+{
+    uint64_t key, v, last[KEYS];
+    buf_t vp = &v;
+    int i, fin = 0;
+    struct timespec pause = { 0, 10000 };
+
+    for (i = 0; i < KEYS; i++)
+        last[i] = 0;
+    while (!fin)
+    {
+        fin = atomic_load(&done);
+        while (cq_deq(cq, &key, &vp) == 0)
+        {
+            if (key >= KEYS || v % KEYS != key || (last[key] && v <= last[key]))
+                bad = 1;
+            last[key] = v;
+            nanosleep(&pause, NULL);
+        }
+    }
+    /* every key's final update got through */
+    for (i = 0; i < KEYS; i++)
+        if (last[i] != EVENTS - KEYS + (uint64_t)i)
+            bad = 1;
+    return (NULL);
+}
+
+void flood(void)
+{
+    pthread_t p, c;
+
+    cq = cq_create(DEPTH, sizeof(uint64_t));
+    bad = 0;
+    atomic_store(&done, 0);
+    pthread_create(&c, NULL, consumer, NULL);
+    pthread_create(&p, NULL, producer, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    printf("%zu updates, %zu conflated, the consumer handled %zu\n",
+           cq->updates, cq->conflated, cq->updates - cq->conflated);
+    check(!bad && cq->conflated > 0, "a slow consumer sees each key's values rise and the last one");
+    cq_destroy(cq);
+}
+
+int main(int argc, char **argv)
+{
+    burst();
+    model();
+    flood();
+    exit(failures ? 1 : 0);
+}
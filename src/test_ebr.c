@@ -0,0 +1,190 @@
+/*
+ * test_ebr - epoch-based reclamation.
+ *
+ * Single threaded first, two records standing in for two threads: nothing
+ * retired is freed while a reader that entered earlier is still inside,
+ * all of it is once the reader leaves, critical sections nest, the thread
+ * table fills and records are reused.  Then a writer replacing a shared
+ * object under readers that check it: a retired object is poisoned rather
+ * than freed, so a reader that still finds it proves it was reclaimed too
+ * early.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "ebr.h"
+#include "test_check.h"
+
+#define EVENTS	20000
+#define READERS	2
+#define LIVE	0x11fe11fe11fe11feULL
+#define DEAD	0xdeaddeaddeaddeadULL
+
+typedef struct obj
+{
+    uint64_t magic;
+    uint64_t a;
+    uint64_t b;
+    struct obj *next;
+} obj_t;
+
+static ebr_t *ebr;
+static _Atomic(obj_t *) current;
+static atomic_int done;
+static int bad;
+static obj_t *grave;
+static size_t nfreed;
+
+/* count frees, ctx is the counter */
+static void count_free(void *ctx, void *obj)
+{
+    (*(size_t *)ctx)++;
+    free(obj);
+}
+
+/* poison and keep, so a late reader sees DEAD instead of reused memory */
+static void bury(void *ctx, void *obj)
+{
+    obj_t *o = obj;
+
+    o->magic = DEAD;
+    o->next = grave;
+    grave = o;
+    nfreed++;
+}
+
+void single(void)
+{
+    ebr_thread_t *a, *b, *t[EBR_MAX_THREADS];
+    size_t freed = 0, i;
+    int ok;
+
+    ebr = ebr_create();
+    a = ebr_register(ebr);
+    b = ebr_register(ebr);
+    ebr_enter(a);
+    for (i = 0; i < 4 * EBR_BATCH; i++)
+        ebr_retire(b, malloc(16), count_free, &freed);
+    ok = freed == 0 && b->retired == 4 * EBR_BATCH;
+    check(ok, "nothing is freed while an earlier reader is inside");
+
+    ebr_exit(a);
+    ebr_barrier(b);
+    ok = freed == 4 * EBR_BATCH && b->freed == freed;
+    check(ok, "everything is freed once the reader leaves");
+
+    ebr_enter(a);
+    ebr_enter(a);
+    ebr_exit(a);
+    ok = atomic_load(&a->epoch) & EBR_ACTIVE;
+    ebr_exit(a);
+    ok = ok && atomic_load(&a->epoch) == 0;
+    check(ok, "critical sections nest");
+
+    ebr_unregister(a);
+    ok = ebr_register(ebr) == a;
+    for (i = 2; i < EBR_MAX_THREADS; i++)
+        ok = ok && (t[i] = ebr_register(ebr)) != NULL;
+    ok = ok && ebr_register(ebr) == NULL && errno == EBUSY;
+    ebr_unregister(t[10]);
+    ok = ok && ebr_register(ebr) == t[10];
+    check(ok, "a full thread table refuses, unregistered records are reused");
+
+    /* whatever is still retired goes with the domain */
+    freed = 0;
+    for (i = 0; i < 10; i++)
+        ebr_retire(b, malloc(16), count_free, &freed);
+    ebr_destroy(ebr);
+    check(freed == 10, "destroy frees what is still retired");
+}
+
+void *writer(void *arg)
+{
+    ebr_thread_t *t = ebr_register(ebr);
+    obj_t *o, *old;
+    uint64_t v;
+
+    for (v = 1; v <= EVENTS; v++)
+    {
+        o = malloc(sizeof(obj_t));
+        o->magic = LIVE;
+        o->a = v;
+        o->b = ~v;
+        old = atomic_exchange(&current, o);
+        ebr_retire(t, old, bury, NULL);
+    }
+    atomic_store(&done, 1);
+    ebr_barrier(t);
+    if (t->freed != EVENTS)
+        bad = 1;
+    ebr_unregister(t);
+    return (NULL);
+}
+
+void *reader(void *arg)
+{
+    ebr_thread_t *t = ebr_register(ebr);
+    size_t *reads = arg;
+    obj_t *o;
+    int i;
+
+    while (!atomic_load(&done))
+    {
+        ebr_enter(t);
+        o = atomic_load(&current);
+        /* hold on to it a while, the writer keeps replacing it */
+        for (i = 0; i < 100; i++)
+            if (o->magic != LIVE || o->a != ~o->b)
+                bad = 1;
+        ebr_exit(t);
+        (*reads)++;
+    }
+    ebr_unregister(t);
+    return (NULL);
+}
+
+void threads(void)
+{
+    pthread_t w, r[READERS];
+    size_t reads[READERS] = { 0 }, total = 0;
+    obj_t *o;
+    int i;
+
+    ebr = ebr_create();
+    o = malloc(sizeof(obj_t));
+    o->magic = LIVE;
+    o->a = 0;
+    o->b = ~(uint64_t)0;
+    atomic_store(&current, o);
+    for (i = 0; i < READERS; i++)
+        pthread_create(&r[i], NULL, reader, &reads[i]);
+    pthread_create(&w, NULL, writer, NULL);
+    pthread_join(w, NULL);
+    for (i = 0; i < READERS; i++)
+    {
+        pthread_join(r[i], NULL);
+        total += reads[i];
+    }
+    printf("%d objects replaced under %zu reads, epoch %llu\n", EVENTS, total,
+           (unsigned long long)atomic_load(&ebr->epoch));
+    check(!bad && nfreed == EVENTS, "no reader ever saw a reclaimed object, none leaked");
+    free(atomic_load(&current));
+    while ((o = grave) != NULL)
+    {
+        grave = o->next;
+        free(o);
+    }
+    ebr_destroy(ebr);
+}
+
+int main(int argc, char **argv)
+{
+    single();
+    threads();
+    exit(failures ? 1 : 0);
+}
@@ -0,0 +1,88 @@
+/*
+ * test_expire - payloads past their deadline are dropped at dequeue time.
+ *
+ * For the spinlock and the lock-free mode: queue a stale backlog, let it
+ * expire and check q_deq skips straight to the fresh payload behind it and
+ * counts every drop; then the same through q_deq_bulk, and a q_enq_by
+ * payload that never expires holding the stale ones behind it.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "vringbuffer.h"
+#include "test_check.h"
+
+#define DEPTH	64
+#define STALE	40
+#define TTL	(1000 * 1000)	/* 1 ms */
+
+
+static void expire_wait(void)
+{
+    struct timespec pause = { 0, 2 * TTL };
+
+    nanosleep(&pause, NULL);
+}
+
+void run(lockmode_t mode, const char *name)
+{
+    sq_t *sqp = sq_create(DEPTH, sizeof(uint64_t));
+    uint64_t v, out[DEPTH];
+    buf_t vp = &v;
+    size_t k;
+    int ok;
+
+    if (sqp == NULL || sq_set_ttl(sqp, TTL) != 0)
+    {
+        fprintf(stderr, "sq_create failed\n");
+        exit(1);
+    }
+    sqp->mode = mode;
+
+    /* a stale backlog, then one fresh payload */
+    for (v = 0; v < STALE; v++)
+        q_enq(sqp, &v);
+    expire_wait();
+    v = 1000;
+    q_enq(sqp, &v);
+    v = 0;
+    ok = q_deq(sqp, &vp) == 0 && v == 1000 && sqp->expired == STALE;
+    ok = ok && q_deq(sqp, &vp) != 0;
+    checkf(ok, "%-9s %s", name, "q_deq skips the expired backlog and counts it");
+
+    /* the same through q_deq_bulk, nothing left once it all expires */
+    q_reset(sqp);
+    for (v = 0; v < STALE; v++)
+        q_enq(sqp, &v);
+    expire_wait();
+    for (v = 0; v < 3; v++)
+        q_enq(sqp, &v);
+    k = q_deq_bulk(sqp, out, DEPTH);
+    ok = k == 3 && out[0] == 0 && out[2] == 2 && sqp->expired == STALE;
+    q_enq_bulk(sqp, out, 3);
+    expire_wait();
+    ok = ok && q_deq_bulk(sqp, out, DEPTH) == 0 && sqp->expired == STALE + 3;
+    checkf(ok, "%-9s %s", name, "q_deq_bulk drops expired payloads, q_enq_bulk stamps them");
+
+    /* a payload that never expires keeps its place at the head */
+    q_reset(sqp);
+    v = 7;
+    q_enq_by(sqp, &v, SQ_NEVER);
+    q_enq(sqp, &v);
+    expire_wait();
+    ok = q_deq(sqp, &vp) == 0 && v == 7 && sqp->expired == 0;
+    ok = ok && q_deq(sqp, &vp) != 0 && sqp->expired == 1;
+    checkf(ok, "%-9s %s", name, "q_enq_by SQ_NEVER outlives the TTL");
+
+    sq_destroy(sqp);
+}
+
+int main(int argc, char **argv)
+{
+    run(LOCK_SPIN, "spinlock");
+    run(LOCK_FREE, "lock-free");
+    exit(failures ? 1 : 0);
+}
@@ -0,0 +1,219 @@
+/*
+ * test_lanes - strict priority and weighted round robin over lq_t lanes.
+ *
+ * Single threaded, in the default lock mode: strict priority always drains
+ * lane 0 first, LQ_WRR serves full lanes in proportion to their weights and
+ * an empty lane gives its turn away; a full SQ_FAIL lane refuses payloads
+ * while an SQ_OVERWRITE lane keeps the newest.  Then, lock-free, one producer floods
+ * the data lane while another sends timestamped control payloads and a
+ * consumer checks every lane arrives complete and in order; the worst
+ * control latency is printed next to the data lane depth it jumped.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "lanes.h"
+#include "test_check.h"
+
+#define DEPTH	16
+#define BIG	1024
+#define DATA	500000
+#define CTRL	2000
+
+/* the payload: sequence number within its lane and a send time */
+typedef struct msg
+{
+    uint64_t seq;
+    uint64_t ns;
+} msg_t;
+
+static lq_t *lq;
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec);
+}
+
+static void put(unsigned lane, uint64_t seq)
+{
+    msg_t m = { seq, now_ns() };
+
+    lq_enq(lq, lane, &m);
+}
+
+void strict_order(void)
+{
+    msg_t m;
+    buf_t vp = &m;
+    unsigned lane, expect_lane = 0;
+    uint64_t expect_seq = 0;
+    int i, ok = 1;
+
+    lq = lq_create(3, DEPTH, sizeof(msg_t), LQ_STRICT, NULL, NULL);
+    for (i = 0; i < 4; i++)
+    {
+        put(2, i);
+        put(1, i);
+        put(0, i);
+    }
+    for (i = 0; i < 12; i++)
+    {
+        if (lq_deq(lq, &vp, &lane) != 0 || lane != expect_lane || m.seq != expect_seq)
+            ok = 0;
+        if (++expect_seq == 4)
+        {
+            expect_seq = 0;
+            expect_lane++;
+        }
+    }
+    ok = ok && lq_deq(lq, &vp, &lane) != 0 && atomic_load(&lq->ready) == 0;
+    check(ok, "strict: lane 0, then 1, then 2, each in order, then empty");
+    lq_destroy(lq);
+}
+
+void wrr_share(void)
+{
+    static const unsigned weights[] = { 4, 2, 1 };
+    msg_t m;
+    buf_t vp = &m;
+    unsigned lane, got[3] = { 0, 0, 0 };
+    int i, ok;
+
+    lq = lq_create(3, DEPTH, sizeof(msg_t), LQ_WRR, weights, NULL);
+    for (i = 0; i < DEPTH; i++)
+    {
+        put(0, i);
+        put(1, i);
+        put(2, i);
+    }
+    /* two whole passes of the schedule while every lane has work */
+    for (i = 0; i < 14; i++)
+    {
+        if (lq_deq(lq, &vp, &lane) == 0)
+            got[lane]++;
+    }
+    ok = got[0] == 8 && got[1] == 4 && got[2] == 2;
+    printf("wrr 4:2:1 served %u:%u:%u\n", got[0], got[1], got[2]);
+    check(ok, "wrr: full lanes served in proportion to their weights");
+
+    /* lane 0 drained: its turns go to the next non-empty lane */
+    lq_reset(lq);
+    for (i = 0; i < 6; i++)
+        put(2, i);
+    ok = 1;
+    for (i = 0; i < 6; i++)
+    {
+        if (lq_deq(lq, &vp, &lane) != 0 || lane != 2 || m.seq != (uint64_t)i)
+            ok = 0;
+    }
+    check(ok, "wrr: empty lanes pass their turn on");
+    lq_destroy(lq);
+
+    check(lq_create(3, DEPTH, sizeof(msg_t), LQ_WRR, NULL, NULL) == NULL, "wrr: weights required");
+}
+
+void full_lanes(void)
+{
+    static const fullpolicy_t full[] = { SQ_OVERWRITE, SQ_FAIL };
+    msg_t m = { 0, 0 };
+    buf_t vp = &m;
+    unsigned lane;
+    uint64_t kept = 0, next = 0, last;
+    int ok = 1;
+
+    lq = lq_create(2, DEPTH, sizeof(msg_t), LQ_STRICT, NULL, full);
+    for (m.seq = 0; m.seq < 2 * DEPTH; m.seq++)
+    {
+        ok = ok && lq_enq(lq, 0, &m) == 0;
+        if (lq_enq(lq, 1, &m) == 0)
+            kept++;
+    }
+    ok = ok && kept > 0 && kept < 2 * DEPTH;
+    /* lane 0 kept its newest payloads, lane 1 the first it accepted */
+    last = 0;
+    while (lq_deq(lq, &vp, &lane) == 0)
+    {
+        if (lane == 0)
+            last = m.seq;
+        else
+            ok = ok && m.seq == next++;
+    }
+    ok = ok && last == 2 * DEPTH - 1 && next == kept;
+    check(ok, "a full SQ_FAIL lane refuses, an SQ_OVERWRITE lane keeps the newest");
+    lq_destroy(lq);
+}
+
+void *data_producer(void *arg)
+{
+    uint64_t i;
+
+    for (i = 0; i < DATA; i++)
+        put(1, i);
+    return (NULL);
+}
+
+void *ctrl_producer(void *arg)
+{
+    uint64_t i;
+    struct timespec pause = { 0, 20000 };
+
+    for (i = 0; i < CTRL; i++)
+    {
+        put(0, i);
+        nanosleep(&pause, NULL);
+    }
+    return (NULL);
+}
+
+void saturated(void)
+{
+    pthread_t tid[2];
+    msg_t m;
+    buf_t vp = &m;
+    unsigned lane;
+    uint64_t next[2] = { 0, 0 }, lat, worst = 0, sum = 0;
+    int ok = 1;
+
+    lq = lq_create(2, BIG, sizeof(msg_t), LQ_STRICT, NULL, NULL);
+    lq_set_mode(lq, LOCK_FREE);
+    pthread_create(&tid[0], NULL, data_producer, NULL);
+    pthread_create(&tid[1], NULL, ctrl_producer, NULL);
+    while (next[0] < CTRL || next[1] < DATA)
+    {
+        if (lq_deq(lq, &vp, &lane) != 0)
+            continue;
+        if (m.seq != next[lane])
+            ok = 0;
+        next[lane] = m.seq + 1;
+        if (lane == 0)
+        {
+            lat = now_ns() - m.ns;
+            sum += lat;
+            if (lat > worst)
+                worst = lat;
+        }
+    }
+    pthread_join(tid[0], NULL);
+    pthread_join(tid[1], NULL);
+    printf("control latency with a %d slot data lane flooded: mean=%lluns worst=%lluns\n",
+           BIG, (unsigned long long)(sum / CTRL), (unsigned long long)worst);
+    check(ok && lq_deq(lq, &vp, &lane) != 0, "saturated: every payload of both lanes, in order");
+    lq_destroy(lq);
+}
+
+int main(int argc, char **argv)
+{
+    strict_order();
+    wrr_share();
+    full_lanes();
+    saturated();
+    exit(failures ? 1 : 0);
+}
@@ -0,0 +1,167 @@
+/*
+ * test_logevt - per-thread event rings merged back into one time line.
+ *
+ * Threads log events tagged with their number and a counter, then the
+ * dump must hand back every event once, in timestamp order overall and in
+ * each thread's own order.  A thread that logs more than LOG_QDEPTH keeps
+ * its newest LOG_QDEPTH - 1, contiguous.  A dump running while threads
+ * still log may skip overwritten events, and can't promise time order
+ * across threads, but must never return a torn event or one out of its
+ * thread's order.  Then the cost of an event with every thread logging
+ * at once, and those events dumped in binary and read back: 16-byte
+ * records in the same order, one dump after another in the file.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "logevt.h"
+#include "test_check.h"
+
+#define THREADS	4
+#define EVENTS	5000
+#define FLOOD	(4 * LOG_QDEPTH)
+
+static atomic_int writing;
+static size_t per_thread = EVENTS;
+
+static uint64_t ns(const struct timespec *t)
+{
+    return ((uint64_t)t->tv_sec * 1000000000ULL + t->tv_nsec);
+}
+
+/* thread t logs per_thread events, val t << 24 | i, id from val's parity */
+void *logger(void *arg)
+{
+    uint32_t t = (uint32_t)(uintptr_t)arg, i;
+
+    for (i = 0; i < per_thread; i++)
+        evt_enq((i & 1) ? EVT_DEQ : EVT_ENQ, t << 24 | i);
+    atomic_fetch_sub(&writing, 1);
+    return (NULL);
+}
+
+/* start n loggers numbered from first, return when they are running */
+static void start(pthread_t *p, uint32_t first, int n)
+{
+    int i;
+
+    atomic_store(&writing, n);
+    for (i = 0; i < n; i++)
+        pthread_create(&p[i], NULL, logger, (void *)(uintptr_t)(first + i));
+}
+
+/*
+ * dump everything there is, checking order; next[t] is thread t's next
+ * counter, or the lowest acceptable when gaps is set, as it is while the
+ * threads are still logging.  Returns the count.
+ */
+static size_t drain(uint32_t *next, int gaps, int *bad)
+{
+    logrec_t rec;
+    uint64_t last = 0;
+    uint32_t t, i;
+    size_t n = 0;
+
+    while (evt_deq(&rec) == 0)
+    {
+        t = rec.val >> 24;
+        i = rec.val & 0xffffff;
+        if (t >= 2 * THREADS + 1 || rec.id != ((i & 1) ? EVT_DEQ : EVT_ENQ) ||
+            (!gaps && ns(&rec.tstamp) < last) || (gaps ? i < next[t] : i != next[t]))
+            *bad = 1;
+        last = ns(&rec.tstamp);
+        next[t] = i + 1;
+        n++;
+    }
+    return (n);
+}
+
+/* dump what the last loggers left in binary, twice, and read it back */
+static int binary(void)
+{
+    char path[] = "/tmp/test_logevtXXXXXX";
+    uint16_t thread[THREADS];
+    uint32_t next[THREADS], t, i;
+    size_t want = THREADS * (LOG_QDEPTH - 1), k;
+    evtbin_hdr_t hdr;
+    evtbin_t e;
+    uint64_t last = 0;
+    FILE *f;
+    int ok;
+
+    close(mkstemp(path));
+    for (t = 0; t < THREADS; t++)
+        next[t] = per_thread - (LOG_QDEPTH - 1);
+    ok = fdump_evts(path) == (long)want && fdump_evts(path) == 0;
+    f = fopen(path, "r");
+    ok = ok && f != NULL && fread(&hdr, sizeof(hdr), 1, f) == 1;
+    ok = ok && memcmp(hdr.magic, EVTBIN_MAGIC, 4) == 0 && hdr.recsize == 16 && hdr.count == want;
+    for (k = 0; ok && k < want; k++)
+    {
+        ok = fread(&e, sizeof(e), 1, f) == 1;
+        t = e.val >> 24;
+        i = e.val & 0xffffff;
+        ok = ok && t < THREADS && i == next[t] && e.ns >= last && e.id == ((i & 1) ? EVT_DEQ : EVT_ENQ);
+        /* the thread number names the ring, the same for all a thread logged */
+        if (ok && i == per_thread - (LOG_QDEPTH - 1))
+            thread[t] = e.thread;
+        ok = ok && e.thread == thread[t];
+        next[t] = i + 1;
+        last = e.ns;
+    }
+    ok = ok && fread(&hdr, sizeof(hdr), 1, f) == 1 && hdr.count == 0 && fread(&e, 1, 1, f) == 0;
+    if (f != NULL)
+        fclose(f);
+    unlink(path);
+    return (ok);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t p[THREADS];
+    struct timespec t0, t1;
+    uint32_t next[2 * THREADS + 1] = { 0 };
+    size_t n;
+    int i, bad = 0;
+
+    start(p, 0, THREADS);
+    for (i = 0; i < THREADS; i++)
+        pthread_join(p[i], NULL);
+    n = drain(next, 0, &bad);
+    check(!bad && n == THREADS * EVENTS, "every event once, in time and thread order");
+
+    per_thread = FLOOD;
+    start(p, THREADS, 1);
+    pthread_join(p[0], NULL);
+    next[THREADS] = FLOOD - LOG_QDEPTH + 1;
+    n = drain(next, 0, &bad);
+    check(!bad && n == LOG_QDEPTH - 1, "a full ring keeps its newest events");
+
+    /* dump while the writers lap their rings */
+    start(p, THREADS + 1, THREADS);
+    n = 0;
+    while (atomic_load(&writing) > 0)
+        n += drain(next, 1, &bad);
+    for (i = 0; i < THREADS; i++)
+        pthread_join(p[i], NULL);
+    n += drain(next, 1, &bad);
+    printf("dumped %zu of %d events while they were logged\n", n, THREADS * FLOOD);
+    check(!bad && n >= LOG_QDEPTH, "a dump during logging: nothing torn or out of order");
+
+    per_thread = EVENTS * 20;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    start(p, 0, THREADS);
+    for (i = 0; i < THREADS; i++)
+        pthread_join(p[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("%d threads logging at once: %.1f ns per event\n", THREADS,
+           (double)(ns(&t1) - ns(&t0)) / (THREADS * per_thread));
+    check(binary(), "a binary dump reads back in order, one segment per dump");
+    exit(failures ? 1 : 0);
+}
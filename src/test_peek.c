@@ -0,0 +1,166 @@
+/*
+ * test_peek - consuming payloads in place with q_deq_peek and q_deq_release.
+ *
+ * Single threaded first, in the spinlock and the lock-free mode: peek
+ * hands out the oldest payload in its slot, a second peek fails with EBUSY
+ * and the other dequeues find nothing until the release, an empty queue
+ * gives EAGAIN, a full SQ_FAIL ring stays full while its head is held and
+ * expired payloads are dropped before the peek.  Then a producer against a
+ * peeking consumer that dawdles over each payload: whatever the policy, a
+ * held payload must never change under the consumer.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "vringbuffer.h"
+#include "test_check.h"
+
+#define DEPTH	8
+#define EVENTS	50000
+
+static const char *policy_name[] = { "overwrite", "block", "fail", "drop" };
+static sq_t *sq;
+static atomic_int finished;
+static int bad;
+static size_t seen;
+
+void single(lockmode_t mode, const char *name)
+{
+    struct timespec pause = { 0, 3000000 };
+    uint64_t v, seq, buf[DEPTH];
+    buf_t vp = &v;
+    const uint64_t *p, *q;
+    int ok;
+
+    sq = sq_create_policy(DEPTH, sizeof(uint64_t), SQ_FAIL);
+    sq->mode = mode;
+    for (v = 10; v < 13; v++)
+        q_enq(sq, &v);
+    p = q_deq_peek(sq, &seq);
+    ok = p != NULL && *p == 10 && seq == 0;
+    q = q_deq_peek(sq, NULL);
+    ok = ok && q == NULL && errno == EBUSY;
+    ok = ok && q_deq(sq, &vp) == -1 && q_deq_bulk(sq, buf, DEPTH) == 0 && *p == 10;
+    checkf(ok, "%-9s %s", name, "a held payload stays put and blocks other dequeues");
+
+    q_deq_release(sq);
+    ok = q_deq(sq, &vp) == 0 && v == 11;
+    p = q_deq_peek(sq, &seq);
+    ok = ok && p != NULL && *p == 12 && seq == 2;
+    q_deq_release(sq);
+    ok = ok && q_deq_peek(sq, NULL) == NULL && errno == EAGAIN;
+    checkf(ok, "%-9s %s", name, "release dequeues, an empty queue gives EAGAIN");
+
+    q_reset(sq);
+    for (v = 0; v < sq->store.max; v++)
+        q_enq(sq, &v);
+    p = q_deq_peek(sq, NULL);
+    ok = p != NULL && *p == 0 && q_enq(sq, &v) == -1 && sq->rejected == 1;
+    if (mode != LOCK_FREE)
+        ok = ok && sq_resize(sq, 2 * DEPTH) == -1 && errno == EBUSY;
+    q_deq_release(sq);
+    ok = ok && q_enq(sq, &v) == 0 && q_deq_bulk(sq, buf, DEPTH) == DEPTH && buf[0] == 1;
+    checkf(ok, "%-9s %s", name, "a full ring stays full while its head is held");
+
+    q_reset(sq);
+    sq_set_ttl(sq, 1000000);
+    v = 1;
+    q_enq(sq, &v);
+    nanosleep(&pause, NULL);
+    v = 2;
+    q_enq(sq, &v);
+    p = q_deq_peek(sq, NULL);
+    ok = p != NULL && *p == 2 && sq->expired == 1;
+    q_deq_release(sq);
+    checkf(ok, "%-9s %s", name, "expired payloads are dropped before the peek");
+    sq_destroy(sq);
+}
+
+/* each payload is a counter and its complement, torn if they disagree */
+void *producer(void *arg)
+{
+    uint64_t v[2];
+
+    for (v[0] = 0; v[0] < EVENTS; v[0]++)
+    {
+        v[1] = ~v[0];
+        q_enq(sq, v);
+    }
+    atomic_store(&finished, 1);
+    return (NULL);
+}
+
+void *consumer(void *arg)
+{
+    const uint64_t *p;
+    uint64_t first, seq, last = 0;
+
+    for (;;)
+    {
+        p = q_deq_peek(sq, &seq);
+        if (p == NULL)
+        {
+            /* finished is read first, so nothing can be queued after the last look */
+            if (atomic_load(&finished) && (p = q_deq_peek(sq, &seq)) == NULL)
+                break;
+            if (p == NULL)
+            {
+                sched_yield();
+                continue;
+            }
+        }
+        first = p[0];
+        /* give the producer a chance to lap the ring under us */
+        if (first % 64 == 0)
+            sched_yield();
+        if (p[0] != first || p[1] != ~first || first != seq || (seen > 0 && first <= last))
+            bad = 1;
+        last = first;
+        seen++;
+        q_deq_release(sq);
+    }
+    return (NULL);
+}
+
+void run(lockmode_t mode, const char *name, fullpolicy_t policy)
+{
+    pthread_t p, c;
+    char what[80];
+    int ok;
+
+    sq = sq_create_policy(DEPTH, 2 * sizeof(uint64_t), policy);
+    sq->mode = mode;
+    atomic_store(&finished, 0);
+    bad = 0;
+    seen = 0;
+    pthread_create(&c, NULL, consumer, NULL);
+    pthread_create(&p, NULL, producer, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    ok = !bad && seen + sq->overwritten == EVENTS && sq->lost == sq->overwritten;
+    if (policy == SQ_BLOCK)
+        ok = ok && seen == EVENTS;
+    printf("%s %s: %zu peeked, %zu overwritten\n", name, policy_name[policy], seen, sq->overwritten);
+    snprintf(what, sizeof(what), "%s: a held payload never changes under its consumer",
+             policy_name[policy]);
+    checkf(ok, "%-9s %s", name, what);
+    sq_destroy(sq);
+}
+
+int main(int argc, char **argv)
+{
+    single(LOCK_SPIN, "spinlock");
+    single(LOCK_FREE, "lock-free");
+    run(LOCK_SPIN, "spinlock", SQ_BLOCK);
+    run(LOCK_SPIN, "spinlock", SQ_OVERWRITE);
+    run(LOCK_FREE, "lock-free", SQ_BLOCK);
+    run(LOCK_FREE, "lock-free", SQ_OVERWRITE);
+    exit(failures ? 1 : 0);
+}
@@ -0,0 +1,190 @@
+/*
+ * test_policy - what an enqueue does on a full ring, and who notices.
+ *
+ * For the spinlock and the lock-free mode and each fullpolicy_t that
+ * doesn't wait: overfill a small ring one payload at a time and then in
+ * bulk, check what q_enq and q_enq_bulk return, the overwritten, dropped
+ * and rejected counters, and that the sequence numbers q_deq_seq hands out
+ * skip exactly the payloads lost.  The policies that wait, SQ_BLOCK and
+ * lock-free SQ_OVERWRITE, get a producer thread against a consumer thread
+ * instead: every sequence number must arrive, in order.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include "vringbuffer.h"
+#include "test_check.h"
+
+#define DEPTH	8
+#define OVER	5	/* payloads offered past a full ring */
+#define EVENTS	20000
+
+static const char *policy_name[] = { "overwrite", "block", "fail", "drop" };
+
+/* a full ring holds the producer until a consumer makes room */
+static int waits(lockmode_t mode, fullpolicy_t policy)
+{
+    return (policy == SQ_BLOCK || (policy == SQ_OVERWRITE && mode == LOCK_FREE));
+}
+
+/**
+ * drain - dequeue everything, checking payload and sequence number agree
+ *
+ * The producers below send their own sequence numbers as the payload, so
+ * the two must be equal.  Returns the number dequeued, -1 on a mismatch.
+ */
+static long drain(sq_t *sqp, uint64_t *first, uint64_t *last)
+{
+    uint64_t v, seq;
+    buf_t vp = &v;
+    long n = 0;
+
+    while (q_deq_seq(sqp, &vp, &seq) == 0)
+    {
+        if (v != seq)
+            return (-1);
+        if (n++ == 0)
+            *first = seq;
+        *last = seq;
+    }
+    return (n);
+}
+
+void run(lockmode_t mode, const char *name, fullpolicy_t policy)
+{
+    sq_t *sqp = sq_create_policy(DEPTH, sizeof(uint64_t), policy);
+    uint64_t v, first = 0, last = 0, src[DEPTH + OVER];
+    buf_t vp = &v;
+    size_t k, max;
+    long n;
+    int ok = 1, rc;
+
+    if (sqp == NULL)
+    {
+        fprintf(stderr, "sq_create_policy failed\n");
+        exit(1);
+    }
+    sqp->mode = mode;
+    max = sqp->store.max;
+
+    /* one at a time: the ring fills, then the policy decides */
+    for (v = 0; v < max + OVER; v++)
+    {
+        rc = q_enq(sqp, &v);
+        if (v < max || policy == SQ_OVERWRITE)
+            ok = ok && rc == 0;
+        else
+            ok = ok && rc == -1;
+    }
+    n = drain(sqp, &first, &last);
+    if (policy == SQ_OVERWRITE)
+    {
+        ok = ok && n == (long)max && first == OVER && last == max + OVER - 1;
+        ok = ok && sqp->overwritten == OVER && sqp->lost == OVER;
+    }
+    else
+    {
+        ok = ok && n == (long)max && first == 0 && last == max - 1;
+        ok = ok && sqp->dropped == (policy == SQ_DROP_NEWEST ? OVER : 0);
+        ok = ok && sqp->rejected == (policy == SQ_FAIL ? OVER : 0);
+        ok = ok && sqp->lost == 0;
+    }
+    checkf(ok, "%-9s %-9s %s", name, policy_name[policy], "q_enq on a full ring");
+
+    /* the next payload shows what happened to the sequence numbers */
+    v = 0;
+    q_enq(sqp, &v);
+    ok = q_deq_seq(sqp, &vp, &first) == 0;
+    if (policy == SQ_DROP_NEWEST)
+        ok = ok && first == max + OVER && sqp->lost == OVER;
+    else if (policy == SQ_FAIL)
+        ok = ok && first == max && sqp->lost == 0;
+    checkf(ok, "%-9s %-9s %s", name, policy_name[policy], "a gap only where payloads were dropped");
+
+    /* in bulk, from an empty ring */
+    q_reset(sqp);
+    for (k = 0; k < max + OVER; k++)
+        src[k] = k;
+    k = q_enq_bulk(sqp, src, max + OVER);
+    n = drain(sqp, &first, &last);
+    if (policy == SQ_OVERWRITE)
+        ok = k == max + OVER && n == (long)max && first == OVER && sqp->overwritten == OVER;
+    else
+        ok = k == max && n == (long)max && first == 0 && last == max - 1 &&
+             sqp->dropped + sqp->rejected == OVER;
+    checkf(ok, "%-9s %-9s %s", name, policy_name[policy], "q_enq_bulk on a full ring");
+
+    sq_destroy(sqp);
+}
+
+static sq_t *block_q;
+static int block_bad;
+
+void *block_producer(void *arg)
+{
+    uint64_t v;
+
+    for (v = 0; v < EVENTS; v++)
+        q_enq_bulk(block_q, &v, 1);
+    return (NULL);
+}
+
+void *block_consumer(void *arg)
+{
+    uint64_t v, seq, next = 0;
+    buf_t vp = &v;
+
+    while (next < EVENTS)
+    {
+        if (q_deq_bulk(block_q, &v, 1) == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        if (v != next)
+            block_bad = 1;
+        next++;
+    }
+    /* nothing left over, and q_deq_seq on an empty ring fails */
+    if (q_deq_seq(block_q, &vp, &seq) == 0)
+        block_bad = 1;
+    return (NULL);
+}
+
+void block_threads(lockmode_t mode, const char *name, fullpolicy_t policy)
+{
+    pthread_t p, c;
+
+    block_q = sq_create_policy(DEPTH, sizeof(uint64_t), policy);
+    block_q->mode = mode;
+    block_bad = 0;
+    pthread_create(&c, NULL, block_consumer, NULL);
+    pthread_create(&p, NULL, block_producer, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    checkf(!block_bad && block_q->lost == 0 && block_q->deq_seq == EVENTS,
+           "%-9s %-9s %s", name, policy_name[policy], "a producer on a full ring waits, nothing lost");
+    sq_destroy(block_q);
+}
+
+int main(int argc, char **argv)
+{
+    fullpolicy_t policy;
+
+    for (policy = SQ_OVERWRITE; policy < SQ_POLICIES; policy++)
+    {
+        if (waits(LOCK_SPIN, policy))
+            block_threads(LOCK_SPIN, "spinlock", policy);
+        else
+            run(LOCK_SPIN, "spinlock", policy);
+        if (waits(LOCK_FREE, policy))
+            block_threads(LOCK_FREE, "lock-free", policy);
+        else
+            run(LOCK_FREE, "lock-free", policy);
+    }
+    exit(failures ? 1 : 0);
+}
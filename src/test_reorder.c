@@ -0,0 +1,149 @@
+/*
+ * test_reorder - re-sequencing payloads that arrive out of order.
+ *
+ * Single threaded first: payloads come out in sequence order whatever
+ * order they went in, one too far ahead is refused with EAGAIN and one
+ * already released is dropped as late, a hole is skipped once a later
+ * payload has waited max_wait_ns and not before.  Then producers taking
+ * sequence numbers from a shared counter, so arrival order depends on the
+ * scheduler: every payload must come out once, in order, and with some
+ * numbers never sent the consumer must skip those, plus any payload that
+ * then turns up late.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "rq.h"
+#include "test_check.h"
+
+#define DEPTH	64
+#define EVENTS	100000
+#define PRODUCERS	4
+#define HOLE_EVERY	1000
+#define WAIT_NS	2000000ULL
+
+static rq_t *rq;
+static atomic_ulong counter;
+static atomic_size_t early;
+static int holes;
+static int bad;
+
+void single(void)
+{
+    struct timespec pause = { 0, 3000000 };
+    uint64_t v, seq, in[] = { 2, 0, 1, 5, 3, 4 };
+    buf_t vp = &v;
+    size_t i;
+    int ok = 1;
+
+    rq = rq_create(8, sizeof(uint64_t), WAIT_NS);
+    for (i = 0; i < 6; i++)
+    {
+        v = 100 + in[i];
+        ok = ok && rq_enq(rq, in[i], &v) == 0;
+    }
+    for (i = 0; i < 6; i++)
+        ok = ok && rq_deq(rq, &seq, &vp) == 0 && seq == i && v == 100 + i;
+    ok = ok && rq_deq(rq, &seq, &vp) == -1;
+    check(ok, "payloads come out in sequence order");
+
+    ok = rq_enq(rq, 6 + 8, &v) == -1 && errno == EAGAIN && rq_enq(rq, 13, &v) == 0;
+    ok = ok && rq_enq(rq, 3, &v) == 1 && rq->late == 1 && rq->ahead == 1;
+    check(ok, "too far ahead is refused, already released is late");
+
+    /* 6..12 missing, 13 waiting: nothing yet, all of them after WAIT_NS */
+    ok = rq_deq(rq, &seq, &vp) == -1;
+    nanosleep(&pause, NULL);
+    ok = ok && rq_deq(rq, &seq, &vp) == 0 && seq == 13 && rq->skipped == 7;
+    ok = ok && rq_enq(rq, 9, &v) == 1;
+    check(ok, "a hole is skipped after max_wait_ns, its payload is then late");
+
+    nanosleep(&pause, NULL);
+    ok = rq_deq(rq, &seq, &vp) == -1 && rq->skipped == 7;
+    check(ok, "a hole with nothing behind it is never skipped");
+    rq_destroy(rq);
+}
+
+void *producer(void *arg)
+{
+    uint64_t seq;
+    int r;
+
+    while ((seq = atomic_fetch_add(&counter, 1)) < EVENTS)
+    {
+        if (holes && seq % HOLE_EVERY == HOLE_EVERY / 2)
+            continue;
+        /* let another producer overtake now and then */
+        if (seq % 7 == 0)
+            sched_yield();
+        if (seq + 1 < atomic_load(&rq->highest))
+            atomic_fetch_add(&early, 1);
+        while ((r = rq_enq(rq, seq, &seq)) == -1)
+            sched_yield();
+        if (r != 0 && !holes)
+            bad = 1;
+    }
+    return (NULL);
+}
+
+void *consumer(void *arg)
+{
+    uint64_t seqs[DEPTH], v[DEPTH], last = 0;
+    size_t i, k, n = 0;
+
+    while (rq->released + rq->skipped < EVENTS)
+    {
+        if ((k = rq_deq_bulk(rq, seqs, v, DEPTH)) == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        for (i = 0; i < k; i++)
+        {
+            if (v[i] != seqs[i] || (n > 0 && seqs[i] <= last))
+                bad = 1;
+            last = seqs[i];
+        }
+        n += k;
+    }
+    return (NULL);
+}
+
+void run(int with_holes, const char *what)
+{
+    pthread_t p[PRODUCERS], c;
+    int i;
+
+    rq = rq_create(DEPTH, sizeof(uint64_t), with_holes ? WAIT_NS : UINT64_MAX);
+    holes = with_holes;
+    bad = 0;
+    atomic_store(&counter, 0);
+    atomic_store(&early, 0);
+    pthread_create(&c, NULL, consumer, NULL);
+    for (i = 0; i < PRODUCERS; i++)
+        pthread_create(&p[i], NULL, producer, NULL);
+    for (i = 0; i < PRODUCERS; i++)
+        pthread_join(p[i], NULL);
+    pthread_join(c, NULL);
+    printf("%zu released, %zu arrived behind a later one, %zu skipped, %zu late, %zu retried\n",
+           rq->released, atomic_load(&early), rq->skipped, atomic_load(&rq->late),
+           atomic_load(&rq->ahead));
+    /* a producer descheduled past WAIT_NS makes a hole too, and comes late */
+    check(!bad && rq->skipped == (holes ? EVENTS / HOLE_EVERY : 0) + rq->late, what);
+    rq_destroy(rq);
+}
+
+int main(int argc, char **argv)
+{
+    single();
+    run(0, "every payload once, in order");
+    run(1, "only the numbers never sent are skipped");
+    exit(failures ? 1 : 0);
+}
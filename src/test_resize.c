@@ -0,0 +1,167 @@
+/*
+ * test_resize - growing and shrinking a live sq_t.
+ *
+ * Single threaded first, spinlock mode: a resize keeps every queued
+ * payload in order, migrates them a step at a time, refuses a shrink below
+ * what is queued and copes with payloads overwritten before they were
+ * migrated.  Then a producer and a consumer, in the spinlock and the
+ * lock-free mode, while the main thread grows the queue from 16 to 1024
+ * slots and shrinks it back: every payload must arrive once, in order.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "vringbuffer.h"
+#include "test_check.h"
+
+#define EVENTS	200000
+#define SMALL	16
+#define LARGE	1024
+
+static sq_t *sqp;
+static atomic_int done;
+static int bad;
+
+/* queue n payloads numbered from first, one lock for all */
+static void fill(uint64_t first, size_t n)
+{
+    uint64_t v[LARGE];
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        v[i] = first + i;
+    q_enq_bulk(sqp, v, n);
+}
+
+/* dequeue n payloads, checking they run on from first */
+static int drain(uint64_t first, size_t n)
+{
+    uint64_t v[LARGE];
+    size_t i, k = q_deq_bulk(sqp, v, n);
+
+    for (i = 0; i < k; i++)
+        if (v[i] != first + i)
+            return (0);
+    return (k == n);
+}
+
+void single(void)
+{
+    uint64_t v;
+    int ok;
+
+    sqp = sq_create_policy(64, sizeof(uint64_t), SQ_FAIL);
+    fill(0, 40);
+    ok = sq_resize(sqp, 1024) == 0 && atomic_load(&sqp->gen) == 1;
+    ok = ok && sqp->old.slab != NULL && q_count(sqp) == 40;
+    check(ok, "grow installs the new store without copying");
+
+    fill(40, 1);
+    ok = sqp->mig == SQ_MIGRATE_STEP;
+    ok = ok && sq_resize(sqp, 2048) == -1 && errno == EBUSY;
+    check(ok, "a call migrates one step, a second resize waits for it");
+
+    ok = drain(0, 41) && sqp->old.slab == NULL && sqp->lost == 0;
+    check(ok, "payloads come out of the new store in order");
+
+    fill(41, 100);
+    ok = sq_resize(sqp, 64) == -1 && errno == EBUSY;
+    ok = ok && drain(41, 90) && sq_resize(sqp, 16) == 0;
+    ok = ok && drain(131, 10) && sqp->store.max == 16 && sqp->old.slab == NULL;
+    fill(0, 16);
+    v = 16;
+    ok = ok && q_enq_bulk(sqp, &v, 1) == 0 && sqp->rejected == 1;
+    check(ok, "shrink below what is queued is refused, then a full 16");
+    sq_destroy(sqp);
+
+    /* overwriting the oldest before it is migrated */
+    sqp = sq_create(LARGE, sizeof(uint64_t));
+    fill(0, LARGE);
+    sq_resize(sqp, LARGE);
+    fill(LARGE, 100);
+    ok = sqp->overwritten == 100 && drain(100, LARGE) && sqp->lost == 100;
+    check(ok, "payloads overwritten during a migration are skipped");
+    sq_destroy(sqp);
+}
+
+void *producer(void *arg)
+{
+    uint64_t v;
+
+    for (v = 0; v < EVENTS; v++)
+        q_enq_bulk(sqp, &v, 1);
+    return (NULL);
+}
+
+void *consumer(void *arg)
+{
+    uint64_t v[64], next = 0;
+    size_t i, k;
+
+    while (next < EVENTS)
+    {
+        if ((k = q_deq_bulk(sqp, v, 64)) == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        for (i = 0; i < k; i++)
+            if (v[i] != next++)
+                bad = 1;
+    }
+    atomic_store(&done, 1);
+    return (NULL);
+}
+
+/* resize to depth, retrying while the last one is still under way */
+static int resize(size_t depth)
+{
+    while (sq_resize(sqp, depth) != 0)
+    {
+        if (errno != EBUSY || atomic_load(&done))
+            return (0);
+        sched_yield();
+    }
+    return (1);
+}
+
+void live(lockmode_t mode, const char *name)
+{
+    pthread_t p, c;
+    size_t depth, n = 0;
+    char what[80];
+
+    sqp = sq_create_policy(SMALL, sizeof(uint64_t), SQ_BLOCK);
+    sqp->mode = mode;
+    bad = 0;
+    atomic_store(&done, 0);
+    pthread_create(&c, NULL, consumer, NULL);
+    pthread_create(&p, NULL, producer, NULL);
+    while (!atomic_load(&done))
+    {
+        for (depth = 2 * SMALL; depth <= LARGE; depth *= 2)
+            n += resize(depth);
+        for (depth = LARGE / 2; depth >= SMALL; depth /= 2)
+            n += resize(depth);
+    }
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    printf("%s: %zu resizes during %d payloads\n", name, n, EVENTS);
+    snprintf(what, sizeof(what), "%s: every payload once, in order, across resizes", name);
+    check(!bad && sqp->lost == 0 && atomic_load(&sqp->gen) == n, what);
+    sq_destroy(sqp);
+}
+
+int main(int argc, char **argv)
+{
+    single();
+    live(LOCK_SPIN, "spinlock");
+    live(LOCK_FREE, "lock-free");
+    exit(failures ? 1 : 0);
+}
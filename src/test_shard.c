@@ -0,0 +1,147 @@
+/*
+ * test_shard - producers on their own shards, consumers stealing.
+ *
+ * Single threaded first: shq_count adds up the shards, and a consumer with
+ * an empty home shard steals half of the fullest shard, in order, and
+ * what it hasn't handed out when it finishes is counted as dropped; a
+ * shard past nshards is refused.  Then N
+ * producers and N consumers for N = 1, 2, 4, 8: every payload must arrive
+ * exactly once and, per consumer, each producer's payloads in order.  The
+ * throughput of each run is printed so the scaling can be compared.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "shard.h"
+#include "test_check.h"
+
+#define DEPTH	256
+#define BATCH	32
+#define EVENTS	20000
+#define MAXN	8
+
+/* the payload: which producer and its sequence number */
+typedef struct msg
+{
+    uint64_t producer;
+    uint64_t seq;
+} msg_t;
+
+static shq_t *shq;
+static int nthreads;
+static atomic_size_t received;
+static atomic_size_t steals;
+static uint64_t sums[MAXN];
+static pthread_mutex_t sums_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void steal_half(void)
+{
+    shq_consumer_t c;
+    msg_t m = { 1, 0 };
+    buf_t vp = &m;
+    int ok;
+
+    shq = shq_create(2, DEPTH, sizeof(msg_t));
+    for (m.seq = 0; m.seq < 10; m.seq++)
+        shq_enq(shq, 1, &m);
+    ok = shq_count(shq) == 10;
+    shq_consumer_init(&c, shq, 0, BATCH);
+    ok = ok && shq_deq(&c, &vp) == 0 && m.seq == 0;
+    ok = ok && c.steals == 1 && c.stolen == 5 && shq_count(shq) == 5;
+    check(ok, "idle consumer steals half the fullest shard");
+    ok = shq_consumer_fini(&c) == 4 && atomic_load(&shq->dropped) == 4;
+    check(ok, "a finished consumer counts its stash as dropped");
+    errno = 0;
+    ok = shq_enq(shq, 2, &m) == -1 && errno == EINVAL && shq_enq_bulk(shq, 2, &m, 1) == 0;
+    check(ok, "a shard past nshards is refused");
+    shq_destroy(shq);
+}
+
+void *producer(void *arg)
+{
+    msg_t m = { (uintptr_t)arg, 0 };
+
+    shq_attach(shq, (unsigned)m.producer);
+    for (m.seq = 0; m.seq < EVENTS; m.seq++)
+        shq_enq(shq, (unsigned)m.producer, &m);
+    return (NULL);
+}
+
+void *consumer(void *arg)
+{
+    shq_consumer_t c;
+    msg_t m;
+    buf_t vp = &m;
+    uint64_t next[MAXN] = { 0 }, sum[MAXN] = { 0 };
+    size_t total = (size_t)nthreads * EVENTS;
+    int i;
+
+    shq_consumer_init(&c, shq, (unsigned)(uintptr_t)arg, BATCH);
+    while (atomic_load(&received) < total)
+    {
+        if (shq_deq(&c, &vp) != 0)
+            continue;
+        /* later payloads of a producer may have gone elsewhere, never earlier ones */
+        if (m.seq < next[m.producer])
+            atomic_fetch_add(&failures, 1);
+        next[m.producer] = m.seq + 1;
+        sum[m.producer] += m.seq;
+        atomic_fetch_add(&received, 1);
+    }
+    pthread_mutex_lock(&sums_mutex);
+    for (i = 0; i < nthreads; i++)
+        sums[i] += sum[i];
+    pthread_mutex_unlock(&sums_mutex);
+    atomic_fetch_add(&steals, c.steals);
+    shq_consumer_fini(&c);
+    return (NULL);
+}
+
+void scale(int n)
+{
+    pthread_t tid[2 * MAXN];
+    struct timespec t0, t1;
+    double secs;
+    uintptr_t i;
+    int ok = 1;
+
+    nthreads = n;
+    atomic_store(&received, 0);
+    atomic_store(&steals, 0);
+    for (i = 0; i < MAXN; i++)
+        sums[i] = 0;
+    shq = shq_create(n, DEPTH, sizeof(msg_t));
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < (uintptr_t)n; i++)
+    {
+        pthread_create(&tid[i], NULL, producer, (void *)i);
+        pthread_create(&tid[n + i], NULL, consumer, (void *)i);
+    }
+    for (i = 0; i < (uintptr_t)(2 * n); i++)
+        pthread_join(tid[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    for (i = 0; i < (uintptr_t)n; i++)
+        ok = ok && sums[i] == (uint64_t)EVENTS * (EVENTS - 1) / 2;
+    ok = ok && shq_count(shq) == 0 && atomic_load(&shq->dropped) == 0;
+    printf("P=C=%d %zu payloads %.0f ops/sec, %zu steals\n", n, (size_t)atomic_load(&received),
+           atomic_load(&received) / secs, (size_t)atomic_load(&steals));
+    check(ok, "every payload once, each producer in order");
+    shq_destroy(shq);
+}
+
+int main(int argc, char **argv)
+{
+    int n;
+
+    steal_half();
+    for (n = 1; n <= MAXN; n *= 2)
+        scale(n);
+    exit(atomic_load(&failures) ? 1 : 0);
+}
@@ -0,0 +1,91 @@
+/*
+ * test_slotpool - several threads taking and returning slots of a small pool.
+ *
+ * Each thread stamps the slot it owns with its id and checks the stamp is
+ * still there before giving it back, so two owners of one slot are caught.
+ * A single thread then checks the pool hands out exactly nslots slots.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "slotpool.h"
+#include "test_check.h"
+
+#define SLOTS	3
+#define WIDTH	200
+#define THREADS	4
+#define ROUNDS	200000
+
+static slotpool_t *pool;
+static atomic_long empty;
+
+void *worker(void *arg)
+{
+    uintptr_t id = (uintptr_t)arg;
+    unsigned char *slot;
+    int i, j;
+
+    for (i = 0; i < ROUNDS; i++)
+    {
+        if ((slot = slotpool_get(pool)) == NULL)
+        {
+            atomic_fetch_add(&empty, 1);
+            continue;
+        }
+        memset(slot, (int)id, WIDTH);
+        for (j = 0; j < WIDTH; j++)
+        {
+            if (slot[j] != id)
+            {
+                atomic_fetch_add(&failures, 1);
+                break;
+            }
+        }
+        slotpool_put(pool, slot);
+    }
+    return (NULL);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[THREADS];
+    void *held[SLOTS];
+    uintptr_t i;
+    int j, ok = 1;
+
+    pool = slotpool_create(SLOTS, WIDTH);
+    if (pool == NULL)
+    {
+        fprintf(stderr, "slotpool_create failed\n");
+        exit(1);
+    }
+    for (i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, (void *)(i + 1));
+    for (i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    printf("%d threads x %d rounds, %ld found the pool empty\n", THREADS, ROUNDS, (long)empty);
+    check(failures == 0, "no slot owned twice");
+
+    /* every slot comes back, distinct and aligned, then the pool is empty */
+    for (j = 0; j < SLOTS; j++)
+    {
+        held[j] = slotpool_get(pool);
+        if (held[j] == NULL || ((uintptr_t)held[j] % SLOTPOOL_CACHE_LINE) != 0)
+            ok = 0;
+        for (i = 0; i < (uintptr_t)j; i++)
+            if (held[i] == held[j])
+                ok = 0;
+    }
+    if (slotpool_get(pool) != NULL)
+        ok = 0;
+    for (j = 0; j < SLOTS; j++)
+        slotpool_put(pool, held[j]);
+    checkf(ok, "%d distinct slots, then empty", SLOTS);
+    slotpool_destroy(pool);
+    exit(failures ? 1 : 0);
+}
@@ -0,0 +1,69 @@
+/*
+ * test_sqlock - several threads bumping one counter under each sq_t lock.
+ *
+ * The counter is a plain int, so any lost update means two threads were in
+ * the critical section at once.  With the histograms on, every acquisition
+ * must show up once in the wait and once in the hold histogram.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "sqlock.h"
+#include "test_check.h"
+
+#define THREADS	4
+#define ROUNDS	20000
+
+static sqlock_t lock;
+static lockmode_t mode;
+static long counter;
+
+void *worker(void *arg)
+{
+    uint32_t bit = 1u << (uintptr_t)arg;
+    int i;
+
+    for (i = 0; i < ROUNDS; i++)
+    {
+        sqlock_acquire(&lock, mode, bit);
+        counter++;
+        sqlock_release(&lock, mode);
+    }
+    return (NULL);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *names[] = { "spinlock", "mutex", "lock-free", "ttas", "ticket", "mcs" };
+    pthread_t threads[THREADS];
+    uint64_t nwait, nhold;
+    uintptr_t i;
+    int b, ok;
+
+    sqlock_init(&lock);
+    lock.stat = true;
+    for (mode = LOCK_SPIN; mode < LOCK_MODES; mode++)
+    {
+        if (mode == LOCK_FREE)
+            continue;
+        counter = 0;
+        sqlock_reset_stats(&lock);
+        for (i = 0; i < THREADS; i++)
+            pthread_create(&threads[i], NULL, worker, (void *)i);
+        for (i = 0; i < THREADS; i++)
+            pthread_join(threads[i], NULL);
+        nwait = nhold = 0;
+        for (b = 0; b < SQLOCK_BUCKETS; b++)
+        {
+            nwait += lock.wait[b];
+            nhold += lock.hold[b];
+        }
+        ok = counter == (long)THREADS * ROUNDS && nwait == (uint64_t)counter && nhold == (uint64_t)counter;
+        checkf(ok, "%-8s counter=%ld waits=%llu holds=%llu", names[mode], counter, (unsigned long long)nwait, (unsigned long long)nhold);
+    }
+    sqlock_destroy(&lock);
+    exit(failures ? 1 : 0);
+}
@@ -0,0 +1,152 @@
+/*
+ * test_transform - payloads multiplied by a weight matrix a batch at a time.
+ *
+ * Single threaded: ten-float payloads through a 3 x 10 transform in
+ * batches of 4 must give what a plain per-payload loop gives, in order,
+ * with the lone payload at the end done by sgemv; a payload wider than
+ * the floats used and a result slot wider than rows are handled by the
+ * leading dimensions; results a full SQ_FAIL output queue turns away are
+ * counted; bad widths are refused.  Then a stream through the stage with
+ * batches of 1 and of 64, both timed, checking every result.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include "tq.h"
+#include "test_check.h"
+
+#define ROWS	3
+#define COLS	10
+#define STREAM	200000
+
+static float w[ROWS * COLS];
+
+/* payload i, field c */
+static float input(size_t i, size_t c)
+{
+    return ((float)((i * 7 + c * 3) % 17) - 8.0f) / 4.0f;
+}
+
+/* the result a per-payload loop gives */
+static int expect(const float *y, size_t i)
+{
+    size_t r, c;
+    float sum;
+
+    for (r = 0; r < ROWS; r++)
+    {
+        sum = 0.0f;
+        for (c = 0; c < COLS; c++)
+            sum += w[r * COLS + c] * input(i, c);
+        if (fabsf(y[r] - sum) > 1e-4f)
+            return (0);
+    }
+    return (1);
+}
+
+/* enqueue payloads first .. first + n - 1, width floats wide */
+static void feed(sq_t *in, size_t first, size_t n, size_t width)
+{
+    float p[16] = { 0 };
+    size_t i, c;
+
+    for (i = first; i < first + n; i++)
+    {
+        for (c = 0; c < COLS; c++)
+            p[c] = input(i, c);
+        /* past cols: a field the transform must not read */
+        for (; c < width; c++)
+            p[c] = 1e6f;
+        q_enq(in, p);
+    }
+}
+
+void single(void)
+{
+    sq_t *in = sq_create(16, COLS * sizeof(float));
+    sq_t *out = sq_create(16, ROWS * sizeof(float));
+    float y[16];
+    buf_t yp = y;
+    size_t i;
+    tq_t *tq;
+    int ok;
+
+    tq = tq_create(in, out, w, ROWS, COLS, 4);
+    feed(in, 0, 9, COLS);
+    ok = tq_step(tq) == 4 && tq_step(tq) == 4 && tq_step(tq) == 1 && tq_step(tq) == 0;
+    ok = ok && tq->gemm_calls == 2 && tq->gemv_calls == 1 && tq->items == 9;
+    for (i = 0; i < 9; i++)
+        ok = ok && q_deq(out, &yp) == 0 && expect(y, i);
+    ok = ok && q_deq(out, &yp) == -1;
+    check(ok, "batches match the per-payload transform, in order");
+    tq_print_stats(stdout, "single", tq);
+    tq_destroy(tq);
+    sq_destroy(in);
+    sq_destroy(out);
+
+    /* payload_t sized on both sides: 10 floats in, 3 of 10 out */
+    in = sq_create(16, 12 * sizeof(float));
+    out = sq_create_policy(4, 10 * sizeof(float), SQ_FAIL);
+    tq = tq_create(in, out, w, ROWS, COLS, 8);
+    feed(in, 0, 6, 12);
+    ok = tq_step(tq) == 6 && tq->refused == 6 - out->store.max;
+    for (i = 0; i < out->store.max; i++)
+        ok = ok && q_deq(out, &yp) == 0 && expect(y, i) && y[ROWS] == 0.0f && y[9] == 0.0f;
+    check(ok, "wider slots use the leading dimensions, a full output refuses");
+    tq_destroy(tq);
+
+    errno = 0;
+    ok = tq_create(in, out, w, ROWS, 13, 8) == NULL && errno == EINVAL;
+    ok = ok && tq_create(in, out, w, 11, COLS, 8) == NULL && tq_create(in, out, w, ROWS, COLS, 0) == NULL;
+    check(ok, "payloads narrower than the transform are refused");
+    sq_destroy(in);
+    sq_destroy(out);
+}
+
+void stream(size_t batch)
+{
+    sq_t *in = sq_create(1024, COLS * sizeof(float));
+    sq_t *out = sq_create(1024, ROWS * sizeof(float));
+    float y[ROWS * 64];
+    char what[80];
+    uint64_t t0, dt = 0;
+    size_t i = 0, j, k, got = 0;
+    tq_t *tq = tq_create(in, out, w, ROWS, COLS, batch);
+    int ok = 1;
+
+    while (got < STREAM)
+    {
+        k = STREAM - i < 512 ? STREAM - i : 512;
+        feed(in, i, k, COLS);
+        i += k;
+        t0 = sq_clock_ns();
+        while (tq_step(tq) > 0)
+            ;
+        dt += sq_clock_ns() - t0;
+        while ((k = q_deq_bulk(out, y, 64)) > 0)
+            for (j = 0; j < k; j++, got++)
+                ok = ok && expect(y + j * ROWS, got);
+    }
+    tq_print_stats(stdout, "stream", tq);
+    printf("batch %zu: %.1f ns per payload in tq_step\n", batch, (double)dt / STREAM);
+    snprintf(what, sizeof(what), "batches of %zu: every result right, in order", batch);
+    check(ok && tq->items == STREAM && tq->refused == 0, what);
+    tq_destroy(tq);
+    sq_destroy(in);
+    sq_destroy(out);
+}
+
+int main(int argc, char **argv)
+{
+    size_t i;
+
+    for (i = 0; i < ROWS * COLS; i++)
+        w[i] = (float)((int)(i % 5) - 2) * 0.5f + (float)i / 32.0f;
+    single();
+    stream(1);
+    stream(64);
+    exit(failures ? 1 : 0);
+}
@@ -0,0 +1,160 @@
+/*
+ * test_vq - variable-size payloads over size-class slabs.
+ *
+ * Single threaded first: mixed sizes come back intact and in order, the
+ * footprint is the ring's fixed cache-line slots plus slabs that follow
+ * the sizes queued, rather than depth x max_len, and small payloads sit
+ * packed.  Then one producer and one consumer in the
+ * spinlock and the lock-free mode, every payload a different length with
+ * contents the consumer can check.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "vq.h"
+#include "test_check.h"
+
+#define DEPTH	1024
+#define MAXLEN	4096
+#define SMALL	1000
+#define EVENTS	20000
+/* the descriptor ring: a cache line and a sequence number per slot */
+#define RING	(DEPTH * (64 + 8))
+
+static vq_t *vq;
+static int bad;
+
+/* payload n is len(n) bytes, each byte (n + i) & 0xff */
+static size_t len_of(uint64_t n)
+{
+    return ((n % 16) == 15 ? 1 + (n * 2654435761u) % MAXLEN : 1 + n % 8);
+}
+
+static void fill(unsigned char *p, uint64_t n, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        p[i] = (unsigned char)(n + i);
+}
+
+static int same(const unsigned char *p, uint64_t n, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (p[i] != (unsigned char)(n + i))
+            return (0);
+    return (1);
+}
+
+void single(void)
+{
+    unsigned char buf[MAXLEN];
+    slotpool_t *pool;
+    uint64_t n;
+    int ok = 1;
+
+    vq = vq_create(DEPTH, MAXLEN, SQ_FAIL);
+    check(vq != NULL && vq_footprint(vq) == RING, "only the ring before the first payload");
+
+    /* mostly 8 bytes, two 4 KB */
+    for (n = 0; n < SMALL; n++)
+    {
+        fill(buf, n, 8);
+        ok = ok && vq_enq(vq, buf, 8) == 0;
+    }
+    fill(buf, n, MAXLEN);
+    ok = ok && vq_enq(vq, buf, MAXLEN) == 0 && vq_enq(vq, buf, MAXLEN) == 0;
+    /* 8 byte class: 512 + 1024 slots; 4 KB class: 1 + 2 slots */
+    ok = ok && vq_footprint(vq) == RING + (512 + 1024) * 8 + 3 * MAXLEN;
+    check(ok, "footprint follows the sizes queued");
+    printf("footprint %zu bytes, fixed slots of %d would take %d\n",
+           vq_footprint(vq), MAXLEN, DEPTH * (MAXLEN + 8));
+
+    pool = atomic_load(&vq->cls[0].chunk[0]);
+    check(pool != NULL && pool->stride == 8, "8 byte payloads packed 8 to a cache line");
+
+    ok = vq_enq(vq, buf, MAXLEN + 1) == -1;
+    for (n = 0; n < SMALL; n++)
+        ok = ok && vq_deq(vq, buf, sizeof(buf)) == 8 && same(buf, n, 8);
+    ok = ok && vq_deq(vq, buf, sizeof(buf)) == MAXLEN && same(buf, n, MAXLEN);
+    ok = ok && vq_deq(vq, buf, 16) == MAXLEN && same(buf, n, 16);
+    ok = ok && vq_deq(vq, buf, sizeof(buf)) == -1;
+    check(ok, "payloads come back intact, in order, cut to room");
+
+    /* the slots went back: the same load needs no new chunk */
+    for (n = 0; n < SMALL; n++)
+        ok = ok && vq_enq(vq, buf, 1 + n % 8) == 0;
+    while (vq_deq(vq, buf, sizeof(buf)) > 0)
+        ;
+    check(ok && vq_footprint(vq) == RING + (512 + 1024) * 8 + 3 * MAXLEN, "freed slots are reused");
+    vq_destroy(vq);
+}
+
+void *producer(void *arg)
+{
+    unsigned char buf[MAXLEN];
+    uint64_t n;
+    size_t len;
+
+    for (n = 0; n < EVENTS; n++)
+    {
+        len = len_of(n);
+        fill(buf, n, len);
+        if (vq_enq(vq, buf, len) != 0)
+            bad = 1;
+    }
+    return (NULL);
+}
+
+void *consumer(void *arg)
+{
+    unsigned char buf[MAXLEN];
+    uint64_t n = 0;
+    ssize_t len;
+
+    while (n < EVENTS)
+    {
+        if ((len = vq_deq(vq, buf, sizeof(buf))) < 0)
+        {
+            sched_yield();
+            continue;
+        }
+        if ((size_t)len != len_of(n) || !same(buf, n, (size_t)len))
+            bad = 1;
+        n++;
+    }
+    return (NULL);
+}
+
+void threads(lockmode_t mode, const char *name)
+{
+    pthread_t p, c;
+    char what[80];
+
+    vq = vq_create(64, MAXLEN, SQ_BLOCK);
+    vq_set_mode(vq, mode);
+    bad = 0;
+    pthread_create(&c, NULL, consumer, NULL);
+    pthread_create(&p, NULL, producer, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    printf("%s: footprint %zu bytes\n", name, vq_footprint(vq));
+    snprintf(what, sizeof(what), "%s: %d mixed size payloads intact and in order", name, EVENTS);
+    check(!bad && vq->ring->lost == 0, what);
+    vq_destroy(vq);
+}
+
+int main(int argc, char **argv)
+{
+    single();
+    threads(LOCK_SPIN, "spinlock");
+    threads(LOCK_FREE, "lock-free");
+    exit(failures ? 1 : 0);
+}
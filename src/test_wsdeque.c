@@ -0,0 +1,97 @@
+/*
+ * test_wsdeque - one owner pushing and popping, several thieves stealing.
+ *
+ * The deque starts with two slots so it has to grow many times while the
+ * thieves are active. Every task must be taken exactly once.
+ *
+ * DRE 2024
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "wsdeque.h"
+#include "test_check.h"
+
+#define TASKS	200000
+#define THIEVES	3
+
+static wsdeque_t *dq;
+static atomic_int taken[TASKS + 1];
+static atomic_int owner_done;
+static atomic_int stolen;
+
+static void take(void *task)
+{
+    atomic_fetch_add(&taken[(uintptr_t)task], 1);
+}
+
+void *thief(void *arg)
+{
+    void *task;
+    int ret;
+    int mine = 0;
+
+    while (!atomic_load(&owner_done) || wsdeque_size(dq) > 0)
+    {
+        ret = wsdeque_steal(dq, &task);
+        if (ret == 0)
+        {
+            take(task);
+            mine++;
+        }
+    }
+    atomic_fetch_add(&stolen, mine);
+    return (NULL);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t thieves[THIEVES];
+    uintptr_t i;
+    void *task;
+    int popped = 0;
+    int bad = 0;
+
+    dq = wsdeque_create(2);
+    for (i = 0; i < THIEVES; i++)
+        pthread_create(&thieves[i], NULL, thief, NULL);
+
+    /* owner pushes bursts and pops about a third of them back */
+    for (i = 1; i <= TASKS; i++)
+    {
+        if (wsdeque_push(dq, (void *)i) != 0)
+        {
+            fprintf(stderr, "wsdeque_push failed\n");
+            exit(1);
+        }
+        if (i % 3 == 0 && wsdeque_pop(dq, &task) == 0)
+        {
+            take(task);
+            popped++;
+        }
+    }
+    /* owner drains what the thieves left */
+    while (wsdeque_pop(dq, &task) == 0)
+    {
+        take(task);
+        popped++;
+    }
+    atomic_store(&owner_done, 1);
+    for (i = 0; i < THIEVES; i++)
+        pthread_join(thieves[i], NULL);
+
+    for (i = 1; i <= TASKS; i++)
+    {
+        if (taken[i] != 1)
+        {
+            if (bad++ < 10)
+                fprintf(stderr, "task %lu taken %d times\n", (unsigned long)i, taken[i]);
+        }
+    }
+    printf("owner popped %d, thieves stole %d, total %d of %d\n", popped, stolen, popped + stolen, TASKS);
+    check(!bad, "every task taken exactly once");
+    wsdeque_destroy(dq);
+    exit(failures ? 1 : 0);
+}
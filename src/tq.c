@@ -0,0 +1,173 @@
+/*! \file tq.c
+ *
+ * DRE 2024
+ *
+ * Batched linear transform stage, see tq.h.
+ */
+
+#include <stdlib.h>     /* aligned_alloc, free */
+#include <string.h>     /* memcpy, memset */
+#include <errno.h>      /* errno, EINVAL, ENOMEM */
+#include "config.h"     /* HAVE_CBLAS_H, HAVE_CBLAS_SGEMM */
+#include "tq.h"         /* tq_t and external function prototypes */
+
+#if defined(HAVE_CBLAS_H) && defined(HAVE_CBLAS_SGEMM)
+#include <cblas.h>      /* cblas_sgemm, cblas_sgemv */
+#define TQ_BLAS 1
+#endif
+
+/**
+ * tq_create - set up a transform stage between two queues
+ * @in: payloads to transform, buffer_width a multiple of sizeof(float)
+ *      and at least cols floats
+ * @out: results, buffer_width a multiple of sizeof(float) and at least
+ *       rows floats
+ * @weight: W, rows x cols floats row-major, copied
+ * @rows: result floats per payload
+ * @cols: payload floats used
+ * @max_batch: most payloads one tq_step takes
+ *
+ * Return: the stage, or NULL with errno set to EINVAL or ENOMEM
+ */
+tq_t *tq_create(sq_t *in, sq_t *out, const float *weight, size_t rows, size_t cols,
+                size_t max_batch)
+{
+    tq_t *tqp;
+
+    if (in == NULL || out == NULL || weight == NULL || rows == 0 || cols == 0 ||
+        max_batch == 0 || in->buffer_width % sizeof(float) != 0 ||
+        out->buffer_width % sizeof(float) != 0 ||
+        in->buffer_width < cols * sizeof(float) || out->buffer_width < rows * sizeof(float))
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+    tqp = aligned_alloc(CACHE_LINE, SQ_STRIDE(sizeof(tq_t)));
+    if (tqp == NULL)
+    {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    memset(tqp, 0, sizeof(tq_t));
+    tqp->in = in;
+    tqp->out = out;
+    tqp->rows = rows;
+    tqp->cols = cols;
+    tqp->lda = in->buffer_width / sizeof(float);
+    tqp->ldc = out->buffer_width / sizeof(float);
+    tqp->max_batch = max_batch;
+    tqp->weight = aligned_alloc(CACHE_LINE, SQ_STRIDE(rows * cols * sizeof(float)));
+    tqp->x = aligned_alloc(CACHE_LINE, SQ_STRIDE(max_batch * in->buffer_width));
+    tqp->y = aligned_alloc(CACHE_LINE, SQ_STRIDE(max_batch * out->buffer_width));
+    if (tqp->weight == NULL || tqp->x == NULL || tqp->y == NULL)
+    {
+        tq_destroy(tqp);
+        errno = ENOMEM;
+        return (NULL);
+    }
+    memcpy(tqp->weight, weight, rows * cols * sizeof(float));
+    /* result floats past rows are never written, queue them as zero */
+    memset(tqp->y, 0, max_batch * out->buffer_width);
+    return (tqp);
+}
+
+/**
+ * tq_destroy - free the stage, not its queues
+ * @tqp: the stage, no thread may be using it.  NULL is ignored.
+ */
+void tq_destroy(tq_t *tqp)
+{
+    if (tqp == NULL)
+        return;
+    free(tqp->weight);
+    free(tqp->x);
+    free(tqp->y);
+    free(tqp);
+}
+
+/**
+ * tq_transform - Y = X W^T for n payloads in x, results in y
+ */
+static void tq_transform(tq_t *tqp, size_t n)
+{
+#ifdef TQ_BLAS
+    if (n == 1)
+    {
+        cblas_sgemv(CblasRowMajor, CblasNoTrans, (int)tqp->rows, (int)tqp->cols, 1.0f,
+                    tqp->weight, (int)tqp->cols, tqp->x, 1, 0.0f, tqp->y, 1);
+        tqp->gemv_calls++;
+        return;
+    }
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, (int)n, (int)tqp->rows, (int)tqp->cols,
+                1.0f, tqp->x, (int)tqp->lda, tqp->weight, (int)tqp->cols, 0.0f, tqp->y, (int)tqp->ldc);
+    tqp->gemm_calls++;
+#else
+    const float *x, *w;
+    float *y, sum;
+    size_t i, r, c;
+
+    for (i = 0; i < n; i++)
+    {
+        x = tqp->x + i * tqp->lda;
+        y = tqp->y + i * tqp->ldc;
+        for (r = 0; r < tqp->rows; r++)
+        {
+            w = tqp->weight + r * tqp->cols;
+            sum = 0.0f;
+            for (c = 0; c < tqp->cols; c++)
+                sum += w[c] * x[c];
+            y[r] = sum;
+        }
+    }
+    if (n == 1)
+        tqp->gemv_calls++;
+    else
+        tqp->gemm_calls++;
+#endif
+}
+
+/**
+ * tq_step - transform one batch
+ * @tqp: the stage
+ *
+ * Takes up to max_batch payloads from in with one q_deq_bulk, transforms
+ * them with one BLAS call and queues the results on out with one
+ * q_enq_bulk, in the same order.  Doesn't wait: an empty in returns 0 at
+ * once, and out's full policy applies to the results.
+ *
+ * Return: payloads taken from in, 0 if it was empty
+ */
+size_t tq_step(tq_t *tqp)
+{
+    size_t n, done;
+
+    n = q_deq_bulk(tqp->in, tqp->x, tqp->max_batch);
+    if (n == 0)
+        return (0);
+    tq_transform(tqp, n);
+    done = q_enq_bulk(tqp->out, tqp->y, n);
+    tqp->refused += n - done;
+    tqp->batches++;
+    tqp->items += n;
+    return (n);
+}
+
+/**
+ * tq_print_stats - batches, products and results lost
+ * @fp: where to print
+ * @label: names the stage or the run
+ * @tqp: the stage
+ */
+void tq_print_stats(FILE *fp, const char *label, const tq_t *tqp)
+{
+    fprintf(fp, "%s: %zu x %zu transform, %zu payloads in %zu batches, mean %.1f, %zu sgemm, %zu sgemv, %zu refused%s\n",
+            label, tqp->rows, tqp->cols, tqp->items, tqp->batches,
+            tqp->batches ? (double)tqp->items / tqp->batches : 0.0,
+            tqp->gemm_calls, tqp->gemv_calls, tqp->refused,
+#ifdef TQ_BLAS
+            ""
+#else
+            " (no cblas, plain loops)"
+#endif
+           );
+}
@@ -0,0 +1,89 @@
+/*! \file tq.h
+ *
+ * DRE 2024
+ *
+ * Transform stage: payloads of floats taken from one sq_t in batches,
+ * multiplied by a fixed weight matrix, and the results queued on another.
+ *
+ * A consumer that applies the same linear transform y = W x to every
+ * payload one at a time makes one matrix-vector product (BLAS level 2)
+ * per payload, and streams all of W through the cache for each one.
+ * tq_step instead takes up to max_batch payloads with a single q_deq_bulk,
+ * which already packs them buffer_width apart: read as floats that is a
+ * row-major matrix X, one payload per row, with no copy beyond the
+ * dequeue.  Then one matrix-matrix product (level 3)
+ *
+ *   Y = X W^T      X is n x cols, W is rows x cols, Y is n x rows
+ *
+ * reuses each block of W across the whole batch, which is where a BLAS
+ * library gets its full FLOP rate.  Y is packed the output queue's
+ * buffer_width apart, so one q_enq_bulk queues every result.  A batch of
+ * one payload uses the matrix-vector product, sgemv, since a 1-row sgemm
+ * only adds call overhead.
+ *
+ * The leading dimensions are the payload widths in floats, so a payload
+ * may carry more than cols floats (payload_t has ten; a transform can use
+ * the first few) and a result slot more than rows.  Float fields past the
+ * ones used are left as they are: zero in a result slot.
+ *
+ * With <cblas.h> and a library providing cblas_sgemm (configure defines
+ * HAVE_CBLAS_H and HAVE_CBLAS_SGEMM) the products are BLAS calls,
+ * otherwise plain loops with the same results.
+ *
+ * One thread calls tq_step; producers on in and consumers on out work as
+ * they would on any sq_t, with its lock mode and full policy.  Results
+ * out's policy turns away are counted in refused.
+ */
+
+#ifndef _TQ_H
+#define _TQ_H
+
+#include <stdio.h>      /* FILE */
+#include <stddef.h>     /* size_t */
+#include "vringbuffer.h" /* sq_t, CACHE_LINE, SQ_STRIDE */
+
+/**
+ * struct tq - batched linear transform between two queues
+ * @in: payloads to transform, cols floats or more each
+ * @out: results, rows floats or more each
+ * @rows: result floats per payload, rows of W
+ * @cols: payload floats used, columns of W
+ * @weight: W, rows x cols row-major, the stage's own copy
+ * @lda: floats from one payload to the next in @x, in's buffer_width / 4
+ * @ldc: floats from one result to the next in @y, out's buffer_width / 4
+ * @max_batch: most payloads one tq_step takes
+ * @x: room for max_batch payloads, the X matrix
+ * @y: room for max_batch results, the Y matrix
+ * @batches: tq_step calls that found payloads
+ * @items: payloads transformed
+ * @gemm_calls: batches done as one matrix-matrix product
+ * @gemv_calls: single payloads done as one matrix-vector product
+ * @refused: results the output queue turned away
+ */
+typedef struct tq
+{
+    sq_t *in;
+    sq_t *out;
+    size_t rows;
+    size_t cols;
+    float *weight;
+    size_t lda;
+    size_t ldc;
+    size_t max_batch;
+    float *x;
+    float *y;
+    size_t batches;
+    size_t items;
+    size_t gemm_calls;
+    size_t gemv_calls;
+    size_t refused;
+} tq_t;
+
+/* externally visible prototypes */
+tq_t *tq_create(sq_t *in, sq_t *out, const float *weight, size_t rows, size_t cols,
+                size_t max_batch);
+void tq_destroy(tq_t *tqp);
+size_t tq_step(tq_t *tqp);
+void tq_print_stats(FILE *fp, const char *label, const tq_t *tqp);
+
+#endif /* _TQ_H */
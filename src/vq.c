@@ -0,0 +1,263 @@
+/*! \file vq.c
+ *
+ * DRE 2024
+ *
+ * Variable-size payload queue over size-class slabs, see vq.h.
+ */
+
+#include <stdlib.h>     /* aligned_alloc, free */
+#include <string.h>     /* memcpy, memset */
+#include <errno.h>      /* errno, EINVAL, ENOMEM, EAGAIN */
+#include "vq.h"         /* vq_t and external function prototypes */
+
+/// \def VQ_REF packs a class, chunk and slot index into a handle
+#define VQ_REF(c, k, i) (((uint32_t)(c) << (VQ_IDX_BITS + 5)) | ((uint32_t)(k) << VQ_IDX_BITS) | (uint32_t)(i))
+/// \def VQ_REF_CLASS, VQ_REF_CHUNK, VQ_REF_IDX take a handle apart
+#define VQ_REF_CLASS(r) ((r) >> (VQ_IDX_BITS + 5))
+#define VQ_REF_CHUNK(r) (((r) >> VQ_IDX_BITS) & (VQ_MAX_CHUNKS - 1))
+#define VQ_REF_IDX(r) ((r) & ((1u << VQ_IDX_BITS) - 1))
+
+/**
+ * vq_class_of - the smallest class holding len bytes
+ */
+inline static unsigned vq_class_of(size_t len)
+{
+    if (len <= (1u << VQ_MIN_SHIFT))
+        return (0);
+    return ((unsigned)(64 - __builtin_clzll((unsigned long long)(len - 1))) - VQ_MIN_SHIFT);
+}
+
+/**
+ * vq_chunk - chunk k of class c, or NULL if it isn't grown yet
+ */
+inline static slotpool_t *vq_chunk(vq_t *vqp, unsigned c, unsigned k)
+{
+    return (atomic_load_explicit(&vqp->cls[c].chunk[k], memory_order_acquire));
+}
+
+/**
+ * vq_grow - publish chunk k of class c
+ * @vqp: the queue
+ * @c: the class
+ * @k: the chunk, the first NULL one
+ *
+ * The first chunk holds VQ_CHUNK_BYTES, each later one twice the last, up
+ * to what VQ_IDX_BITS can index.  Two threads may grow the same chunk; the
+ * compare-and-swap keeps one and the other is freed.
+ *
+ * Return: the chunk now in place, or NULL if out of memory
+ */
+static slotpool_t *vq_grow(vq_t *vqp, unsigned c, unsigned k)
+{
+    vq_class_t *cls = &vqp->cls[c];
+    slotpool_t *pool, *none = NULL;
+    size_t nslots = VQ_CHUNK_BYTES / cls->width;
+
+    if (nslots == 0)
+        nslots = 1;
+    nslots <<= (k < VQ_IDX_BITS) ? k : VQ_IDX_BITS;
+    if (nslots > (1u << VQ_IDX_BITS))
+        nslots = 1u << VQ_IDX_BITS;
+    pool = slotpool_create_packed(nslots, cls->width);
+    if (pool == NULL)
+        return (NULL);
+    if (!atomic_compare_exchange_strong_explicit(&cls->chunk[k], &none, pool,
+            memory_order_acq_rel, memory_order_acquire))
+    {
+        slotpool_destroy(pool);
+        return (none);
+    }
+    atomic_fetch_add_explicit(&vqp->footprint, nslots * pool->stride, memory_order_relaxed);
+    return (pool);
+}
+
+/**
+ * vq_alloc - take a slot of class c
+ * @vqp: the queue
+ * @c: the class
+ * @refp: return the slot's handle
+ *
+ * Tries the chunks oldest first, so the small early chunks stay the busy
+ * ones, and grows the class only when every chunk is empty.
+ *
+ * Return: the slot, or NULL if the class is out of chunks or memory
+ */
+static void *vq_alloc(vq_t *vqp, unsigned c, uint32_t *refp)
+{
+    slotpool_t *pool;
+    char *slot;
+    unsigned k;
+
+    for (k = 0; k < VQ_MAX_CHUNKS; k++)
+    {
+        if ((pool = vq_chunk(vqp, c, k)) == NULL &&
+            (pool = vq_grow(vqp, c, k)) == NULL)
+            return (NULL);
+        if ((slot = slotpool_get(pool)) != NULL)
+        {
+            *refp = VQ_REF(c, k, (slot - pool->slab) / pool->stride);
+            return (slot);
+        }
+    }
+    return (NULL);
+}
+
+/**
+ * vq_slot - the slot a handle names
+ */
+inline static void *vq_slot(vq_t *vqp, uint32_t ref, slotpool_t **poolp)
+{
+    *poolp = vq_chunk(vqp, VQ_REF_CLASS(ref), VQ_REF_CHUNK(ref));
+    return ((*poolp)->slab + (size_t)VQ_REF_IDX(ref) * (*poolp)->stride);
+}
+
+/**
+ * vq_create - allocate a queue; no slab memory until the first vq_enq
+ * @depth: descriptors in the ring, a power of two as sq_create requires
+ * @max_len: the largest payload, up to 8 << (VQ_MAX_CLASSES - 1) bytes
+ * @policy: what vq_enq does when the ring is full, not SQ_OVERWRITE
+ *
+ * Return: the queue, or NULL with errno set to EINVAL or ENOMEM
+ */
+vq_t *vq_create(size_t depth, size_t max_len, fullpolicy_t policy)
+{
+    vq_t *vqp;
+    unsigned c;
+
+    if (max_len == 0 || policy == SQ_OVERWRITE ||
+        (max_len - 1) >> (VQ_MIN_SHIFT + VQ_MAX_CLASSES - 1) != 0)
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+    vqp = aligned_alloc(CACHE_LINE, SQ_STRIDE(sizeof(vq_t)));
+    if (vqp == NULL)
+    {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    memset(vqp, 0, sizeof(vq_t));
+    vqp->ring = sq_create_policy(depth, sizeof(vq_desc_t), policy);
+    if (vqp->ring == NULL)
+    {
+        free(vqp);
+        return (NULL);
+    }
+    vqp->max_len = max_len;
+    vqp->nclasses = vq_class_of(max_len) + 1;
+    for (c = 0; c < vqp->nclasses; c++)
+        vqp->cls[c].width = (size_t)1 << (VQ_MIN_SHIFT + c);
+    atomic_init(&vqp->footprint, 0);
+    return (vqp);
+}
+
+/**
+ * vq_destroy - free the ring, every slab and the queue
+ * @vqp: the queue, no thread may be using it.  NULL is ignored.
+ *
+ * Payloads still queued go with their slabs.
+ */
+void vq_destroy(vq_t *vqp)
+{
+    unsigned c, k;
+
+    if (vqp == NULL)
+        return;
+    for (c = 0; c < vqp->nclasses; c++)
+        for (k = 0; k < VQ_MAX_CHUNKS; k++)
+            slotpool_destroy(vq_chunk(vqp, c, k));
+    sq_destroy(vqp->ring);
+    free(vqp);
+}
+
+/**
+ * vq_set_mode - set the ring's lock, before the first vq_enq
+ * @vqp: the queue
+ * @mode: any lockmode_t; LOCK_FREE needs one producer and one consumer
+ */
+void vq_set_mode(vq_t *vqp, lockmode_t mode)
+{
+    vqp->ring->mode = mode;
+}
+
+/**
+ * vq_enq - copy a payload into its size class and queue its descriptor
+ * @vqp: the queue
+ * @src: the payload
+ * @len: its bytes, 1 to max_len
+ *
+ * The descriptor goes through q_enq_bulk, which publishes the slot
+ * contents with it.  When the ring's policy turns it away the slot goes
+ * straight back.
+ *
+ * Return: 0, or -1 with errno set to EINVAL for a bad len, ENOMEM when the
+ * class can't grow, or EAGAIN when the full ring refused the payload
+ */
+int vq_enq(vq_t *vqp, const void *src, size_t len)
+{
+    vq_desc_t d;
+    slotpool_t *pool;
+    void *slot;
+
+    if (len == 0 || len > vqp->max_len)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+    slot = vq_alloc(vqp, vq_class_of(len), &d.ref);
+    if (slot == NULL)
+    {
+        errno = ENOMEM;
+        return (-1);
+    }
+    memcpy(slot, src, len);
+    d.len = (uint32_t)len;
+    if (q_enq_bulk(vqp->ring, &d, 1) == 0)
+    {
+        vq_slot(vqp, d.ref, &pool);
+        slotpool_put(pool, slot);
+        errno = EAGAIN;
+        return (-1);
+    }
+    return (0);
+}
+
+/**
+ * vq_deq - dequeue the oldest payload and give its slot back
+ * @vqp: the queue
+ * @dst: room for the payload
+ * @room: bytes at dst, max_len always suffices
+ *
+ * A payload longer than room is cut to room bytes; the return value still
+ * says how long it was.
+ *
+ * Return: the payload's length, or -1 if the queue was empty
+ */
+ssize_t vq_deq(vq_t *vqp, void *dst, size_t room)
+{
+    vq_desc_t d;
+    slotpool_t *pool;
+    void *slot;
+
+    if (q_deq_bulk(vqp->ring, &d, 1) == 0)
+        return (-1);
+    slot = vq_slot(vqp, d.ref, &pool);
+    memcpy(dst, slot, d.len < room ? d.len : room);
+    slotpool_put(pool, slot);
+    return ((ssize_t)d.len);
+}
+
+/**
+ * vq_footprint - bytes the queue holds: its ring and every class's slabs
+ * @vqp: the queue
+ *
+ * The ring is fixed at depth cache-line slots and their sequence numbers.
+ * Chunks are never given back while the queue exists, so the slab part is
+ * the high-water mark of what the payloads needed, plus the doubling slack.
+ */
+size_t vq_footprint(vq_t *vqp)
+{
+    size_t ring = vqp->ring->store.max * (vqp->ring->stride + sizeof(uint64_t));
+
+    return (ring + atomic_load_explicit(&vqp->footprint, memory_order_relaxed));
+}
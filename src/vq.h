@@ -0,0 +1,107 @@
+/*! \file vq.h
+ *
+ * DRE 2024
+ *
+ * Variable-size payload queue: an sq_t of small descriptors, the payloads
+ * in power-of-two size-class slabs.
+ *
+ * Every sq_t slot is as wide as the largest payload it may carry, so a
+ * queue of mostly 8 byte messages with the odd 4 KB one spends 4 KB per
+ * slot.  A vq_t queues only a vq_desc_t, the length and a 32-bit handle,
+ * and copies the payload into the smallest class that holds it:
+ *
+ * - Class c holds 8 << c bytes, from 8 bytes up to max_len rounded up to a
+ *   power of two.  Its slots are packed (slotpool_create_packed), so eight
+ *   8 byte messages share one cache line.
+ * - A class starts with no memory.  Its slab grows by chunks, the first
+ *   VQ_CHUNK_BYTES and each one twice the last, when every slot it has is
+ *   in use, so the footprint follows the sizes actually queued.
+ * - Allocation is lock-free: each chunk is a slotpool Treiber stack, and a
+ *   new chunk is published with one compare-and-swap; a thread that loses
+ *   the race frees its own and uses the winner's.
+ * - The handle packs class, chunk and slot index, so the descriptor stays
+ *   8 bytes and the slot address is arithmetic on the chunk's slab.
+ *
+ * The descriptors themselves are not packed: the ring is an sq_t, whose
+ * slots are SQ_STRIDE wide so that producer and consumer never share a
+ * line, and an 8 byte vq_desc_t takes a whole 64 byte slot plus its
+ * sequence number.  That fixed depth x 72 bytes is the price of not
+ * sharing lines; for 8 byte messages it is most of the cost, 72 of every
+ * 80 bytes.  vq_footprint counts it with the slabs, so it compares fairly
+ * with a plain sq_t of max_len slots, which pays depth x (SQ_STRIDE(max_len)
+ * + 8).
+ *
+ * The ring keeps its lock mode, and its full policy decides what vq_enq
+ * does when it is full.  SQ_OVERWRITE can't be used: the descriptor it
+ * overwrote would leak its slot.  For the same reason the ring gets no TTL.
+ */
+
+#ifndef _VQ_H
+#define _VQ_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint32_t */
+#include <stdatomic.h>  /* atomic_ operations */
+#include <sys/types.h>  /* ssize_t */
+#include "vringbuffer.h" /* sq_t, lockmode_t, fullpolicy_t */
+#include "slotpool.h"   /* slotpool_t */
+
+/// \def VQ_MIN_SHIFT class 0 holds 1 << VQ_MIN_SHIFT bytes
+#define VQ_MIN_SHIFT 3
+/// \def VQ_MAX_CLASSES bounds max_len at 8 << 23, 64 MB
+#define VQ_MAX_CLASSES 24
+/// \def VQ_MAX_CHUNKS chunks per class, a handle has 5 bits for the chunk
+#define VQ_MAX_CHUNKS 32
+/// \def VQ_IDX_BITS slot index bits of a handle, bounds the slots per chunk
+#define VQ_IDX_BITS 22
+/// \def VQ_CHUNK_BYTES bytes in a class's first chunk, at least one slot
+#define VQ_CHUNK_BYTES 4096
+
+/**
+ * struct vq_desc - what the ring carries for each payload
+ * @len: payload bytes
+ * @ref: class, chunk and slot index of the payload
+ */
+typedef struct vq_desc
+{
+    uint32_t len;
+    uint32_t ref;
+} vq_desc_t;
+
+/**
+ * struct vq_class - one size class
+ * @width: bytes per slot
+ * @chunk: the slabs, NULL past the last one grown
+ */
+typedef struct vq_class
+{
+    size_t width;
+    _Atomic(slotpool_t *) chunk[VQ_MAX_CHUNKS];
+} vq_class_t;
+
+/**
+ * struct vq - variable-size payload queue
+ * @ring: the descriptors, in order
+ * @max_len: the largest payload vq_enq takes
+ * @nclasses: classes in use, the last one holds max_len
+ * @footprint: slab bytes allocated over every class
+ * @cls: the size classes
+ */
+typedef struct vq
+{
+    sq_t *ring;
+    size_t max_len;
+    unsigned nclasses;
+    atomic_size_t footprint;
+    vq_class_t cls[VQ_MAX_CLASSES];
+} vq_t;
+
+/* externally visible prototypes */
+vq_t *vq_create(size_t depth, size_t max_len, fullpolicy_t policy);
+void vq_destroy(vq_t *vqp);
+void vq_set_mode(vq_t *vqp, lockmode_t mode);
+int vq_enq(vq_t *vqp, const void *src, size_t len);
+ssize_t vq_deq(vq_t *vqp, void *dst, size_t room);
+size_t vq_footprint(vq_t *vqp);
+
+#endif /* _VQ_H */
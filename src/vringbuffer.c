@@ -0,0 +1,1365 @@
+/*! \file vringbuffer.c
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ * Copyright (C) 2005-2022 Dahetral Systems
+ * Author: David Turvene (dturvene@gmail.com)
+ *
+ * DRE 2024 - the varied slot ringbuffer, see vringbuffer.h.  Moved out of
+ * ringbuffer-varied.c, which keeps the payload type and the test pthreads.
+ */
+
+#include <stdlib.h>     /* aligned_alloc, free, exit, EXIT_FAILURE */
+#include <stdio.h>      /* char I/O, perror */
+#include <string.h>     /* memcpy, memset */
+#include <errno.h>      /* errno, EINVAL, EBUSY, EAGAIN */
+#include "config.h"     /* meson generated configuration file */
+#include "logevt.h"     /* event logging */
+#include "sqtrace.h"    /* SQ_TRACE_ tracepoints */
+#include "vringbuffer.h" /* sq_t and external function prototypes */
+
+#define LOCK_C 0x01
+#define LOCK_P 0x02
+
+/**
+ * die - helper function to stop immediately
+ * @msg - an informational string to identify where program failed
+ *
+ * See man:perror
+ */
+inline static void die(const char* msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * sq_store_alloc - allocate the slab and arrays of a store
+ * @st: the store, its fields all set here
+ * @depth: number of slots, a power of two
+ * @stride: bytes per slot, a whole number of cache lines
+ * @deadlines: allocate the deadline array too, every slot SQ_NEVER
+ *
+ * Return: 0, or -1 with errno set to ENOMEM and nothing allocated
+ */
+static int sq_store_alloc(sq_store_t *st, size_t depth, size_t stride, bool deadlines)
+{
+    size_t i;
+
+    st->max = depth;
+    st->mask = depth - 1;
+    // one aligned allocation for every slot, the size is a multiple of the alignment as aligned_alloc requires
+    st->slab = aligned_alloc( CACHE_LINE, depth * stride );
+    st->seq = aligned_alloc( CACHE_LINE, SQ_STRIDE(depth * sizeof(uint64_t)) );
+    st->deadline = deadlines ? aligned_alloc( CACHE_LINE, SQ_STRIDE(depth * sizeof(uint64_t)) ) : NULL;
+    if (st->slab == NULL || st->seq == NULL || (deadlines && st->deadline == NULL))
+    {
+        free(st->slab);
+        free(st->seq);
+        free(st->deadline);
+        st->slab = NULL;
+        errno = ENOMEM;
+        return (-1);
+    }
+    // clear
+    memset( st->slab, 0, depth * stride );
+    for (i = 0; deadlines && i < depth; i++)
+        st->deadline[i] = SQ_NEVER;
+    return (0);
+}
+
+/**
+ * sq_store_free - free a store's slab and arrays
+ * @st: the store, slab NULL afterwards
+ */
+static void sq_store_free(sq_store_t *st)
+{
+    free(st->deadline);
+    free(st->seq);
+    free(st->slab); /// de allocate
+    st->slab = NULL;
+}
+
+/**
+ * sq_create - allocate a queue and its slab
+ * @depth: number of slots, a power of two so indices wrap with a mask
+ * @width: payload bytes copied in and out of each slot
+ *
+ * An SQ_OVERWRITE queue, see sq_create_policy.
+ */
+sq_t *sq_create(size_t depth, size_t width)
+{
+    return (sq_create_policy(depth, width, SQ_OVERWRITE));
+}
+
+/**
+ * sq_create_policy - allocate a queue and its slab with a full policy
+ * @depth: number of slots, a power of two so indices wrap with a mask
+ * @width: payload bytes copied in and out of each slot
+ * @policy: what an enqueue does when the ring is full
+ *
+ * Each slot is width bytes rounded up to whole cache lines.  The queue
+ * starts empty, in LOCK_SPIN mode with logging off and no debug callback.
+ *
+ * Return: the queue, or NULL with errno set to EINVAL for a zero width, a
+ * depth that is not a power of two or an unknown policy, or ENOMEM
+ */
+sq_t *sq_create_policy(size_t depth, size_t width, fullpolicy_t policy)
+{
+    sq_t *sqp;
+
+    if (width == 0 || depth == 0 || (depth & (depth - 1)) != 0 || policy >= SQ_POLICIES)
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+    /* the struct is aligned too so head and tail really get their own lines */
+    sqp = aligned_alloc( CACHE_LINE, SQ_STRIDE(sizeof(sq_t)) );
+    if (sqp == NULL)
+        return (NULL);
+    memset( sqp, 0, sizeof(sq_t) );
+    sqp->buffer_width = width;
+    sqp->stride = SQ_STRIDE(width);
+    if (sq_store_alloc(&sqp->store, depth, sqp->stride, false) != 0)
+    {
+        free(sqp);
+        return (NULL);
+    }
+    sqlock_init(&sqp->lock);
+    atomic_init(&sqp->head, 0);
+    atomic_init(&sqp->tail, 0);
+    atomic_init(&sqp->gen, 0);
+    atomic_init(&sqp->resize, SQ_RESIZE_IDLE);
+    atomic_init(&sqp->resize_at, 0);
+    sqp->mode = LOCK_SPIN;
+    sqp->policy = policy;
+    return (sqp);
+}
+
+/**
+ * sq_destroy - free the slab and the queue, every slot goes with it
+ * @sqp: the queue, no thread may be using it.  NULL is ignored.
+ *
+ * A resize still under way goes too.  Once the consumer has made next the
+ * store they share a slab, so next is only freed before that.
+ */
+void sq_destroy(sq_t *sqp)
+{
+    sqresize_t rs;
+
+    if (sqp == NULL)
+        return;
+    sqlock_destroy(&sqp->lock);
+    rs = atomic_load(&sqp->resize);
+    if (rs == SQ_RESIZE_PENDING || rs == SQ_RESIZE_SWITCHED)
+        sq_store_free(&sqp->next);
+    if (sqp->old.slab != NULL)
+        sq_store_free(&sqp->old);
+    sq_store_free(&sqp->store);
+    free(sqp);
+}
+
+/**
+ * sq_set_ttl - give every payload a deadline, dropped unread once it passes
+ * @sqp: the queue, before the first enqueue
+ * @ttl_ns: q_enq and q_enq_bulk payloads expire this many nanoseconds after
+ *          they are queued; 0 and they never do, only q_enq_by deadlines
+ *
+ * The first call allocates the deadline array, one uint64_t per slot.
+ * Later calls only change the TTL.
+ *
+ * Return: 0, or -1 with errno set to ENOMEM
+ */
+int sq_set_ttl(sq_t *sqp, uint64_t ttl_ns)
+{
+    sq_store_t *st = &sqp->store;
+    size_t i;
+
+    if (st->deadline == NULL)
+    {
+        st->deadline = aligned_alloc( CACHE_LINE, SQ_STRIDE(st->max * sizeof(uint64_t)) );
+        if (st->deadline == NULL)
+        {
+            errno = ENOMEM;
+            return (-1);
+        }
+        for (i = 0; i < st->max; i++)
+            st->deadline[i] = SQ_NEVER;
+    }
+    sqp->ttl_ns = ttl_ns;
+    return (0);
+}
+
+/**
+ * q_reset - empty the queue between test runs
+ * @sqp: the simple queue context structure, no thread may be using it
+ *
+ * A resize still under way is finished on the spot: with nothing queued
+ * there is nothing left to migrate or drain.
+ */
+void q_reset(sq_t* sqp)
+{
+    sqresize_t rs = atomic_load(&sqp->resize);
+
+    if (rs == SQ_RESIZE_PENDING || rs == SQ_RESIZE_SWITCHED)
+    {
+        sq_store_free(&sqp->store);
+        sqp->store = sqp->next;
+    }
+    atomic_store(&sqp->resize, SQ_RESIZE_IDLE);
+    if (sqp->old.slab != NULL)
+        sq_store_free(&sqp->old);
+    sqp->enq = 0;
+    sqp->deq = 0;
+    sqp->count = 0;
+    sqp->max_entries = 0;
+    sqp->enq_seq = 0;
+    sqp->overwritten = 0;
+    sqp->dropped = 0;
+    sqp->rejected = 0;
+    sqp->deq_seq = 0;
+    sqp->lost = 0;
+    sqp->expired = 0;
+    sqp->held = false;
+    sqlock_reset_stats(&sqp->lock);
+    atomic_store(&sqp->head, 0);
+    atomic_store(&sqp->tail, 0);
+}
+
+/**
+ * q_print: display the all bufs in the queue
+ * @label: an informational string used to identify the queue state
+ * @sqp: the simple queue context structure
+ *
+ * Walk the slab from the first slot to the last
+ * and print each element value with the cb callback, if one is set
+ */
+void q_print(const char* label, const sq_t* sqp)
+{
+    size_t i;
+
+    printf("%s count=%zu slab=%p enq=%zu deq=%zu expired=%zu\n", label, sqp->count, sqp->store.slab, sqp->enq, sqp->deq, sqp->expired);
+    for (i = 0; sqp->cb && i < sqp->store.max; i++)
+    {
+        sqp->cb(SQ_BUF(sqp, i));// now works with latest modifications...
+    }
+    printf("\n");
+}
+
+/**
+ * q_count - how many payloads are queued, without taking the lock
+ * @sqp: the simple queue context structure
+ *
+ * A snapshot for deciding where to look, not a promise: the count can
+ * change as soon as it is read.  In LOCK_FREE mode tail is read before
+ * head so the difference never goes negative.
+ */
+size_t q_count(sq_t* sqp)
+{
+    size_t tail;
+
+    if (sqp->mode == LOCK_FREE)
+    {
+        tail = atomic_load_explicit(&sqp->tail, memory_order_acquire);
+        return (atomic_load_explicit(&sqp->head, memory_order_acquire) - tail);
+    }
+    return (__atomic_load_n(&sqp->count, __ATOMIC_RELAXED));
+}
+
+/**
+ * q_lock, q_unlock - take and drop the queue's lock for its mode
+ * @sqp: the simple queue context structure, not in LOCK_FREE mode
+ * @desired: LOCK_P or LOCK_C, the spinlock holder bit
+ */
+inline static void q_lock(sq_t *sqp, uint32_t desired)
+{
+    sqlock_acquire(&sqp->lock, sqp->mode, desired);
+}
+
+inline static void q_unlock(sq_t *sqp)
+{
+    sqlock_release(&sqp->lock, sqp->mode);
+}
+
+/**
+ * sq_resize - move a live queue to a new store of depth slots
+ * @sqp: the queue, producers and consumers may keep going
+ * @depth: the new number of slots, a power of two
+ *
+ * The new store is allocated first, outside any lock.  In the locked modes
+ * it is installed under the lock with the queued payloads' places reserved
+ * at its start, which costs no copying; the q_* calls that follow migrate
+ * the payloads in steps, see sq_t.  A shrink below what is queued now
+ * fails there, try again once the consumers have caught up.  In LOCK_FREE
+ * mode the producer switches on its next enqueue and waits while more is
+ * queued than the new store holds, as on any full ring.
+ *
+ * Return: 0, or -1 with errno set to EINVAL for a bad depth, EBUSY while
+ * the last resize is still under way, the queue holds more than depth or,
+ * locked modes, a q_deq_peek payload is held, or ENOMEM
+ */
+int sq_resize(sq_t *sqp, size_t depth)
+{
+    sqresize_t idle = SQ_RESIZE_IDLE;
+    sq_store_t st;
+
+    if (depth == 0 || (depth & (depth - 1)) != 0)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+    if (sqp->mode == LOCK_FREE)
+    {
+        if (!atomic_compare_exchange_strong(&sqp->resize, &idle, SQ_RESIZE_PREPARING))
+        {
+            errno = EBUSY;
+            return (-1);
+        }
+        if (sq_store_alloc(&sqp->next, depth, sqp->stride, sqp->store.deadline != NULL) != 0)
+        {
+            atomic_store(&sqp->resize, SQ_RESIZE_IDLE);
+            return (-1);
+        }
+        atomic_fetch_add(&sqp->gen, 1);
+        atomic_store_explicit(&sqp->resize, SQ_RESIZE_PENDING, memory_order_release);
+        return (0);
+    }
+    if (sq_store_alloc(&st, depth, sqp->stride, sqp->store.deadline != NULL) != 0)
+        return (-1);
+    q_lock(sqp, LOCK_P);
+    /* a held payload would be migrated, or freed with old, under its consumer */
+    if (sqp->old.slab != NULL || sqp->count > depth || sqp->held)
+    {
+        q_unlock(sqp);
+        sq_store_free(&st);
+        errno = EBUSY;
+        return (-1);
+    }
+    sqp->old = sqp->store;
+    sqp->store = st;
+    sqp->mig_from = sqp->deq;
+    sqp->mig = 0;
+    sqp->mig_n = sqp->count;
+    sqp->deq = 0;
+    sqp->enq = sqp->count & st.mask;
+    if (sqp->mig_n == 0)
+        sq_store_free(&sqp->old);
+    atomic_fetch_add(&sqp->gen, 1);
+    q_unlock(sqp);
+    return (0);
+}
+
+/**
+ * q_deadline - the deadline q_enq gives a payload queued now
+ * @sqp: the simple queue context structure
+ *
+ * Reads the clock only when the queue has a TTL.
+ */
+inline static uint64_t q_deadline(const sq_t *sqp)
+{
+    return ((sqp->store.deadline != NULL && sqp->ttl_ns != 0) ? sq_clock_ns() + sqp->ttl_ns : SQ_NEVER);
+}
+
+/**
+ * q_stamp - set the deadline of k slots from idx on, wrapping
+ * @st: the store
+ * @idx: first slot, already masked
+ * @k: number of slots, at most max
+ * @deadline: sq_clock_ns time the payloads expire, or SQ_NEVER
+ */
+inline static void q_stamp(sq_store_t *st, size_t idx, size_t k, uint64_t deadline)
+{
+    size_t i;
+
+    if (st->deadline == NULL)
+        return;
+    for (i = 0; i < k; i++)
+        st->deadline[(idx + i) & st->mask] = deadline;
+}
+
+/**
+ * q_expire - count the expired payloads at the head of the queue
+ * @st: the store holding them
+ * @idx: the oldest slot, already masked
+ * @avail: payloads queued from idx on
+ *
+ * One clock read, then only the deadline array: the payloads themselves
+ * are never touched, let alone copied.
+ *
+ * Return: how many of the oldest payloads are past their deadline
+ */
+static size_t q_expire(const sq_store_t *st, size_t idx, size_t avail)
+{
+    uint64_t now;
+    size_t k = 0;
+
+    if (st->deadline == NULL || avail == 0 || st->deadline[idx] == SQ_NEVER)
+        return (0);
+    now = sq_clock_ns();
+    while (k < avail && st->deadline[(idx + k) & st->mask] <= now)
+        k++;
+    return (k);
+}
+
+/**
+ * q_drop_expired - drop the expired payloads at the head, locked modes
+ * @sqp: the simple queue context structure, locked
+ *
+ * deq jumps past the whole stale run at once.  While sq_resize is
+ * migrating only the payloads already moved are looked at.
+ */
+static void q_drop_expired(sq_t *sqp)
+{
+    size_t avail = sqp->old.slab != NULL ? sqp->mig - sqp->deq : sqp->count;
+    size_t k = q_expire(&sqp->store, sqp->deq, avail);
+
+    if (k == 0)
+        return;
+    sqp->deq = (sqp->deq + k) & sqp->store.mask;
+    sqp->count -= k;
+    sqp->expired += k;
+    if (sqp->log)
+        evt_enq(EVT_EXPIRE, k);
+}
+
+/**
+ * q_number - give k slots from idx on the next sequence numbers, wrapping
+ * @sqp: the simple queue context structure, producer side
+ * @st: the store
+ * @idx: first slot, already masked
+ * @k: number of slots, at most max
+ */
+inline static void q_number(sq_t *sqp, sq_store_t *st, size_t idx, size_t k)
+{
+    size_t i;
+
+    for (i = 0; i < k; i++)
+        st->seq[(idx + i) & st->mask] = sqp->enq_seq++;
+}
+
+/**
+ * q_seen - account for k payloads dequeued in a row, consumer side
+ * @sqp: the simple queue context structure
+ * @last: the sequence number of the last of them
+ * @k: how many
+ *
+ * Whatever lies between deq_seq and last and wasn't among the k was
+ * overwritten, dropped or expired before a consumer got to it.
+ */
+inline static void q_seen(sq_t *sqp, uint64_t last, size_t k)
+{
+    sqp->lost += (size_t)(last + 1 - sqp->deq_seq) - k;
+    sqp->deq_seq = last + 1;
+}
+
+/**
+ * q_refuse - a payload found the ring full under SQ_FAIL or SQ_DROP_NEWEST
+ * @sqp: the simple queue context structure, producer side
+ * @n: number of payloads turned away
+ *
+ * A dropped payload uses up its sequence number so the gap shows up at the
+ * consumer; a refused one was never accepted, the caller still has it.
+ */
+inline static void q_refuse(sq_t *sqp, size_t n)
+{
+    if (sqp->policy == SQ_DROP_NEWEST)
+    {
+        sqp->enq_seq += n;
+        sqp->dropped += n;
+    }
+    else
+        sqp->rejected += n;
+}
+
+/**
+ * q_copy_in - copy k payloads into the slots from idx on, wrapping once
+ * @sqp: the simple queue context structure
+ * @st: the store
+ * @idx: first slot, already masked
+ * @src: k payloads packed buffer_width apart
+ * @k: number of payloads, at most max
+ *
+ * At most two contiguous runs of slots, before and after the wrap.  When
+ * the slot stride equals the payload width a run is a single memcpy.
+ */
+static void q_copy_in(sq_t *sqp, sq_store_t *st, size_t idx, const char *src, size_t k)
+{
+    size_t run, i;
+
+    while (k > 0)
+    {
+        run = st->max - idx;
+        if (run > k)
+            run = k;
+        if (sqp->stride == sqp->buffer_width)
+            memcpy( SQ_AT(sqp, st, idx), src, run * sqp->buffer_width );
+        else
+        {
+            for (i = 0; i < run; i++)
+                memcpy( SQ_AT(sqp, st, idx + i), src + i * sqp->buffer_width, sqp->buffer_width );
+        }
+        src += run * sqp->buffer_width;
+        k -= run;
+        idx = 0;
+    }
+}
+
+/**
+ * q_copy_out - copy k payloads out of the slots from idx on, wrapping once
+ * @sqp: the simple queue context structure
+ * @st: the store
+ * @idx: first slot, already masked
+ * @dst: room for k payloads packed buffer_width apart
+ * @k: number of payloads, at most max
+ *
+ * Mirror of q_copy_in.
+ */
+static void q_copy_out(sq_t *sqp, const sq_store_t *st, size_t idx, char *dst, size_t k)
+{
+    size_t run, i;
+
+    while (k > 0)
+    {
+        run = st->max - idx;
+        if (run > k)
+            run = k;
+        if (sqp->stride == sqp->buffer_width)
+            memcpy( dst, SQ_AT(sqp, st, idx), run * sqp->buffer_width );
+        else
+        {
+            for (i = 0; i < run; i++)
+                memcpy( dst + i * sqp->buffer_width, SQ_AT(sqp, st, idx + i), sqp->buffer_width );
+        }
+        dst += run * sqp->buffer_width;
+        k -= run;
+        idx = 0;
+    }
+}
+
+/**
+ * q_migrate - move queued payloads to the store sq_resize installed, locked modes
+ * @sqp: the simple queue context structure, locked
+ * @upto: move the payloads that go below this slot of the new store
+ *
+ * The payloads queued at sq_resize go to slots 0 to mig_n - 1 of the new
+ * store, oldest first, with their sequence numbers and deadlines.  Those
+ * below deq were overwritten or expired before their turn and are skipped.
+ * The last one moved frees old: every other use of it is under this lock.
+ */
+static void q_migrate(sq_t *sqp, size_t upto)
+{
+    sq_store_t *old = &sqp->old, *st = &sqp->store;
+    size_t from;
+
+    if (old->slab == NULL)
+        return;
+    if (upto > sqp->mig_n)
+        upto = sqp->mig_n;
+    if (sqp->mig < sqp->deq)
+        sqp->mig = sqp->deq;
+    for (; sqp->mig < upto; sqp->mig++)
+    {
+        from = (sqp->mig_from + sqp->mig) & old->mask;
+        memcpy( SQ_AT(sqp, st, sqp->mig), SQ_AT(sqp, old, from), sqp->buffer_width );
+        st->seq[sqp->mig] = old->seq[from];
+        if (st->deadline != NULL)
+            st->deadline[sqp->mig] = old->deadline != NULL ? old->deadline[from] : SQ_NEVER;
+    }
+    if (sqp->mig == sqp->mig_n)
+        sq_store_free(old);
+}
+
+/**
+ * q_migrate_step - the share of a migration every locked q_* call does
+ * @sqp: the simple queue context structure, locked
+ * @need: slots from deq on the caller is about to read or overwrite
+ *
+ * SQ_MIGRATE_STEP more payloads, or as many as the caller needs if that
+ * is more, so the copying is spread over the calls that follow a resize.
+ */
+inline static void q_migrate_step(sq_t *sqp, size_t need)
+{
+    size_t upto;
+
+    if (sqp->old.slab == NULL)
+        return;
+    upto = (sqp->mig > sqp->deq ? sqp->mig : sqp->deq) + SQ_MIGRATE_STEP;
+    if (upto < sqp->deq + need)
+        upto = sqp->deq + need;
+    q_migrate(sqp, upto);
+}
+
+/**
+ * q_ready_head - get the oldest payloads ready for a consumer, locked modes
+ * @sqp: the simple queue context structure, locked
+ * @need: payloads the consumer wants to read
+ *
+ * Migrated first, so their deadlines can be checked, and then the expired
+ * ones dropped, which may bring unmigrated payloads to the head.
+ */
+static void q_ready_head(sq_t *sqp, size_t need)
+{
+    size_t deq = sqp->deq;
+
+    q_migrate_step(sqp, need);
+    q_drop_expired(sqp);
+    if (sqp->deq != deq)
+        q_migrate_step(sqp, need);
+}
+
+/**
+ * q_producer_store - the store the lock-free producer writes at head
+ * @sqp: the simple queue context structure
+ * @head: the producer's head
+ *
+ * Moves a LOCK_FREE resize on from the producer's side: a pending next is
+ * switched to here, with head as resize_at, and a drained one goes idle.
+ * Both happen at the start of an enqueue, so afterwards the producer never
+ * touches the store it left.
+ */
+static sq_store_t *q_producer_store(sq_t *sqp, size_t head)
+{
+    switch (atomic_load_explicit(&sqp->resize, memory_order_acquire))
+    {
+    case SQ_RESIZE_PENDING:
+        atomic_store_explicit(&sqp->resize_at, head, memory_order_relaxed);
+        atomic_store_explicit(&sqp->resize, SQ_RESIZE_SWITCHED, memory_order_release);
+        return (&sqp->next);
+    case SQ_RESIZE_SWITCHED:
+        return (&sqp->next);
+    case SQ_RESIZE_DRAINED:
+        atomic_store_explicit(&sqp->resize, SQ_RESIZE_IDLE, memory_order_release);
+        return (&sqp->store);
+    default:
+        return (&sqp->store);
+    }
+}
+
+/**
+ * q_consumer_store - the store the lock-free consumer reads at tail
+ * @sqp: the simple queue context structure
+ * @tail: the consumer's tail
+ * @headp: the head it loaded, lowered to resize_at while that is ahead
+ *
+ * Load head before calling: a producer that switched before publishing
+ * that head has stored SWITCHED before it too.  Below resize_at the
+ * payloads are still in the old store.  Once tail reaches it the producer
+ * is long gone from the old store, so it is freed here and next becomes
+ * the store.
+ */
+static sq_store_t *q_consumer_store(sq_t *sqp, size_t tail, size_t *headp)
+{
+    size_t at;
+
+    if (atomic_load_explicit(&sqp->resize, memory_order_acquire) != SQ_RESIZE_SWITCHED)
+        return (&sqp->store);
+    at = atomic_load_explicit(&sqp->resize_at, memory_order_relaxed);
+    if (tail < at)
+    {
+        if (*headp > at)
+            *headp = at;
+        return (&sqp->store);
+    }
+    sq_store_free(&sqp->store);
+    sqp->store = sqp->next;
+    atomic_store_explicit(&sqp->resize, SQ_RESIZE_DRAINED, memory_order_release);
+    return (&sqp->store);
+}
+
+/**
+ * q_enq_lockfree: lock-free enqueue, the producer half of LOCK_FREE mode
+ * @sqp: the simple queue context structure
+ * @val: value to enter into the next bufs element
+ * @deadline: when the payload expires, see q_enq_by
+ *
+ * Only the producer writes head and only the consumer writes tail, so
+ * neither needs a lock:
+ * - load our own head relaxed, the consumer's tail with acquire so the slot
+ *   it last released is really free
+ * - fill the slot, then publish it with a release store of head
+ *
+ * The producer can't overwrite the oldest element here the way the locked
+ * q_enq does because that would mean moving the consumer's deq.  When the
+ * ring is full SQ_OVERWRITE and SQ_BLOCK wait for the consumer instead.
+ *
+ * Return: 0, or -1 if SQ_FAIL or SQ_DROP_NEWEST turned the payload away
+ */
+static int q_enq_lockfree(sq_t* sqp, buf_t val, uint64_t deadline)
+{
+    size_t head = atomic_load_explicit(&sqp->head, memory_order_relaxed);
+    sq_store_t *st = q_producer_store(sqp, head);
+    size_t used;
+    uint32_t spins = 0;
+
+    /* >= since a shrink may leave more queued than the new store holds */
+    while ((used = head - atomic_load_explicit(&sqp->tail, memory_order_acquire)) >= st->max)
+    {
+        if (spins == 0)
+            SQ_TRACE_FULL(sqp, sqp->policy);
+        if (sqp->policy == SQ_FAIL || sqp->policy == SQ_DROP_NEWEST)
+        {
+            q_refuse(sqp, 1);
+            return (-1);
+        }
+        spin_wait(&spins);
+    }
+    memcpy( SQ_AT(sqp, st, head & st->mask), val, sqp->buffer_width );
+    q_stamp(st, head & st->mask, 1, deadline);
+    q_number(sqp, st, head & st->mask, 1);
+    atomic_store_explicit(&sqp->head, head + 1, memory_order_release);
+
+    /// high-water mark - only the producer writes it
+    if ( sqp->max_entries < used + 1 )
+    {
+        sqp->max_entries = used + 1;
+        if (sqp->log)
+            evt_enq(EVT_MAX_QUEUE, sqp->max_entries);
+    }
+    SQ_TRACE_ENQ(sqp, 1, used + 1);
+    if (sqp->log)
+        evt_enq(EVT_ENQ, used + 1);
+    return (0);
+}
+
+/**
+ * q_deq_lockfree: lock-free dequeue, the consumer half of LOCK_FREE mode
+ * @sqp: the simple queue context structure
+ * @valp: return the value in the oldest bufs element
+ * @seqp: return its sequence number, may be NULL
+ *
+ * Mirror of q_enq_lockfree: acquire the producer's head, copy the slot out,
+ * then hand it back with a release store of tail.  Expired payloads at the
+ * head are handed back first, in the same store, without being copied.
+ *
+ * Return:
+ *   0 for success, -1 if the queue is empty
+ */
+static int q_deq_lockfree(sq_t* sqp, buf_t* valp, uint64_t *seqp)
+{
+    uint64_t seq;
+    size_t tail = atomic_load_explicit(&sqp->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&sqp->head, memory_order_acquire);
+    sq_store_t *st;
+    size_t k;
+
+    if (sqp->held)
+        return (-1);
+    st = q_consumer_store(sqp, tail, &head);
+    k = q_expire(st, tail & st->mask, head - tail);
+    if (k > 0)
+    {
+        sqp->expired += k;
+        if (sqp->log)
+            evt_enq(EVT_EXPIRE, k);
+        tail += k;
+        if (tail == head)
+        {
+            atomic_store_explicit(&sqp->tail, tail, memory_order_release);
+            SQ_TRACE_EMPTY(sqp);
+            return (-1);
+        }
+    }
+    if (tail == head)
+    {
+        SQ_TRACE_EMPTY(sqp);
+        return (-1);
+    }
+    memcpy( *valp, SQ_AT(sqp, st, tail & st->mask), sqp->buffer_width );
+    seq = st->seq[tail & st->mask];
+    atomic_store_explicit(&sqp->tail, tail + 1, memory_order_release);
+    q_seen(sqp, seq, 1);
+    if (seqp != NULL)
+        *seqp = seq;
+    SQ_TRACE_DEQ(sqp, 1, head - tail - 1);
+    if (sqp->log)
+        evt_enq(EVT_DEQ, head - tail - 1);
+    return (0);
+}
+
+/**
+ * q_enq: enqueue a new value into the oldest ringbuffer element
+ * @sqp: the simple queue context structure
+ * @val: value to enter into current bufs element
+ *
+ * With a TTL set (sq_set_ttl) the payload expires ttl_ns from now.
+ *
+ * Return: 0, or -1 if the ring was full and the policy turned it away
+ */
+int q_enq(sq_t* sqp, buf_t val)
+{
+    return (q_enq_by(sqp, val, q_deadline(sqp)));
+}
+
+/**
+ * q_must_wait - a full ring the producer may not overwrite, locked modes
+ * @sqp: the simple queue context structure, locked by the producer
+ *
+ * Any policy but SQ_OVERWRITE, and SQ_OVERWRITE too while the oldest
+ * payload is held by q_deq_peek.
+ */
+inline static bool q_must_wait(const sq_t *sqp)
+{
+    return (sqp->count == sqp->store.max && (sqp->policy != SQ_OVERWRITE || sqp->held));
+}
+
+/**
+ * q_wait_room - SQ_BLOCK: wait for a free slot, locked modes
+ * @sqp: the simple queue context structure, locked by the producer
+ *
+ * The lock is dropped while waiting so a consumer can take it, and held
+ * again on return with count below max, or with SQ_OVERWRITE free to
+ * overwrite again.
+ */
+static void q_wait_room(sq_t *sqp)
+{
+    uint32_t spins = 0;
+
+    while (q_must_wait(sqp))
+    {
+        q_unlock(sqp);
+        spin_wait(&spins);
+        q_lock(sqp, LOCK_P);
+    }
+}
+
+/**
+ * q_enq_by: enqueue a new value with its own deadline
+ * @sqp: the simple queue context structure
+ * @val: value to enter into current bufs element
+ * @deadline: sq_clock_ns time after which the payload is dropped unread,
+ *            SQ_NEVER to keep it.  Ignored without sq_set_ttl.
+ *
+ * Logic:
+ * - if the ring is full and the policy isn't SQ_OVERWRITE, wait for room
+ *   or turn the payload away
+ * - update element value and its sequence number and wrap or increment
+ *   enq pointer
+ * - if all bufs are being used then move the deq pointer to the
+ *   current oldest (one more than the newest!),
+ *   if bufs still available then increment buf count
+ *
+ * Return: 0, or -1 if SQ_FAIL or SQ_DROP_NEWEST turned the payload away
+ */
+int q_enq_by(sq_t* sqp, buf_t val, uint64_t deadline)
+{
+    if (sqp->mode == LOCK_FREE)
+        return (q_enq_lockfree(sqp, val, deadline));
+    q_lock(sqp, LOCK_P);
+    /* an overwrite below needs the slot at deq migrated first, a step covers it */
+    q_migrate_step(sqp, 0);
+    if (sqp->count == sqp->store.max)
+        SQ_TRACE_FULL(sqp, sqp->policy);
+    if (q_must_wait(sqp))
+    {
+        if (sqp->policy == SQ_FAIL || sqp->policy == SQ_DROP_NEWEST)
+        {
+            q_refuse(sqp, 1);
+            q_unlock(sqp);
+            return (-1);
+        }
+        q_wait_room(sqp);
+    }
+    /// if (debug_flag)
+    //  printf("q_enq enter count=%d val=%s enq=%s deq=%s sqp->last=%p sqp->first=%p \n", sqp->count, payload_sprintf((payload_t *)&val), payload_sprintf((payload_t *)sqp->enq), payload_sprintf((payload_t *)sqp->deq), sqp->last, sqp->first);
+    /// OLD CODE
+    /// NEW CODE - copy IN FROM external variable into the slot enq aims at
+    //
+    memcpy( SQ_BUF(sqp, sqp->enq), val, sqp->buffer_width );/// NEW COPY INTO START OF STRUCT NO MATTER SIZE
+    q_stamp(&sqp->store, sqp->enq, 1, deadline);
+    q_number(sqp, &sqp->store, sqp->enq, 1);
+    // the queue's width, set once by sq_create
+    /// ITERATOR FOR ENQUEUE OPERATION
+    /** increment to next slot
+     * if past the last then set to first
+     */
+    sqp->enq = (sqp->enq + 1) & sqp->store.mask; // roll around buffer array to lowest
+
+    /* When the the array is full, q_enq has just overwritten the oldest buffer
+     * so move the deq pointer to the NEXT oldest, which is where enq now aims.
+     * If the array is not full, then deq will still point to the oldest so just
+     * increment the buffer count.
+     */
+    if (sqp->count == sqp->store.max) // OLD CODE mixed pointers and counts: if (sqp->first + sqp->count == sqp->max)
+    {
+        sqp->deq = sqp->enq;
+        sqp->overwritten++;
+    }
+    else // majority case - just iterate the count on the ring buffer for most
+        sqp->count++;
+
+    /// high-water mark for this queue
+    if ( sqp->max_entries < sqp->count )
+    {
+        sqp->max_entries = sqp->count;
+        if (sqp->log)
+        {
+            /// log event before releasing lock = note largest number of queue entries at once
+            evt_enq(EVT_MAX_QUEUE, sqp->max_entries);
+        }
+
+    }
+    //if (debug_flag)
+    //  printf("q_enq exit count=%d enq=%s deq=%s sqp->last=%p sqp->first=%p \n", sqp->count, payload_sprintf((payload_t *)sqp->enq), payload_sprintf((payload_t *)sqp->deq), sqp->last, sqp->first);
+    SQ_TRACE_ENQ(sqp, 1, sqp->count);
+    if (sqp->log)
+    {
+        /* log event before releasing lock.  This makes the critical section
+         * longer but logs the event accurately; outside of the critical
+         * section will result in out-of-sequence events being logged.
+         */
+        evt_enq(EVT_ENQ, sqp->count);
+    }
+    q_unlock(sqp);
+    return (0);
+}
+/**
+ * q_deq: dequeue the oldest ringbuffer element
+ * @sqp: the simple queue context structure
+ * @valp: return the value in the current deq element
+ *
+ * See q_deq_seq.
+ */
+int q_deq(sq_t* sqp, buf_t* valp)
+{
+    return (q_deq_seq(sqp, valp, NULL));
+}
+
+/**
+ * q_deq_seq: dequeue the oldest ringbuffer element and its sequence number
+ * @sqp: the simple queue context structure
+ * @valp: return the value in the current deq element
+ * @seqp: return its sequence number, may be NULL.  A jump from the last
+ *        one seen means payloads were lost in between, see sq_t lost.
+ *
+ * Logic:
+ * - drop the expired elements at the head, if the queue has deadlines
+ * - If no valid elements, return -1
+ * - get value from bufs element
+ * - mark queue element as invalid (for debugging) and decrement counter
+ * - if last element then wrap to first, otherwise move to next element
+ *
+ * Return:
+ *   0 for success, negative otherwise
+ */
+int q_deq_seq(sq_t* sqp, buf_t* valp, uint64_t *seqp)
+{
+    uint64_t seq;
+
+    if (sqp->mode == LOCK_FREE)
+        return q_deq_lockfree(sqp, valp, seqp);
+    q_lock(sqp, LOCK_C);
+    /* the head is in use by whoever peeked at it */
+    if (sqp->held)
+    {
+        q_unlock(sqp);
+        return (-1);
+    }
+    q_ready_head(sqp, 1);
+    /* if no valid entries, return error
+     * checked under the lock, the producer may be halfway through q_enq */
+    if (sqp->count == 0)
+    {
+        SQ_TRACE_EMPTY(sqp);
+        q_unlock(sqp);
+        return (-1);
+    }
+    //if (debug_flag) // raw output for now...
+    //  printf("q_deq enter count=%d val=%s enq=%s deq=%s sqp->last=%p sqp->first=%p \n", sqp->count, payload_sprintf((payload_t *)valp), payload_sprintf((payload_t *)sqp->enq), payload_sprintf((payload_t *)sqp->deq), sqp->last, sqp->first);
+    //
+    ///
+    // CRITICAL CODE - THE ACTUAL PURPOSE OF DEQUEUE FCN
+    ///
+    /// ORIGINAL CODE
+    /// NEW CODE - copy out of the slot deq aims at to external variable
+    //
+/// void *memcpy(void dest[restrict .n], const void src[restrict .n], size_t n);
+    memcpy( *valp, SQ_BUF(sqp, sqp->deq), sqp->buffer_width );// the queue's own width, never more than a slot holds
+    seq = sqp->store.seq[sqp->deq];
+    q_seen(sqp, seq, 1);
+    if (seqp != NULL)
+        *seqp = seq;
+    /* set bufs element to invalid for debugging */
+    //if (debug_flag)
+    ///  *(sqp->deq) = INVALID_EL; /// OLD CODE - just a simple one address
+    //  printf("q_deq exit count=%d val=%s enq=%s deq=%s sqp->last=%p sqp->first=%p \n", sqp->count, payload_sprintf((payload_t *)valp), payload_sprintf((payload_t *)sqp->enq), payload_sprintf((payload_t *)sqp->deq), sqp->last, sqp->first);
+
+    ///
+    // END CRITICAL CODE  - REST IS HOUSKEEPING
+    //
+    /* dec count because bufs element can be reused now */
+    sqp->count--; // decrease valid available elements - because the total amount "available" never changes
+    // This is David T's buffer decrement / dequeue interpretation
+    //
+    /* increment to next slot
+     * if past the last then set to first
+     */
+    // increments queue buffer up towards sqp->enq
+    sqp->deq = (sqp->deq + 1) & sqp->store.mask; /// wraparound to the lowest buffer
+    if (sqp->log)
+    {
+        /* log event before releasing lock.  This makes the critical section
+         * longer but logs the event accurately; outside of the critical
+         * section will result in out-of-sequence events being logged.
+         */
+        evt_enq(EVT_DEQ, sqp->count);
+    }
+    //if (debug_flag)
+    //  printf("q_deq exit count=%d ep=%p val=%s dp=%p val=%s\n", sqp->count, sqp->enq, *(sqp->enq), sqp->deq, *(sqp->deq));
+    SQ_TRACE_DEQ(sqp, 1, sqp->count);
+
+    q_unlock(sqp);
+    return (0);
+}
+
+/**
+ * q_put_run - fill k slots from enq on, locked modes
+ * @sqp: the simple queue context structure, locked by the producer
+ * @src: k payloads packed buffer_width apart
+ * @k: number of payloads, at most max
+ * @deadline: their deadline
+ *
+ * When the ring fills deq moves to the oldest survivor as in q_enq, and
+ * the payloads that cost are counted as overwritten.
+ */
+static void q_put_run(sq_t *sqp, const char *src, size_t k, uint64_t deadline)
+{
+    sq_store_t *st = &sqp->store;
+
+    /* the payloads about to be overwritten must have been migrated, or migration would undo it */
+    if (sqp->count + k > st->max)
+        q_migrate_step(sqp, sqp->count + k - st->max);
+    q_copy_in(sqp, st, sqp->enq, src, k);
+    q_stamp(st, sqp->enq, k, deadline);
+    q_number(sqp, st, sqp->enq, k);
+    sqp->enq = (sqp->enq + k) & st->mask;
+    if (sqp->count + k >= st->max)
+    {
+        /* full, the oldest survivor is where enq now aims */
+        sqp->overwritten += sqp->count + k - st->max;
+        sqp->count = st->max;
+        sqp->deq = sqp->enq;
+    }
+    else
+        sqp->count += k;
+}
+
+/**
+ * q_enq_bulk: enqueue n payloads under one lock
+ * @sqp: the simple queue context structure
+ * @src: n payloads packed buffer_width apart, oldest first
+ * @n: number of payloads
+ *
+ * Same result as n calls of q_enq, but the lock is taken once, the slots
+ * are filled in contiguous runs and count, enq and deq move once.  With
+ * SQ_OVERWRITE payloads that would be overwritten before the call returns
+ * are skipped, though they still use up sequence numbers.  SQ_BLOCK waits
+ * for room for the rest whenever the ring fills; SQ_FAIL and SQ_DROP_NEWEST
+ * take what fits and turn the rest away.  In LOCK_FREE mode the producer
+ * publishes as many as fit with one release store of head.
+ * With a TTL every payload gets the same deadline, ttl_ns from the call.
+ *
+ * Return: payloads accepted, less than n only if SQ_FAIL or SQ_DROP_NEWEST
+ * turned some away
+ */
+size_t q_enq_bulk(sq_t* sqp, const void *src, size_t n)
+{
+    const char *p = src;
+    sq_store_t *st;
+    size_t head, used, k, done = 0;
+    uint32_t spins = 0;
+    uint64_t deadline;
+
+    if (n == 0)
+        return (0);
+    deadline = q_deadline(sqp);
+    if (sqp->mode == LOCK_FREE)
+    {
+        head = atomic_load_explicit(&sqp->head, memory_order_relaxed);
+        while (n > 0)
+        {
+            st = q_producer_store(sqp, head);
+            used = head - atomic_load_explicit(&sqp->tail, memory_order_acquire);
+            if (used >= st->max)
+            {
+                /* once per call, not once per spin */
+                if (spins == 0)
+                    SQ_TRACE_FULL(sqp, sqp->policy);
+                if (sqp->policy == SQ_FAIL || sqp->policy == SQ_DROP_NEWEST)
+                {
+                    q_refuse(sqp, n);
+                    break;
+                }
+                spin_wait(&spins);
+                continue;
+            }
+            k = st->max - used;
+            if (k > n)
+                k = n;
+            q_copy_in(sqp, st, head & st->mask, p, k);
+            q_stamp(st, head & st->mask, k, deadline);
+            q_number(sqp, st, head & st->mask, k);
+            head += k;
+            atomic_store_explicit(&sqp->head, head, memory_order_release);
+            p += k * sqp->buffer_width;
+            n -= k;
+            done += k;
+            /// high-water mark - only the producer writes it
+            if ( sqp->max_entries < used + k )
+            {
+                sqp->max_entries = used + k;
+                if (sqp->log)
+                    evt_enq(EVT_MAX_QUEUE, sqp->max_entries);
+            }
+            SQ_TRACE_ENQ(sqp, k, used + k);
+            if (sqp->log)
+                evt_enq(EVT_ENQ, used + k);
+        }
+        return (done);
+    }
+    q_lock(sqp, LOCK_P);
+    q_migrate_step(sqp, 0);
+    while (n > 0)
+    {
+        if (sqp->policy == SQ_OVERWRITE && !sqp->held)
+        {
+            if (sqp->count + n > sqp->store.max)
+                SQ_TRACE_FULL(sqp, sqp->policy);
+            /* the oldest would only be overwritten by the newest in this same call */
+            if (n > sqp->store.max)
+            {
+                k = n - sqp->store.max;
+                p += k * sqp->buffer_width;
+                sqp->enq_seq += k;
+                sqp->overwritten += k;
+                done += k;
+                n = sqp->store.max;
+            }
+            q_put_run(sqp, p, n, deadline);
+            done += n;
+            break;
+        }
+        if (q_must_wait(sqp))
+        {
+            SQ_TRACE_FULL(sqp, sqp->policy);
+            if (sqp->policy == SQ_FAIL || sqp->policy == SQ_DROP_NEWEST)
+            {
+                q_refuse(sqp, n);
+                break;
+            }
+            q_wait_room(sqp);
+            continue;
+        }
+        k = sqp->store.max - sqp->count;
+        if (k > n)
+            k = n;
+        q_put_run(sqp, p, k, deadline);
+        p += k * sqp->buffer_width;
+        n -= k;
+        done += k;
+    }
+    if ( sqp->max_entries < sqp->count )
+    {
+        sqp->max_entries = sqp->count;
+        if (sqp->log)
+            evt_enq(EVT_MAX_QUEUE, sqp->max_entries);
+    }
+    SQ_TRACE_ENQ(sqp, done, sqp->count);
+    if (sqp->log)
+        evt_enq(EVT_ENQ, sqp->count);
+    q_unlock(sqp);
+    return (done);
+}
+
+/**
+ * q_deq_bulk: dequeue up to n of the oldest payloads under one lock
+ * @sqp: the simple queue context structure
+ * @dst: room for n payloads packed buffer_width apart
+ * @n: most payloads to take, pass max to drain the queue
+ *
+ * Expired payloads at the head are dropped first, as in q_deq, and do not
+ * count towards n.  Sequence numbers are checked once per call, against
+ * the last payload taken.
+ *
+ * Return: the number of payloads copied to dst, oldest first, 0 if the
+ * queue was empty
+ */
+size_t q_deq_bulk(sq_t* sqp, void *dst, size_t n)
+{
+    sq_store_t *st;
+    size_t head, tail, k;
+    uint64_t last;
+
+    if (sqp->mode == LOCK_FREE)
+    {
+        if (sqp->held)
+            return (0);
+        tail = atomic_load_explicit(&sqp->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&sqp->head, memory_order_acquire);
+        st = q_consumer_store(sqp, tail, &head);
+        k = q_expire(st, tail & st->mask, head - tail);
+        if (k > 0)
+        {
+            sqp->expired += k;
+            if (sqp->log)
+                evt_enq(EVT_EXPIRE, k);
+            tail += k;
+            atomic_store_explicit(&sqp->tail, tail, memory_order_release);
+        }
+        k = head - tail;
+        if (k > n)
+            k = n;
+        if (k == 0)
+        {
+            SQ_TRACE_EMPTY(sqp);
+            return (0);
+        }
+        q_copy_out(sqp, st, tail & st->mask, dst, k);
+        last = st->seq[(tail + k - 1) & st->mask];
+        atomic_store_explicit(&sqp->tail, tail + k, memory_order_release);
+        q_seen(sqp, last, k);
+        SQ_TRACE_DEQ(sqp, k, head - tail - k);
+        if (sqp->log)
+            evt_enq(EVT_DEQ, head - tail - k);
+        return (k);
+    }
+    q_lock(sqp, LOCK_C);
+    if (sqp->held)
+    {
+        q_unlock(sqp);
+        return (0);
+    }
+    q_ready_head(sqp, sqp->count < n ? sqp->count : n);
+    k = sqp->count;
+    if (k > n)
+        k = n;
+    if (k > 0)
+    {
+        st = &sqp->store;
+        q_copy_out(sqp, st, sqp->deq, dst, k);
+        q_seen(sqp, st->seq[(sqp->deq + k - 1) & st->mask], k);
+        sqp->deq = (sqp->deq + k) & st->mask;
+        sqp->count -= k;
+        SQ_TRACE_DEQ(sqp, k, sqp->count);
+        if (sqp->log)
+            evt_enq(EVT_DEQ, sqp->count);
+    }
+    else
+        SQ_TRACE_EMPTY(sqp);
+    q_unlock(sqp);
+    return (k);
+}
+
+/**
+ * q_deq_peek - the oldest payload, in its slot, without dequeuing it
+ * @sqp: the simple queue context structure
+ * @seqp: return its sequence number, may be NULL
+ *
+ * For a consumer that only reads a few fields: no copy, the pointer is
+ * into the slot itself.  Expired payloads at the head are dropped first, as
+ * in q_deq.  The payload stays held, its slot not reused and no other
+ * dequeue handed anything, until q_deq_release.  Don't enqueue to a full
+ * SQ_BLOCK or SQ_OVERWRITE queue from the thread holding it: the producer
+ * would wait for a release that can't come.
+ *
+ * Return: the payload, buffer_width bytes, or NULL with errno set to
+ * EAGAIN if the queue is empty or EBUSY if a payload is already held
+ */
+const void *q_deq_peek(sq_t* sqp, uint64_t *seqp)
+{
+    sq_store_t *st;
+    size_t head, tail, k;
+    const void *p;
+
+    if (sqp->mode == LOCK_FREE)
+    {
+        if (sqp->held)
+        {
+            errno = EBUSY;
+            return (NULL);
+        }
+        tail = atomic_load_explicit(&sqp->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&sqp->head, memory_order_acquire);
+        st = q_consumer_store(sqp, tail, &head);
+        k = q_expire(st, tail & st->mask, head - tail);
+        if (k > 0)
+        {
+            sqp->expired += k;
+            if (sqp->log)
+                evt_enq(EVT_EXPIRE, k);
+            tail += k;
+            atomic_store_explicit(&sqp->tail, tail, memory_order_release);
+        }
+        if (tail == head)
+        {
+            SQ_TRACE_EMPTY(sqp);
+            errno = EAGAIN;
+            return (NULL);
+        }
+        /* store stays put until this consumer moves tail past resize_at */
+        p = SQ_AT(sqp, st, tail & st->mask);
+        q_seen(sqp, st->seq[tail & st->mask], 1);
+        if (seqp != NULL)
+            *seqp = st->seq[tail & st->mask];
+        sqp->held = true;
+        return (p);
+    }
+    q_lock(sqp, LOCK_C);
+    if (sqp->held)
+    {
+        q_unlock(sqp);
+        errno = EBUSY;
+        return (NULL);
+    }
+    q_ready_head(sqp, 1);
+    if (sqp->count == 0)
+    {
+        SQ_TRACE_EMPTY(sqp);
+        q_unlock(sqp);
+        errno = EAGAIN;
+        return (NULL);
+    }
+    /* migrated by q_ready_head, and no resize starts while it is held */
+    p = SQ_BUF(sqp, sqp->deq);
+    q_seen(sqp, sqp->store.seq[sqp->deq], 1);
+    if (seqp != NULL)
+        *seqp = sqp->store.seq[sqp->deq];
+    sqp->held = true;
+    q_unlock(sqp);
+    return (p);
+}
+
+/**
+ * q_deq_release - dequeue the payload q_deq_peek handed out
+ * @sqp: the simple queue context structure
+ *
+ * The pointer q_deq_peek returned is invalid from here on.  Does nothing
+ * if no payload is held.
+ */
+void q_deq_release(sq_t* sqp)
+{
+    size_t tail, left;
+
+    if (sqp->mode == LOCK_FREE)
+    {
+        if (!sqp->held)
+            return;
+        sqp->held = false;
+        tail = atomic_load_explicit(&sqp->tail, memory_order_relaxed);
+        atomic_store_explicit(&sqp->tail, tail + 1, memory_order_release);
+        left = atomic_load_explicit(&sqp->head, memory_order_relaxed) - tail - 1;
+        SQ_TRACE_DEQ(sqp, 1, left);
+        if (sqp->log)
+            evt_enq(EVT_DEQ, left);
+        return;
+    }
+    q_lock(sqp, LOCK_C);
+    if (sqp->held)
+    {
+        sqp->held = false;
+        sqp->count--;
+        sqp->deq = (sqp->deq + 1) & sqp->store.mask;
+        SQ_TRACE_DEQ(sqp, 1, sqp->count);
+        if (sqp->log)
+            evt_enq(EVT_DEQ, sqp->count);
+    }
+    q_unlock(sqp);
+}
@@ -0,0 +1,305 @@
+/*! \file vringbuffer.h
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ * Copyright (C) 2005-2022 Dahetral Systems
+ * Author: David Turvene (dturvene@gmail.com)
+ *
+ * DRE 2024 - the varied slot ringbuffer (sq_t) separated out of
+ * ringbuffer-varied.c so queues can be created at run time: sq_create takes
+ * the depth and the slot width, so one build can hold any number of queues
+ * of different shapes.  ringbuffer-varied.c is now only the test program.
+ */
+
+#ifndef _VRINGBUFFER_H
+#define _VRINGBUFFER_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint32_t, etc. */
+#include <stdbool.h>    /* boolean declaration and types: true, false */
+#include <pthread.h>    /* pthread_mutex */
+#include <stdatomic.h>  /* atomic_ operations */
+#include <sched.h>      /* sched_yield */
+#include <time.h>       /* clock_gettime */
+#include "sqlock.h"     /* lockmode_t, sqlock_t, spin_wait */
+
+/// \def CACHE_LINE keeps the lock-free producer and consumer indices apart
+#define CACHE_LINE 64
+
+/// OLD CODE
+///typedef uint32_t buf_t;
+/** \struct buf_t \brief the void pointer placeholder
+ *  The new varied size ringbuffer entry - which makes it more
+ * relevant and useful for wider use - requires to exploit the
+ * magical void * pointer as a universal placeholder for the memory that is
+ * aimed at for replacement or recovery. David T.'s code enqueues an entry
+ * and that means the data replaces where the enqueue pointer is aiming at.
+ *
+ * His code, and if you think about it, was for one integer. And he cheated by
+ * calling everything a buf_t in the struct below and that made his logical
+ * comparisons and pointer math was limited to one kind of struct type. His confused
+ * allocating and logical comparisons made my life harder to expand his work.
+ *
+ * In the new version the "buffer" buf_t is a void pointer that acts like a placeholder
+ * to aim at a slot of buffer_width bytes. You can now send a data
+ * element of up to buffer_width into a queue position and out of a queue position because
+ * it accomodates any up to that max. Of course we are counting in size_t from 0.
+ *
+ * The beauty is that it will transfer by memcpy the entire buffer but when you type cast it to your
+ * own format it will still have those data at proper offsets. As long as you keep the
+ * typecast correct and use the same pointer referencing data will appear in the same format.
+ *
+ * */
+/// \struct void * poiunter allows variable struct type casting with a varied data struct
+typedef void * buf_t; // every buffer slot is by default an address.
+
+/// \def SQ_STRIDE is a slot width rounded up to whole cache lines so neighbouring slots never share a line
+#define SQ_STRIDE(width) (((width) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+/// \def SQ_AT is the address of slot i of store st
+#define SQ_AT(sqp, st, i) ((buf_t)((st)->slab + (size_t)(i) * (sqp)->stride))
+/// \def SQ_BUF is the address of slot i - the old bufs[i] is now just arithmetic on the slab
+#define SQ_BUF(sqp, i) SQ_AT(sqp, &(sqp)->store, i)
+/// \def SQ_NEVER is the deadline of a payload that never expires
+#define SQ_NEVER UINT64_MAX
+/// \def SQ_MIGRATE_STEP bounds the slots a locked q_* call moves for sq_resize
+#define SQ_MIGRATE_STEP 32
+
+/// \fn sq_clock_ns is CLOCK_MONOTONIC in nanoseconds, the clock evt_enq stamps with and deadlines are in
+inline static uint64_t sq_clock_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec);
+}
+
+/**
+ * fullpolicy_t - what an enqueue does when the ring is full, fixed at sq_create_policy
+ * @SQ_OVERWRITE: drop the oldest payload to make room, David T.'s original
+ *                and the default.  LOCK_FREE can't move the consumer's side
+ *                of the ring, so there it waits as SQ_BLOCK does.
+ * @SQ_BLOCK: wait until a consumer makes room, nothing is lost
+ * @SQ_FAIL: refuse the payload and return -1 at once, the caller still has it
+ * @SQ_DROP_NEWEST: discard the new payload and return -1; it uses up a
+ *                  sequence number, so consumers see the gap
+ * @SQ_POLICIES: number of policies
+ */
+typedef enum fullpolicy
+{
+    SQ_OVERWRITE = 0,
+    SQ_BLOCK = 1,
+    SQ_FAIL = 2,
+    SQ_DROP_NEWEST = 3,
+    SQ_POLICIES
+} fullpolicy_t;
+
+/**
+ * sqresize_t - where a LOCK_FREE sq_resize is, see sq_t
+ * @SQ_RESIZE_IDLE: no resize, both sides use store
+ * @SQ_RESIZE_PREPARING: sq_resize is filling next
+ * @SQ_RESIZE_PENDING: next is ready, the producer hasn't switched yet
+ * @SQ_RESIZE_SWITCHED: the producer writes next from resize_at on, the
+ *                      consumer still drains store below it
+ * @SQ_RESIZE_DRAINED: the consumer retired the old store, next is store
+ *                     now; the producer's next enqueue makes it idle
+ */
+typedef enum sqresize
+{
+    SQ_RESIZE_IDLE = 0,
+    SQ_RESIZE_PREPARING,
+    SQ_RESIZE_PENDING,
+    SQ_RESIZE_SWITCHED,
+    SQ_RESIZE_DRAINED
+} sqresize_t;
+
+/**
+ * struct sq_store - the slots of a queue, replaced as a whole by sq_resize
+ * @slab: one cache line aligned allocation holding every slot
+ * @seq: the sequence number of each slot's payload
+ * @deadline: one sq_clock_ns deadline per slot, NULL until sq_set_ttl
+ * @max: the number of total slots in the slab, a power of two
+ * @mask: max - 1, indices wrap with a mask instead of a compare or a divide
+ */
+typedef struct sq_store
+{
+    char *slab;
+    uint64_t *seq;
+    uint64_t *deadline;
+    size_t max;
+    size_t mask;
+} sq_store_t;
+
+/**
+ * struct sq - simple queue
+ * @store: the slots, their sequence numbers and deadlines
+ * @stride: bytes from one slot to the next, buffer_width rounded up to a
+ *          multiple of CACHE_LINE
+ * @enq: index of the slot to fill for the newest value,
+ *       the element will either be invalid or, if valid, the
+ *       oldest filled.
+ * @deq: index of the slot to drain next,
+ *       always the oldest element.
+ * @count: the number of slots containing data
+ * @buffer_width: the payload bytes q_enq copies in and q_deq copies out
+ * @max_entries: the most entries queued at once, the high-water mark
+ * @mode: the lockmode_t, set after sq_create and before the first enqueue
+ * @policy: the fullpolicy_t, set by sq_create_policy
+ * @ttl_ns: the deadline q_enq gives a payload, this long after it is queued;
+ *          0 for SQ_NEVER
+ * @enq_seq: the sequence number the next payload gets, producer side
+ * @overwritten: SQ_OVERWRITE payloads lost to a newer one
+ * @dropped: SQ_DROP_NEWEST payloads discarded on a full ring
+ * @rejected: SQ_FAIL payloads refused on a full ring
+ * @deq_seq: one past the sequence number last dequeued, consumer side
+ * @lost: sequence numbers the consumers never saw, whatever the reason
+ * @expired: payloads dropped unread because their deadline had passed
+ * @held: a payload handed out by q_deq_peek and not yet q_deq_release'd
+ * @lock: the lock words for every locked mode and their wait and hold
+ *        histograms, recorded when lock.stat is set
+ * @log: log enq and deq events with evt_enq
+ * @cb: debug callback
+ * @gen: stores installed by sq_resize
+ * @old: locked modes, the store sq_resize is migrating out of
+ * @mig_from: its slot that held the oldest payload at sq_resize
+ * @mig: payloads migrated, or consumed before they were, so far
+ * @mig_n: payloads queued at sq_resize, the ones to migrate
+ * @next: LOCK_FREE, the store the producer switches to
+ * @resize: LOCK_FREE, the sqresize_t
+ * @resize_at: LOCK_FREE, the first head the producer wrote to next
+ *
+ * This is the main simple queue structure.
+ * DRE 2024
+ *  It's now more than an array of ints and fancy names.
+ *
+ * Slot storage is a single slab of max * stride bytes instead of one heap
+ * allocation per slot, so slot i is always at slab + i * stride (SQ_BUF).
+ * Walking the queue is a linear scan the hardware prefetcher can follow and
+ * creating or destroying the queue is a single allocation.
+ *
+ * It is created once for each queue with sq_create.  The slots fill and empty going higher. If the
+ * slots fill to the last element then it loops back to the first element
+ * and starts to overwrite the oldest elements.
+ *
+ * Each queue carries its own locks (see sqlock.h) and, for the lock-free
+ * mode, head and tail.
+ *
+ * With sq_set_ttl every slot also has a deadline, kept in its own array so
+ * a scan over stale slots reads eight deadlines per cache line and never
+ * touches the payloads.  q_deq and q_deq_bulk first drop the run of
+ * expired payloads at the head of the queue, uncopied, by moving deq past
+ * them in one step.  Only that leading run is dropped: with q_enq_by
+ * deadlines out of order, a stale payload behind a live one waits its turn.
+ *
+ * Every payload offered to the queue gets the next 64-bit sequence number,
+ * kept beside it in seq.  A dequeue compares what it gets with deq_seq,
+ * so lost counts exactly the payloads overwritten, dropped or expired
+ * before any consumer saw them, and q_deq_seq hands the number to the
+ * consumer.  The counters on the producer side sit on head's cache line
+ * and the consumer side's on tail's, so in LOCK_FREE mode neither thread
+ * writes the other's line.
+ *
+ * sq_resize grows or shrinks a live queue, every slot moving to a new
+ * store, without stopping its producers or consumers:
+ * - In the locked modes the new store goes in under the lock, holding the
+ *   queued payloads' places at its start, and the old one stays as old.
+ *   Every locked q_* call then moves up to SQ_MIGRATE_STEP payloads across
+ *   before doing its own work, and a consumer moves at least the ones it
+ *   is about to read, so no call waits on more than its own share of the
+ *   copying.  Nothing else can see old without the lock, so the last move
+ *   frees it.
+ * - LOCK_FREE has no lock to install anything under.  sq_resize only fills
+ *   next and marks it pending; the producer switches on its next enqueue
+ *   and records resize_at, the first position it writes to next.  The
+ *   consumer keeps draining store below resize_at, in place, and when it
+ *   reaches it frees store and makes next the store.  Each side moves the
+ *   resize state on only at the start of its own call, so neither frees a
+ *   store the other may still be using.
+ * gen counts the stores installed; a second sq_resize fails with EBUSY
+ * until the first one is finished.
+ *
+ * q_deq_peek hands the consumer a pointer to the oldest payload in its
+ * slot instead of a copy, and q_deq_release gives the slot back.  In
+ * between the payload is held: deq (tail) stays on it, so no producer can
+ * reuse the slot, and other dequeues find nothing, so one consumer at a
+ * time processes in place.  A locked SQ_OVERWRITE producer that would
+ * overwrite a held payload waits for its release, as LOCK_FREE always
+ * does, and sq_resize fails with EBUSY while one is held.
+ */
+typedef struct sq
+{
+    //! \var store holds every slot, its sequence number and deadline
+    sq_store_t store;
+    //! \var stride is the distance between slots, a whole number of cache lines
+    size_t stride;
+    //!
+    size_t enq; // ring buffer slot index to write into
+    //!
+    size_t deq; // ring buffer slot index to read from
+    //! \var count modified to actual count - he got lazy and that's why portability wasn't there...
+    size_t count;	// an absolute not a reference - but what he didn't use is it can be added as a simple offset if needed
+    //! \var buffer_width is the payload bytes copied in and out of each slot
+    size_t buffer_width; // in sizeof value
+    //! \var max_entries is the largest count seen, replaces the old global g_max_entries
+    size_t max_entries;
+    //! \var mode selects the lock, or lock-free access
+    lockmode_t mode;
+    //! \var policy is what an enqueue on a full ring does
+    fullpolicy_t policy;
+    //! \var ttl_ns is added to the enqueue time for the q_enq deadline, 0 never expires
+    uint64_t ttl_ns;
+    //! \var log turns on evt_enq event logging for this queue
+    bool log;
+    //! \note I have left callback and it can be replaced
+    //! \var cb is the local callback that David T. used for debugging it must have a function that printfs out the actual contents of the buffer.
+    void (*cb)(buf_t);//
+    //! \var lock is taken by q_enq and q_deq in every mode but LOCK_FREE
+    sqlock_t lock;
+    //! \var gen counts the stores sq_resize installed
+    atomic_size_t gen;
+    //! \var old, mig_from, mig, mig_n track a locked mode migration, old.slab NULL when none
+    sq_store_t old;
+    size_t mig_from;
+    size_t mig;
+    size_t mig_n;
+    //! \var next, resize, resize_at hand a LOCK_FREE resize from producer to consumer
+    sq_store_t next;
+    _Atomic(sqresize_t) resize;
+    atomic_size_t resize_at;
+    //! \var head is the lock-free mode's enq: total enqueued, written only by the producer
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    //! \var enq_seq numbers the payloads as they are offered, used up by drops too
+    uint64_t enq_seq;
+    //! \var overwritten, dropped, rejected count the payloads a full ring cost, per policy
+    size_t overwritten;
+    size_t dropped;
+    size_t rejected;
+    //! \var tail is the lock-free mode's deq: total dequeued, written only by the consumer
+    /// \note head and tail sit on separate cache lines so publishing one doesn't steal the other's line
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+    //! \var deq_seq is the sequence number the consumers expect next
+    uint64_t deq_seq;
+    //! \var lost counts sequence numbers skipped between dequeues
+    size_t lost;
+    //! \var expired counts the payloads dropped at dequeue time, written by the consumer side only
+    size_t expired;
+    //! \var held is set from q_deq_peek to q_deq_release, the slot at deq is still in use
+    bool held;
+} sq_t;
+
+/* externally visible prototypes */
+sq_t *sq_create(size_t depth, size_t width);
+sq_t *sq_create_policy(size_t depth, size_t width, fullpolicy_t policy);
+void sq_destroy(sq_t *sqp);
+int sq_set_ttl(sq_t *sqp, uint64_t ttl_ns);
+int sq_resize(sq_t *sqp, size_t depth);
+void q_reset(sq_t *sqp);
+void q_print(const char *label, const sq_t *sqp);
+size_t q_count(sq_t *sqp);
+int q_enq(sq_t *sqp, buf_t val);
+int q_enq_by(sq_t *sqp, buf_t val, uint64_t deadline);
+int q_deq(sq_t *sqp, buf_t *valp);
+int q_deq_seq(sq_t *sqp, buf_t *valp, uint64_t *seqp);
+size_t q_enq_bulk(sq_t *sqp, const void *src, size_t n);
+size_t q_deq_bulk(sq_t *sqp, void *dst, size_t n);
+const void *q_deq_peek(sq_t *sqp, uint64_t *seqp);
+void q_deq_release(sq_t *sqp);
+
+#endif /* _VRINGBUFFER_H */
@@ -0,0 +1,224 @@
+/*! \file wsdeque.c
+ *
+ * DRE 2024
+ *
+ * Chase-Lev work-stealing deque, see wsdeque.h
+ */
+
+#include <stdlib.h>     /* aligned_alloc, malloc, free */
+#include <string.h>     /* memset */
+#include "wsdeque.h"    /* wsdeque_t and external function prototypes */
+
+/**
+ * wsarray_create - allocate circular storage
+ * @size: number of slots, a power of two
+ *
+ * Return: the new array or NULL if out of memory
+ */
+static wsarray_t *wsarray_create(size_t size)
+{
+    wsarray_t *a = malloc(sizeof(wsarray_t) + size * sizeof(a->slot[0]));
+    if (a == NULL)
+        return (NULL);
+    a->size = size;
+    a->retired = NULL;
+    return (a);
+}
+
+/**
+ * wsarray_get, wsarray_put - relaxed slot access wrapping at the array size
+ */
+inline static void *wsarray_get(wsarray_t *a, int64_t i)
+{
+    return atomic_load_explicit(&a->slot[i & (a->size - 1)], memory_order_relaxed);
+}
+
+inline static void wsarray_put(wsarray_t *a, int64_t i, void *task)
+{
+    atomic_store_explicit(&a->slot[i & (a->size - 1)], task, memory_order_relaxed);
+}
+
+/**
+ * wsdeque_grow - replace the full array with one twice the size
+ * @dq: the deque, called by the owner only
+ * @a: the current array
+ * @bottom, @top: the live range to copy
+ *
+ * The old array is pushed onto the retired list rather than freed because a
+ * thief may have loaded it and still be about to read its top slot.
+ *
+ * Return: the new array or NULL if out of memory
+ */
+static wsarray_t *wsdeque_grow(wsdeque_t *dq, wsarray_t *a, int64_t bottom, int64_t top)
+{
+    wsarray_t *bigger = wsarray_create(a->size << 1);
+    int64_t i;
+
+    if (bigger == NULL)
+        return (NULL);
+    for (i = top; i < bottom; i++)
+        wsarray_put(bigger, i, wsarray_get(a, i));
+    atomic_store_explicit(&dq->array, bigger, memory_order_release);
+    a->retired = dq->retired;
+    dq->retired = a;
+    return (bigger);
+}
+
+/**
+ * wsdeque_create - allocate an empty deque
+ * @size: initial capacity, rounded up to a power of two
+ *
+ * Return: the deque or NULL if out of memory
+ */
+wsdeque_t *wsdeque_create(size_t size)
+{
+    size_t pow2 = 2;
+    wsdeque_t *dq;
+    wsarray_t *a;
+
+    while (pow2 < size)
+        pow2 <<= 1;
+    dq = aligned_alloc(WSDEQUE_CACHE_LINE, sizeof(wsdeque_t));
+    if (dq == NULL)
+        return (NULL);
+    if ((a = wsarray_create(pow2)) == NULL)
+    {
+        free(dq);
+        return (NULL);
+    }
+    memset(dq, 0, sizeof(wsdeque_t));
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+    atomic_init(&dq->array, a);
+    dq->retired = NULL;
+    return (dq);
+}
+
+/**
+ * wsdeque_destroy - free the deque, its array and all retired arrays
+ * @dq: the deque, no thread may be using it
+ *
+ * Tasks still in the deque are not touched.
+ */
+void wsdeque_destroy(wsdeque_t *dq)
+{
+    wsarray_t *a;
+
+    if (dq == NULL)
+        return;
+    while ((a = dq->retired) != NULL)
+    {
+        dq->retired = a->retired;
+        free(a);
+    }
+    free(atomic_load_explicit(&dq->array, memory_order_relaxed));
+    free(dq);
+}
+
+/**
+ * wsdeque_push - owner pushes a task at the bottom
+ * @dq: the deque
+ * @task: the task pointer
+ *
+ * The release fence publishes the slot before the new bottom, so a thief
+ * that sees the bottom also sees the task.
+ *
+ * Return: 0 for success, negative if the array could not grow
+ */
+int wsdeque_push(wsdeque_t *dq, void *task)
+{
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    wsarray_t *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+
+    if (b - t > (int64_t)a->size - 1)
+    {
+        if ((a = wsdeque_grow(dq, a, b, t)) == NULL)
+            return (-1);
+    }
+    wsarray_put(a, b, task);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    return (0);
+}
+
+/**
+ * wsdeque_pop - owner takes the newest task from the bottom
+ * @dq: the deque
+ * @taskp: returns the task
+ *
+ * Bottom is lowered first so thieves stop short of the slot, then top is
+ * read behind a full fence. Only when one task is left does the owner have
+ * to race the thieves for it with a compare-and-swap on top.
+ *
+ * Return: 0 for success, WSDEQUE_EMPTY otherwise
+ */
+int wsdeque_pop(wsdeque_t *dq, void **taskp)
+{
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    wsarray_t *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+    int64_t t;
+    int ret = 0;
+
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+    if (t > b)
+    {
+        /* already empty, restore bottom */
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return (WSDEQUE_EMPTY);
+    }
+    *taskp = wsarray_get(a, b);
+    if (t == b)
+    {
+        /* last task, a thief may be taking it right now */
+        if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                memory_order_seq_cst,
+                memory_order_relaxed))
+            ret = WSDEQUE_EMPTY;
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    }
+    return (ret);
+}
+
+/**
+ * wsdeque_steal - any thread takes the oldest task from the top
+ * @dq: the deque
+ * @taskp: returns the task
+ *
+ * Return: 0 for success, WSDEQUE_EMPTY if there was nothing to take or
+ * WSDEQUE_ABORT if another thread claimed the task first, in which case the
+ * caller may retry or move on to another victim.
+ */
+int wsdeque_steal(wsdeque_t *dq, void **taskp)
+{
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    int64_t b;
+    wsarray_t *a;
+    void *task;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+    if (t >= b)
+        return (WSDEQUE_EMPTY);
+    a = atomic_load_explicit(&dq->array, memory_order_acquire);
+    task = wsarray_get(a, t);
+    if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+            memory_order_seq_cst,
+            memory_order_relaxed))
+        return (WSDEQUE_ABORT);
+    *taskp = task;
+    return (0);
+}
+
+/**
+ * wsdeque_size - approximate number of tasks, exact if called by the owner
+ * while no thief is active
+ */
+size_t wsdeque_size(wsdeque_t *dq)
+{
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+    return (b > t ? (size_t)(b - t) : 0);
+}
@@ -0,0 +1,75 @@
+/*! \file wsdeque.h
+ *
+ * DRE 2024
+ *
+ * Chase-Lev work-stealing deque on circular array storage.
+ *
+ * The same circular array idea as the other ringbuffers, but with two ends:
+ * the owning thread pushes and pops tasks at the bottom like a stack, and
+ * any number of thief threads steal the oldest tasks from the top.
+ *
+ * - wsdeque_push and wsdeque_pop are owner-only and use no atomic
+ *   read-modify-write except when popping the very last task races a thief.
+ * - wsdeque_steal may be called from any thread and claims the top task
+ *   with a compare-and-swap.
+ * - When the array fills, the owner copies the live tasks into an array of
+ *   twice the size.  A thief can still be reading the old array, so old
+ *   arrays are retired onto a list and only freed by wsdeque_destroy; the
+ *   retired arrays never add up to more than the live array.
+ *
+ * Memory orders follow Le, Pop, Cohen and Zappa Nardelli, "Correct and
+ * Efficient Work-Stealing for Weak Memory Models", PPoPP 2013.
+ */
+
+#ifndef _WSDEQUE_H
+#define _WSDEQUE_H
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* int64_t */
+#include <stdatomic.h>  /* atomic_ operations */
+
+/// \def WSDEQUE_EMPTY returned by pop and steal when there is nothing to take
+#define WSDEQUE_EMPTY (-1)
+/// \def WSDEQUE_ABORT returned by steal when another thread won the race for the top task
+#define WSDEQUE_ABORT (-2)
+/// \def WSDEQUE_CACHE_LINE keeps top and bottom from sharing a cache line
+#define WSDEQUE_CACHE_LINE 64
+
+/**
+ * struct wsarray - circular task storage
+ * @size: number of slots, always a power of two
+ * @retired: next older array on the deque's retired list
+ * @slot: the tasks, indexed by position & (size - 1)
+ */
+typedef struct wsarray
+{
+    size_t size;
+    struct wsarray *retired;
+    _Atomic(void *) slot[];
+} wsarray_t;
+
+/**
+ * struct wsdeque - work-stealing deque
+ * @top: index of the oldest task, advanced by thieves (and the owner
+ *       when it pops the last task)
+ * @bottom: index one past the newest task, only written by the owner
+ * @array: the current circular array
+ * @retired: arrays replaced by growth, owner-only, freed on destroy
+ */
+typedef struct wsdeque
+{
+    _Alignas(WSDEQUE_CACHE_LINE) _Atomic(int64_t) top;
+    _Alignas(WSDEQUE_CACHE_LINE) _Atomic(int64_t) bottom;
+    _Atomic(wsarray_t *) array;
+    wsarray_t *retired;
+} wsdeque_t;
+
+/* externally visible prototypes */
+wsdeque_t *wsdeque_create(size_t size);
+void wsdeque_destroy(wsdeque_t *dq);
+int wsdeque_push(wsdeque_t *dq, void *task);
+int wsdeque_pop(wsdeque_t *dq, void **taskp);
+int wsdeque_steal(wsdeque_t *dq, void **taskp);
+size_t wsdeque_size(wsdeque_t *dq);
+
+#endif /* _WSDEQUE_H */